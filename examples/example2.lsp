@@ -1,6 +1,6 @@
 (load "library.lsp")
 (define counter 10)
-(while (> counter 0) 
+(while (>= counter 0) 
        (progn 
          (print "counter " counter) 
          (set! counter (- counter 1))))
@@ -4,7 +4,7 @@
 ; calculating exponents
 (let 
   ((c 10))
-  (while (> c -10)
+  (while (>= c -10)
          (progn
            (print "e^" c " = " (exp e c))
            (set! c (- c 1)))))
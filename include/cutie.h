@@ -1,3 +1,5 @@
+#include <stddef.h>
+
 #ifdef __cplusplus
 extern "C"
 {
@@ -12,6 +14,7 @@ typedef struct Error {
     Error_Type,
     Error_DivideByZero,
     Error_OutOfBounds,
+    Error_IO,
   } type;
 
   const char *message;
@@ -34,31 +37,297 @@ typedef enum {
   ATOM_MACRO,
   ATOM_STRING,
   ATOM_ERROR,
+  ATOM_LOCAL,
+  ATOM_SCOPE,
+  ATOM_FRAME,
+  ATOM_UNBOUND,
+  ATOM_EXPANSION,
+  ATOM_VECTOR,
+  ATOM_HASHTABLE,
+  ATOM_ARRAY,
 } AtomType;
 
+typedef enum {
+  SPECIAL_NONE,
+  SPECIAL_QUOTE,
+  SPECIAL_DEFINE,
+  SPECIAL_SET,
+  SPECIAL_PROGN,
+  SPECIAL_WHILE,
+  SPECIAL_LAMBDA,
+  SPECIAL_IF,
+  SPECIAL_DEFMACRO,
+  SPECIAL_LOAD,
+  SPECIAL_REQUIRE,
+  SPECIAL_PROVIDE,
+  SPECIAL_COND,
+  SPECIAL_LET,
+  SPECIAL_AND,
+  SPECIAL_OR,
+  SPECIAL_WHEN,
+  SPECIAL_UNLESS,
+} SpecialForm;
+
+/* ATOM REPRESENTATION
+ *
+ * By default an Atom is a type and a union, 16 bytes. Built with
+ * -DCUTIE_NAN_BOXING it is a single 64-bit word instead: a real is stored
+ * as itself, and any other value in the payload of a quiet NaN, with its
+ * type in the sign bit and the four bits below the quiet bit and a 47-bit
+ * pointer or integer under that. Integers too wide for 47 bits become
+ * reals, and heap pointers must fit in 47 bits, as user space addresses
+ * do on x86-64.
+ *
+ * Either way Atoms are only taken apart through the accessors below, and
+ * made with make_integer() and friends or atom_pointer(). */
+
+#ifndef CUTIE_NAN_BOXING
+
 struct Atom {
   AtomType type;
 
 union {
   struct Pair *pair;
-  char* symbol;
-  char* string;
+  struct Symbol *symbol;
+  struct Scope *scope;
+  struct Frame *frame;
+  struct String *string;
+  struct Vector *vector;
+  struct HashTable *hashtable;
+  struct Array *array;
   long int integer;
   double real;
   Builtin builtin;
 } value;
 };
 
+#define NIL_INITIALIZER {ATOM_NIL, {0}}
+
+#define atom_type(a) ((a).type)
+#define atom_pair(a) ((a).value.pair)
+#define atom_symbol(a) ((a).value.symbol)
+#define atom_scope(a) ((a).value.scope)
+#define atom_frame(a) ((a).value.frame)
+#define atom_vector(a) ((a).value.vector)
+#define atom_hashtable(a) ((a).value.hashtable)
+#define atom_array(a) ((a).value.array)
+#define atom_string(a) ((a).value.string)
+#define atom_integer(a) ((a).value.integer)
+#define atom_real(a) ((a).value.real)
+#define atom_builtin(a) ((a).value.builtin)
+
+/* An Atom of type pointing at p, for the types that hold pointers */
+static inline struct Atom atom_pointer(AtomType type, void *p)
+{
+  struct Atom a;
+  a.type = type;
+  a.value.pair = (struct Pair *)p;
+  return a;
+}
+
+/* The same pointer under another type, as closures are pairs */
+static inline struct Atom atom_retype(struct Atom a, AtomType type)
+{
+  a.type = type;
+  return a;
+}
+
+#else
+
+#include <stdint.h>
+
+struct Atom {
+  uint64_t bits;
+};
+
+#define NANBOX_QNAN    0x7ff8000000000000ULL
+#define NANBOX_PAYLOAD 0x00007fffffffffffULL
+#define NANBOX_TAG(bits) ((((bits) >> 59) & 16) | (((bits) >> 47) & 15))
+
+/* Tag 0 is left to reals, so the one NaN make_real() stores is a real */
+#define NIL_INITIALIZER {NANBOX_QNAN | (1ULL << 47)}
+
+static inline struct Atom atom_box(AtomType type, uint64_t payload)
+{
+  uint64_t tag = (uint64_t)type + 1;
+  struct Atom a;
+  a.bits = NANBOX_QNAN | ((tag & 16) << 59) | ((tag & 15) << 47)
+    | (payload & NANBOX_PAYLOAD);
+  return a;
+}
+
+static inline AtomType atom_type(struct Atom a)
+{
+  if ((a.bits & NANBOX_QNAN) != NANBOX_QNAN || NANBOX_TAG(a.bits) == 0)
+    return ATOM_REAL;
+  return (AtomType)(NANBOX_TAG(a.bits) - 1);
+}
+
+static inline double atom_real(struct Atom a)
+{
+  union { uint64_t bits; double real; } u;
+  u.bits = a.bits;
+  return u.real;
+}
+
+#define atom_payload(a) ((uintptr_t)((a).bits & NANBOX_PAYLOAD))
+#define atom_pair(a) ((struct Pair *)atom_payload(a))
+#define atom_symbol(a) ((struct Symbol *)atom_payload(a))
+#define atom_scope(a) ((struct Scope *)atom_payload(a))
+#define atom_frame(a) ((struct Frame *)atom_payload(a))
+#define atom_vector(a) ((struct Vector *)atom_payload(a))
+#define atom_hashtable(a) ((struct HashTable *)atom_payload(a))
+#define atom_array(a) ((struct Array *)atom_payload(a))
+#define atom_string(a) ((struct String *)atom_payload(a))
+#define atom_integer(a) ((long)((int64_t)((a).bits << 17) >> 17))
+#define atom_builtin(a) ((Builtin)atom_payload(a))
+
+static inline struct Atom atom_pointer(AtomType type, void *p)
+{
+  return atom_box(type, (uintptr_t)p);
+}
+
+static inline struct Atom atom_retype(struct Atom a, AtomType type)
+{
+  return atom_box(type, a.bits);
+}
+
+#endif
+
+
+/* Interned symbol. Bindings in the root environment are stored directly
+ * in the symbol's global value cell. */
+struct Symbol {
+  unsigned long hash;
+  size_t length;
+  SpecialForm special;
+  int bound;
+  struct Atom value;
+  char *name;
+};
 
 struct Pair {
 struct Atom atom[2];
 };
 
+/* Slot layout of a closure's frame: the parameters in order, then the
+ * rest parameter if there is one, then any internal DEFINEs. */
+struct Scope {
+  size_t count;
+  size_t params;
+  int rest;
+  struct Symbol **names;
+  struct Code *code;
+};
+
+/* A closure call frame. Slots are indexed by the closure's Scope;
+ * bindings DEFINEd at runtime under other names go on the extra alist. */
+struct Frame {
+  struct Atom parent;
+  struct Atom extra;
+  struct Scope *scope;
+  struct Atom *slots;
+};
+
+/* A string of length characters, see string.c. chars is NULL while the
+ * string is a rope of left and right; otherwise it points at the text,
+ * in this allocation or in that of base. */
+struct String {
+  size_t length;
+  char *chars;
+  struct Atom base;
+  struct Atom left;
+  struct Atom right;
+};
+
+/* A fixed-length vector; the items follow the header in one allocation */
+struct Vector {
+  size_t length;
+  struct Atom *items;
+};
+
+/* A hash table, see hash.c. While it grows, the buckets of the old array
+ * from migrated on have not been moved into the new one yet. */
+struct HashTable {
+  size_t count;
+  size_t capacity;
+  struct Atom *buckets;
+  struct Atom *old;
+  size_t old_capacity;
+  size_t migrated;
+};
+
+/* A homogeneous array of unboxed numbers, see array.c */
+enum {
+  ARRAY_F64,
+  ARRAY_I64,
+};
+
+struct Array {
+  int kind;
+  size_t length;
+  union {
+    double *f64;
+    long *i64;
+  } data;
+};
+
+/* Bytecode for a closure body or a top-level form, see compile.c. Each
+ * macro call site has a slot for its compiled expansion. Code that can
+ * not capture its frame keeps the last one it returned from for reuse. */
+struct Code {
+  size_t length;
+  size_t max_stack;
+  size_t nconstants;
+  size_t nsites;
+  int captures;
+  int *ops;
+  struct Atom *constants;
+  struct Code **sites;
+  struct Frame *spare;
+};
+
+/* VM instructions; their operands follow as further words */
+typedef enum {
+  OP_CONST,
+  OP_NIL,
+  OP_LOCAL,
+  OP_GLOBAL,
+  OP_NAME,
+  OP_SET_LOCAL,
+  OP_SET_NAME,
+  OP_DEFINE_LOCAL,
+  OP_DEFINE_NAME,
+  OP_POP,
+  OP_JUMP,
+  OP_JUMP_IF_NIL,
+  OP_JUMP_IF_TRUE_OR_POP,
+  OP_CLOSURE,
+  OP_MACRO,
+  OP_LOAD,
+  OP_REQUIRE,
+  OP_PROVIDE,
+  OP_EXPAND,
+  OP_TAIL_EXPAND,
+  OP_MACRO_GUARD,
+  OP_LET,
+  OP_UNLET,
+  OP_CALL,
+  OP_TAIL_CALL,
+  OP_RETURN,
+  OP_FAIL,
+} Opcode;
+
 typedef struct Atom Atom;
 
 extern const Atom nil;
-#define car(p) ((p).value.pair->atom[0])
-#define cdr(p) ((p).value.pair->atom[1])
+#define car(p) (atom_pair(p)->atom[0])
+#define cdr(p) (atom_pair(p)->atom[1])
+
+/* A macro call whose expansion has been cached has its operator replaced
+ * by an ATOM_EXPANSION, a (operator macro . expansion) list. */
+#define LOCAL_DEPTH(ref) (atom_integer(cdr(ref)) >> 16)
+#define LOCAL_INDEX(ref) (atom_integer(cdr(ref)) & 0xffff)
 
 int error_raised(Error err);
 Error make_error_ok(
@@ -75,14 +344,22 @@ Error make_error(
 #define ERROR_RAISED(err) error_raised((err))
 
 Atom cons(Atom car_val, Atom cdr_val);
+Atom make_list(size_t n);
 Atom make_integer(long x);
 Atom make_real(double x);
 Atom make_string(const char *s);
+Atom make_string_n(const char *s, size_t len);
 Atom make_symbol(const char *s);
+Atom make_symbol_n(const char *s, size_t len);
+Atom make_symbol_upcase(const char *s, size_t len);
+int symbol_next(size_t *index, Atom *symbol);
 Atom make_builtin(Builtin fn);
+Atom make_vector(size_t n, Atom fill);
+Atom list_to_vector(Atom list);
 Error make_closure(Atom env, Atom args, Atom body, Atom *result);
 
 /* Builtins */
+Atom integer_arithmetic(char op, long x, long y);
 Error builtin_add(Atom args, Atom *result);
 Error builtin_subtract(Atom args, Atom *result);
 Error builtin_multiply(Atom args, Atom *result);
@@ -90,15 +367,71 @@ Error builtin_divide(Atom args, Atom *result);
 
 Error builtin_numeq(Atom args, Atom *result);
 Error builtin_less(Atom args, Atom *result);
+Error builtin_greater(Atom args, Atom *result);
+Error builtin_less_equal(Atom args, Atom *result);
+Error builtin_greater_equal(Atom args, Atom *result);
 
 Error builtin_car(Atom args, Atom *result);
 Error builtin_cdr(Atom args, Atom *result);
 Error builtin_cons(Atom args, Atom *result);
 
+Error builtin_list(Atom args, Atom *result);
+Error builtin_length(Atom args, Atom *result);
+Error builtin_reverse(Atom args, Atom *result);
+Error builtin_append(Atom args, Atom *result);
+Error builtin_nth(Atom args, Atom *result);
+Error builtin_last(Atom args, Atom *result);
+Error builtin_map(Atom args, Atom *result);
+Error builtin_foldl(Atom args, Atom *result);
+Error builtin_foldr(Atom args, Atom *result);
+
+Error builtin_make_vector(Atom args, Atom *result);
+Error builtin_vector(Atom args, Atom *result);
+Error builtin_vector_ref(Atom args, Atom *result);
+Error builtin_vector_set(Atom args, Atom *result);
+Error builtin_vector_length(Atom args, Atom *result);
+Error builtin_vector_to_list(Atom args, Atom *result);
+Error builtin_list_to_vector(Atom args, Atom *result);
+Error builtin_vectorp(Atom args, Atom *result);
+
+Error builtin_equal(Atom args, Atom *result);
+Error builtin_make_hash_table(Atom args, Atom *result);
+Error builtin_hash_ref(Atom args, Atom *result);
+Error builtin_hash_set(Atom args, Atom *result);
+Error builtin_hash_remove(Atom args, Atom *result);
+Error builtin_hash_count(Atom args, Atom *result);
+Error builtin_hash_keys(Atom args, Atom *result);
+Error builtin_hash_to_list(Atom args, Atom *result);
+Error builtin_hash_for_each(Atom args, Atom *result);
+Error builtin_hash_tablep(Atom args, Atom *result);
+
+Error builtin_make_array(Atom args, Atom *result);
+Error builtin_list_to_array(Atom args, Atom *result);
+Error builtin_array_to_list(Atom args, Atom *result);
+Error builtin_array_ref(Atom args, Atom *result);
+Error builtin_array_set(Atom args, Atom *result);
+Error builtin_array_length(Atom args, Atom *result);
+Error builtin_array_sum(Atom args, Atom *result);
+Error builtin_array_dot(Atom args, Atom *result);
+Error builtin_array_add(Atom args, Atom *result);
+Error builtin_array_scale(Atom args, Atom *result);
+Error builtin_array_min(Atom args, Atom *result);
+Error builtin_array_max(Atom args, Atom *result);
+Error builtin_array_less(Atom args, Atom *result);
+Error builtin_array_greater(Atom args, Atom *result);
+Error builtin_array_numeq(Atom args, Atom *result);
+Error builtin_arrayp(Atom args, Atom *result);
+
 Error builtin_stringeq(Atom args, Atom *result);
 Error builtin_stringless(Atom args, Atom *result);
 Error builtin_stringconcat(Atom args, Atom *result);
 Error builtin_stringsubstr(Atom args, Atom *result);
+Error builtin_stringlength(Atom args, Atom *result);
+Error builtin_stringsearch(Atom args, Atom *result);
+Error builtin_stringindex(Atom args, Atom *result);
+Error builtin_stringsplit(Atom args, Atom *result);
+Error builtin_stringcount(Atom args, Atom *result);
+Error builtin_stringreplace(Atom args, Atom *result);
 
 Error apply(Atom fn, Atom args, Atom *result);
 Error builtin_apply(Atom args, Atom *result);
@@ -110,6 +443,9 @@ Error builtin_stringp(Atom args, Atom *result);
 Error builtin_symbolp(Atom args, Atom *result);
 Error builtin_numberp(Atom args, Atom *result);
 Error builtin_error(Atom args, Atom *result);
+Error builtin_gc(Atom args, Atom *result);
+Error builtin_gc_threshold(Atom args, Atom *result);
+Error builtin_macroexpand_all(Atom args, Atom *result);
 
 /* ENV */
 Atom create_env(Atom parent);
@@ -118,11 +454,87 @@ Atom setup_env();
 Error env_get(Atom env, Atom symbol, Atom *result);
 Error env_set(Atom env, Atom symbol, Atom value);
 Error env_set_existing(Atom env, Atom symbol, Atom value);
+Atom env_root(Atom env);
+
+Atom make_frame(Atom parent, struct Scope *scope);
+long scope_index(struct Scope *scope, struct Symbol *symbol);
+Error local_get(Atom env, Atom ref, Atom *result);
+Error local_set(Atom env, Atom ref, Atom value);
+Error local_define(Atom env, Atom ref, Atom value);
+
+/* Lexical addressing */
+enum {
+  LOCAL_NONE,
+  LOCAL_SLOT,
+  LOCAL_DYNAMIC,
+};
+
+int lookup_local(Atom symbol, struct Scope *scope, Atom env,
+    long *depth, long *index);
+Atom make_local(Atom symbol, long depth, long index);
+Atom resolve_body(Atom env, Atom args, Atom body);
+Error resolve_let(Atom env, Atom args, struct Scope **scope);
+
+/* Macro expansion */
+Error expand_call(Atom form, Atom macro, Atom *expansion);
+void  expand_body(Atom env, Atom args, Atom body);
+void  expand_form(Atom env, Atom expr);
+Atom  macroexpand_all(Atom expr);
+
+/* Hash tables */
+unsigned long hash_atom(Atom key);
+int   atom_equal(Atom a, Atom b);
+Atom  make_hash_table(void);
+Atom  hash_get(Atom table, Atom key);
+void  hash_put(Atom table, Atom key, Atom value);
+int   hash_remove(Atom table, Atom key);
+Atom  hash_entries(Atom table);
+
+/* Strings */
+const char *string_chars(Atom s);
+const char *string_bytes(Atom s);
+Atom  string_concat(Atom a, Atom b);
+Atom  string_slice(Atom s, size_t start, size_t len);
+int   string_compare(Atom a, Atom b);
+long  string_search(Atom s, Atom pattern, size_t from);
+long  string_index(Atom s, Atom set, size_t from);
+
+/* Numeric arrays */
+Atom  make_array(int kind, size_t n);
+Atom  array_ref(Atom array, size_t i);
+void  array_set(Atom array, size_t i, Atom value);
+Atom  array_sum(Atom array);
+Atom  array_dot(Atom x, Atom y);
+Atom  array_add(Atom x, Atom y);
+Atom  array_scale(Atom x, Atom k);
+Atom  array_extreme(Atom array, int max);
+Atom  array_compare(int op, Atom x, Atom y);
+
+/* Bytecode */
+enum {
+  ENGINE_TREE,
+  ENGINE_VM,
+};
+
+int   cutie_engine(int engine);
+Error compile_thunk(Atom expr, Atom env, struct Code **code);
+Error compile_closure(Atom fn, struct Code **code);
+Error vm_eval(Atom expr, Atom env, Atom *result);
+Error vm_apply(Atom fn, Atom args, Atom *result);
+void  vm_mark(void);
 
 /* IO */
 void print_expr(Atom atom);
 void print_line();
 void print_error(Error err);
+
+/* Reader character classes, see read.c */
+#define CHAR_SPACE  1
+#define CHAR_DELIM  2   /* ends an atom: white space, parentheses, NUL */
+#define CHAR_PREFIX 4   /* a token by itself: ( ) ' ` */
+#define CHAR_DIGIT  8
+extern const unsigned char char_class[256];
+
 Error lex(const char *str, const char **start, const char **end);
 Error read_expr(const char *input, const char **end, Atom *result);
 Error parse_simple(const char *start, const char *end, Atom *result);
@@ -135,16 +547,56 @@ Error cutie_parse(const char *input, Atom *result);
 int nilp(Atom atom);
 int listp(Atom expr);
 Atom copy_list(Atom list);
+void init_special_forms();
 Error eval_expr(Atom expr, Atom env, Atom *result);
 Error apply(Atom fn, Atom args, Atom *result);
 
+/* Reader ports, see port.c */
+struct Port;
+struct Port *port_open_fd(int fd);
+struct Port *port_open_file(const char *path);
+Error port_read(struct Port *port, Atom *result);
+void  port_close(struct Port *port);
+
 /* Load list code */
 char *slurp(const char *path);
+int load_port(Atom env, struct Port *port);
 int load_file(Atom env, const char *path);
+Error load_path(Atom env, const char *path);
+Error load_module(Atom env, const char *path, int *loaded);
+Error require_module(Atom env, Atom module, Atom path, Atom *result);
+Error provide_feature(Atom env, Atom feature, Atom *result);
+
+/* Heap images, see image.c */
+void  image_register_builtins(void);
+Error image_save(Atom env, const char *path);
+Error image_load(Atom env, const char *path);
 
 void* cutie_malloc(unsigned int sz);
 void  cutie_free(void* p);
 void  cutie_mem();
+void  cutie_symbols();
+
+/* Garbage collection */
+enum {
+  GC_PAIR,
+  GC_STRING,
+  GC_DATA,
+  GC_FRAME,
+  GC_SCOPE,
+  GC_CODE,
+  GC_VECTOR,
+  GC_HASHTABLE,
+};
+
+void*  gc_alloc(int kind, size_t sz);
+struct Pair* gc_alloc_pair(void);
+struct Pair* gc_alloc_pairs(size_t n, size_t *got);
+void   gc_mark(Atom root);
+void   gc_mark_code(struct Code *code);
+size_t cutie_gc(void);
+size_t cutie_gc_threshold(size_t bytes);
+void   cutie_gc_protect(Atom root);
 
 #ifdef __cplusplus
 }
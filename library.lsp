@@ -14,10 +14,6 @@
                     (list 'quasiquote (cdr x)))))
       (list 'quote x)))
 
-(defmacro (let defs . body)
-  `((lambda ,(map car defs) ,@body)
-    ,@(map cadr defs)))
-
 (defmacro (ignore x)
   `(quote ,x))
 
@@ -25,30 +21,8 @@
   `(,@x))
 
 ;;; CORE FUNCTIONAL FEATURES
-(define (foldl proc init list)
-  (if list
-      (foldl proc
-             (proc init (car list))
-             (cdr list))
-      init))
-
-(define (foldr proc init list)
-  (if list
-      (proc (car list)
-            (foldr proc init (cdr list)))
-      init))
-
-(define (unary-map proc list)
-  (foldr (lambda (x rest) (cons (proc x) rest))
-         nil
-         list))
-
-(define (map proc . arg-lists)
-  (if (car arg-lists)
-      (cons (apply proc (unary-map car arg-lists))
-            (apply map (cons proc
-                             (unary-map cdr arg-lists))))
-      nil))
+;; map, foldl, foldr, list, length, reverse, append, nth and last are
+;; builtins
 
 ; y-combinator
 (define Y
@@ -59,15 +33,7 @@
  
 
 ;; FLOW CONTROL
-(defmacro (when condition . body)
-    `(if ,condition
-       (progn ,@body)
-       nil))
-
-(defmacro (unless condition . body)
-    `(if ,condition 
-       nil 
-       (progn ,@body)))
+;; cond, let, and, or, when and unless are special forms
 
 (defmacro (for-each fn seq)
   `(progn (map nil ,fn ,seq) t))
@@ -79,9 +45,6 @@
        (and-list (cdr ,body)))
      T))
 
-(define (and . body)
-  (and-list body))
-
 (defmacro (or-list body)
   `(if ,body
      (if (null? (car ,body))
@@ -89,19 +52,6 @@
        T)
      nil))
 
-(define (or . body)
-  (or-list body))
-
-(defmacro (cond . clauses)
-  (if (pair? clauses)
-    (let 
-      ((first (car clauses))
-       (rest (cdr clauses)))
-      `(if ,(car first)
-         (progn ,@(cdr first))
-            (cond ,@rest)))
-    nil))
-
 ;;; List stuff
 (define (first sx) (car sx))
 (define (rest sx) (cdr sx))
@@ -114,46 +64,23 @@
 (define (cddr x)  (cdr (cdr x)))
 (define (cdddr x) (cdr (cdr (cdr x))))
 
-(define (length list)
-  (if (eq? nil list)
-    0
-    (+ 1 (length (rest list)))))
-
-(define (last list)
-  (if (cdr list)
-    (last (cdr list))
-    (car list)))
-
-(define (list . items)
-  (foldr cons nil items))
-
-(define (reverse list)
-  (foldl (lambda (a x) (cons x a)) nil list))
-
-(defmacro (append . ls)
-  `(foldr cons () ,@ls))
-
 (define (circular lst)
   (set! (cdr (last lst)) lst))
 
-(define (list-eq? a b) 
-  (if (= (car a) (car b))
-    (list-eq? (cdr a) (cdr b))
-    nil))
-
-(define (append a b) (foldr cons b a))
-
-(define (nth pos list)
-  (if (= 0 pos)
-    (car list)
-    (nth (- pos 1) (cdr list))))
+(define (list-eq? a b)
+  (if a
+    (if b
+      (if (= (car a) (car b))
+        (list-eq? (cdr a) (cdr b))
+        nil)
+      nil)
+    (null? b)))
 
   ;; Math & logic
 (define e 2.718281828459045)
 (define pi 3.14159)
 
 (define eq =) ; this might be wrong.
-(define (> a b) (if (< a b) nil T))
 (define (abs x) (if (< x 0) (- 0 x) x))
 (define (min x y) (if (> x y) y x))
 (define (max x y) (if (< x y) y x))
@@ -163,13 +90,6 @@
 (define (rem a b)
   (- a (* b (/ a b))))
 
-(define +
-  (let ((old+ +))
-    (lambda xs (foldl old+ 0 xs))))
-(define *
-  (let ((old* *))
-    (lambda xs (foldl old* 1 xs))))
-
 
 (define (exp a n)
   (if (> n 0)
@@ -202,9 +122,7 @@
 (define string< string-lessp)
 (define string> string-greaterp)
 
-(define string-concat
-  (let ((old-sc string-concat))
-    (lambda xs (foldl old-sc "" xs))))
+;; string-concat is a builtin taking any number of strings
 
 ;;; Basic tests
 (define (fact n)
@@ -213,7 +131,7 @@
      (* n (fact (- n 1)))))
 
 (define (fib n)
-  (if (> 1 n)
+  (if (>= 1 n)
     1
     (+ (fib (- n 1)) (fib (- n 2))))) 
 
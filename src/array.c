@@ -0,0 +1,296 @@
+#include <stdint.h>
+
+#include "cutie.h"
+
+/* NUMERIC ARRAYS
+ *
+ * An array holds unboxed f64 or i64 elements in one flat buffer, aligned
+ * for the widest vector loads. The kernels below are plain loops written
+ * so the compiler vectorizes them; on x86-64 Linux each is also built for
+ * AVX2 and the best version for the CPU is picked when the program
+ * starts, through an ifunc. Elsewhere the baseline build is used. */
+
+#if defined(__GNUC__) && defined(__x86_64__) && defined(__linux__)
+#define KERNEL __attribute__((target_clones("avx2", "default")))
+#else
+#define KERNEL
+#endif
+
+#define ARRAY_ALIGN 32
+
+Atom make_array(int kind, size_t n)
+{
+  struct Array *a = gc_alloc(GC_DATA,
+      sizeof(struct Array) + n * sizeof(double) + ARRAY_ALIGN - 1);
+  uintptr_t data = ((uintptr_t)(a + 1) + ARRAY_ALIGN - 1)
+    & ~(uintptr_t)(ARRAY_ALIGN - 1);
+  size_t i;
+
+  a->kind = kind;
+  a->length = n;
+  a->data.f64 = (double *)data;
+  if (kind == ARRAY_F64) {
+    for (i = 0; i < n; i++)
+      a->data.f64[i] = 0.0;
+  } else {
+    for (i = 0; i < n; i++)
+      a->data.i64[i] = 0;
+  }
+  return atom_pointer(ATOM_ARRAY, a);
+}
+
+Atom array_ref(Atom array, size_t i)
+{
+  struct Array *a = atom_array(array);
+  return a->kind == ARRAY_F64 ? make_real(a->data.f64[i])
+    : make_integer(a->data.i64[i]);
+}
+
+/* value must be a number; reals stored in an i64 array are truncated */
+void array_set(Atom array, size_t i, Atom value)
+{
+  struct Array *a = atom_array(array);
+  int real = atom_type(value) == ATOM_REAL;
+
+  if (a->kind == ARRAY_F64)
+    a->data.f64[i] = real ? atom_real(value) : (double)atom_integer(value);
+  else
+    a->data.i64[i] = real ? (long)atom_real(value) : atom_integer(value);
+}
+
+/* Kernels */
+
+KERNEL static double sum_f64(const double *x, size_t n)
+{
+  double s = 0.0;
+  size_t i;
+  for (i = 0; i < n; i++)
+    s += x[i];
+  return s;
+}
+
+KERNEL static long sum_i64(const long *x, size_t n)
+{
+  long s = 0;
+  size_t i;
+  for (i = 0; i < n; i++)
+    s += x[i];
+  return s;
+}
+
+KERNEL static double dot_f64(const double *x, const double *y, size_t n)
+{
+  double s = 0.0;
+  size_t i;
+  for (i = 0; i < n; i++)
+    s += x[i] * y[i];
+  return s;
+}
+
+KERNEL static long dot_i64(const long *x, const long *y, size_t n)
+{
+  long s = 0;
+  size_t i;
+  for (i = 0; i < n; i++)
+    s += x[i] * y[i];
+  return s;
+}
+
+KERNEL static void add_f64(const double *x, const double *y, double *out,
+    size_t n)
+{
+  size_t i;
+  for (i = 0; i < n; i++)
+    out[i] = x[i] + y[i];
+}
+
+KERNEL static void add_i64(const long *x, const long *y, long *out, size_t n)
+{
+  size_t i;
+  for (i = 0; i < n; i++)
+    out[i] = x[i] + y[i];
+}
+
+KERNEL static void scale_f64(const double *x, double k, double *out,
+    size_t n)
+{
+  size_t i;
+  for (i = 0; i < n; i++)
+    out[i] = x[i] * k;
+}
+
+KERNEL static void scale_i64(const long *x, long k, long *out, size_t n)
+{
+  size_t i;
+  for (i = 0; i < n; i++)
+    out[i] = x[i] * k;
+}
+
+KERNEL static void widen_i64(const long *x, double *out, size_t n)
+{
+  size_t i;
+  for (i = 0; i < n; i++)
+    out[i] = (double)x[i];
+}
+
+KERNEL static double min_f64(const double *x, size_t n)
+{
+  double m = x[0];
+  size_t i;
+  for (i = 1; i < n; i++)
+    m = x[i] < m ? x[i] : m;
+  return m;
+}
+
+KERNEL static long min_i64(const long *x, size_t n)
+{
+  long m = x[0];
+  size_t i;
+  for (i = 1; i < n; i++)
+    m = x[i] < m ? x[i] : m;
+  return m;
+}
+
+KERNEL static double max_f64(const double *x, size_t n)
+{
+  double m = x[0];
+  size_t i;
+  for (i = 1; i < n; i++)
+    m = x[i] > m ? x[i] : m;
+  return m;
+}
+
+KERNEL static long max_i64(const long *x, size_t n)
+{
+  long m = x[0];
+  size_t i;
+  for (i = 1; i < n; i++)
+    m = x[i] > m ? x[i] : m;
+  return m;
+}
+
+KERNEL static void compare_f64(int op, const double *x, const double *y,
+    long *out, size_t n)
+{
+  size_t i;
+  switch (op) {
+    case '<':
+      for (i = 0; i < n; i++)
+        out[i] = x[i] < y[i];
+      break;
+    case '>':
+      for (i = 0; i < n; i++)
+        out[i] = x[i] > y[i];
+      break;
+    default:
+      for (i = 0; i < n; i++)
+        out[i] = x[i] == y[i];
+      break;
+  }
+}
+
+KERNEL static void compare_i64(int op, const long *x, const long *y,
+    long *out, size_t n)
+{
+  size_t i;
+  switch (op) {
+    case '<':
+      for (i = 0; i < n; i++)
+        out[i] = x[i] < y[i];
+      break;
+    case '>':
+      for (i = 0; i < n; i++)
+        out[i] = x[i] > y[i];
+      break;
+    default:
+      for (i = 0; i < n; i++)
+        out[i] = x[i] == y[i];
+      break;
+  }
+}
+
+/* Operations. Arrays passed together must be of the same kind and
+ * length; the builtins check this. */
+
+Atom array_sum(Atom array)
+{
+  struct Array *a = atom_array(array);
+  return a->kind == ARRAY_F64 ? make_real(sum_f64(a->data.f64, a->length))
+    : make_integer(sum_i64(a->data.i64, a->length));
+}
+
+Atom array_dot(Atom x, Atom y)
+{
+  struct Array *a = atom_array(x), *b = atom_array(y);
+  return a->kind == ARRAY_F64
+    ? make_real(dot_f64(a->data.f64, b->data.f64, a->length))
+    : make_integer(dot_i64(a->data.i64, b->data.i64, a->length));
+}
+
+Atom array_add(Atom x, Atom y)
+{
+  Atom result = make_array(atom_array(x)->kind, atom_array(x)->length);
+  struct Array *a = atom_array(x), *b = atom_array(y);
+
+  if (a->kind == ARRAY_F64)
+    add_f64(a->data.f64, b->data.f64, atom_array(result)->data.f64, a->length);
+  else
+    add_i64(a->data.i64, b->data.i64, atom_array(result)->data.i64, a->length);
+  return result;
+}
+
+/* An i64 array scaled by an integer stays i64; otherwise the result is
+ * f64 */
+Atom array_scale(Atom x, Atom k)
+{
+  struct Array *a = atom_array(x);
+  Atom result;
+  double *out;
+
+  if (a->kind == ARRAY_I64 && atom_type(k) == ATOM_INTEGER) {
+    result = make_array(ARRAY_I64, a->length);
+    scale_i64(a->data.i64, atom_integer(k), atom_array(result)->data.i64,
+        a->length);
+    return result;
+  }
+
+  result = make_array(ARRAY_F64, a->length);
+  out = atom_array(result)->data.f64;
+  if (a->kind == ARRAY_I64) {
+    widen_i64(a->data.i64, out, a->length);
+    scale_f64(out, atom_real(k), out, a->length);
+  } else
+    scale_f64(a->data.f64, atom_type(k) == ATOM_REAL ? atom_real(k)
+        : (double)atom_integer(k), out, a->length);
+  return result;
+}
+
+/* The least or, with max set, the greatest element; nil when empty */
+Atom array_extreme(Atom array, int max)
+{
+  struct Array *a = atom_array(array);
+
+  if (a->length == 0)
+    return nil;
+  if (a->kind == ARRAY_F64)
+    return make_real(max ? max_f64(a->data.f64, a->length)
+        : min_f64(a->data.f64, a->length));
+  return make_integer(max ? max_i64(a->data.i64, a->length)
+      : min_i64(a->data.i64, a->length));
+}
+
+/* An i64 array of 1 where the elements compare by op ('<', '>' or '=')
+ * and 0 where they do not */
+Atom array_compare(int op, Atom x, Atom y)
+{
+  Atom result = make_array(ARRAY_I64, atom_array(x)->length);
+  struct Array *a = atom_array(x), *b = atom_array(y);
+
+  if (a->kind == ARRAY_F64)
+    compare_f64(op, a->data.f64, b->data.f64, atom_array(result)->data.i64,
+        a->length);
+  else
+    compare_i64(op, a->data.i64, b->data.i64, atom_array(result)->data.i64,
+        a->length);
+  return result;
+}
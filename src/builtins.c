@@ -1,141 +1,186 @@
+#include <limits.h>
 #include <string.h>
 #include <stdlib.h>
 
 #include "cutie.h"
 
 int is_numeric(Atom a) {
-  return a.type == ATOM_REAL || a.type == ATOM_INTEGER;
+  return atom_type(a) == ATOM_REAL || atom_type(a) == ATOM_INTEGER;
 }
 
 double get_real_value(Atom a) {
-  return a.type == ATOM_INTEGER ? (double)a.value.integer : a.value.real;
+  return atom_type(a) == ATOM_INTEGER ? (double)atom_integer(a) : atom_real(a);
 }
 
-/* Builtins */
-Error builtin_add(Atom args, Atom *result)
+/* x op y for two integers, op one of + - * /, with y non-zero for /. A
+ * result too wide for a long is given as a real rather than wrapping.
+ * The VM's inlined arithmetic uses this too, so both engines agree. */
+Atom integer_arithmetic(char op, long x, long y)
 {
-  Atom a, b;
+  long z;
+
+  switch (op) {
+  case '+':
+    if (__builtin_add_overflow(x, y, &z))
+      return make_real((double)x + (double)y);
+    break;
+  case '-':
+    if (__builtin_sub_overflow(x, y, &z))
+      return make_real((double)x - (double)y);
+    break;
+  case '*':
+    if (__builtin_mul_overflow(x, y, &z))
+      return make_real((double)x * (double)y);
+    break;
+  default:
+    if (x == LONG_MIN && y == -1)
+      return make_real(-(double)LONG_MIN);
+    z = x / y;
+    break;
+  }
+  return make_integer(z);
+}
 
-  if (nilp(args) || nilp(cdr(args)) || !nilp(cdr(cdr(args))))
-    return ERROR(Error_Args, "Requires two arguments.");
+/* Builtins */
 
-  a = car(args);
-  b = car(cdr(args));
+/* Fold the numeric arguments with op, one of + - * /. The result is an
+ * integer while every argument is, and a real from the first real on,
+ * or from the first integer result that would overflow. A single
+ * argument to - or / is negated or inverted. */
+static Error arithmetic(char op, Atom args, Atom *result)
+{
+  Atom acc, b;
+
+  if (nilp(args)) {
+    if (op == '-' || op == '/')
+      return ERROR(Error_Args, "Requires at least one argument.");
+    *result = make_integer(op == '*' ? 1 : 0);
+    return ERROR_OK();
+  }
 
-  if (!is_numeric(a) || !is_numeric(b))
+  acc = car(args);
+  args = cdr(args);
+  if (!is_numeric(acc))
     return ERROR(Error_Type, "Arguments must be numeric.");
 
-  if (a.type == ATOM_REAL || b.type == ATOM_REAL)
-      *result = make_real(get_real_value(a) + get_real_value(b));
-    else
-      *result = make_integer(a.value.integer + b.value.integer);
+  if (nilp(args) && (op == '-' || op == '/')) {
+    args = cons(acc, nil);
+    acc = make_integer(op == '-' ? 0 : 1);
+  }
+
+  for (; !nilp(args); args = cdr(args)) {
+    b = car(args);
+    if (!is_numeric(b))
+      return ERROR(Error_Type, "Arguments must be numeric.");
+
+    if (op == '/' && get_real_value(b) == 0)
+      return ERROR(Error_DivideByZero, "Divisor is zero.");
+
+    if (atom_type(acc) == ATOM_REAL || atom_type(b) == ATOM_REAL) {
+      double x = get_real_value(acc), y = get_real_value(b);
+
+      switch (op) {
+      case '+': acc = make_real(x + y); break;
+      case '-': acc = make_real(x - y); break;
+      case '*': acc = make_real(x * y); break;
+      default:  acc = make_real(x / y); break;
+      }
+    } else {
+      acc = integer_arithmetic(op, atom_integer(acc), atom_integer(b));
+    }
+  }
 
+  *result = acc;
   return ERROR_OK();
 }
 
-Error builtin_subtract(Atom args, Atom *result)
+Error builtin_add(Atom args, Atom *result)
 {
-  Atom a, b;
-
-  if (nilp(args) || nilp(cdr(args)) || !nilp(cdr(cdr(args))))
-    return ERROR(Error_Args, "Requires two arguments.");
-
-  a = car(args);
-  b = car(cdr(args));
-
-  if (!is_numeric(a) || !is_numeric(b))
-    return ERROR(Error_Type, "Arguments must be numeric.");
-
-  if (a.type == ATOM_REAL || b.type == ATOM_REAL)
-      *result = make_real(get_real_value(a) - get_real_value(b));
-    else
-      *result = make_integer(a.value.integer - b.value.integer);
+  return arithmetic('+', args, result);
+}
 
-  return ERROR_OK();
+Error builtin_subtract(Atom args, Atom *result)
+{
+  return arithmetic('-', args, result);
 }
 
 Error builtin_multiply(Atom args, Atom *result)
 {
-  Atom a, b;
-
-  if (nilp(args) || nilp(cdr(args)) || !nilp(cdr(cdr(args))))
-    return ERROR(Error_Args, "Requires two arguments.");
-
-  a = car(args);
-  b = car(cdr(args));
-
-  if (!is_numeric(a) || !is_numeric(b))
-    return ERROR(Error_Type, "Arguments must be numeric.");
-
-  if (a.type == ATOM_REAL || b.type == ATOM_REAL)
-      *result = make_real(get_real_value(a) * get_real_value(b));
-    else
-      *result = make_integer(a.value.integer * b.value.integer);
-
-  return ERROR_OK();
+  return arithmetic('*', args, result);
 }
 
 Error builtin_divide(Atom args, Atom *result)
+{
+  return arithmetic('/', args, result);
+}
+
+/* Compare each numeric argument with the next; true when every pair is
+ * ordered by op. Integers are compared as integers, anything mixed with
+ * a real as reals. */
+static Error compare(int op, Atom args, Atom *result)
 {
   Atom a, b;
+  int ordered = 1;
 
-  if (nilp(args) || nilp(cdr(args)) || !nilp(cdr(cdr(args))))
-    return ERROR(Error_Args, "Requires two arguments.");
+  if (nilp(args))
+    return ERROR(Error_Args, "Requires at least one argument.");
 
   a = car(args);
-  b = car(cdr(args));
-
-  if (!is_numeric(a) || !is_numeric(b))
+  if (!is_numeric(a))
     return ERROR(Error_Type, "Arguments must be numeric.");
 
-  if (get_real_value(b) == 0)
-    return ERROR(Error_DivideByZero, "Divisor is zero.");
+  for (args = cdr(args); !nilp(args); args = cdr(args)) {
+    int c;
 
-  if (a.type == ATOM_REAL || b.type == ATOM_REAL)
-      *result = make_real(get_real_value(a) / get_real_value(b));
-    else
-      *result = make_integer(a.value.integer / b.value.integer);
+    b = car(args);
+    if (!is_numeric(b))
+      return ERROR(Error_Type, "Arguments must be numeric.");
+
+    if (atom_type(a) == ATOM_REAL || atom_type(b) == ATOM_REAL) {
+      double x = get_real_value(a), y = get_real_value(b);
+      c = (x > y) - (x < y);
+    } else {
+      c = (atom_integer(a) > atom_integer(b))
+        - (atom_integer(a) < atom_integer(b));
+    }
 
+    switch (op) {
+    case '=': ordered &= c == 0; break;
+    case '<': ordered &= c < 0;  break;
+    case '>': ordered &= c > 0;  break;
+    case 'l': ordered &= c <= 0; break;
+    default:  ordered &= c >= 0; break;
+    }
+    a = b;
+  }
+
+  *result = ordered ? make_symbol("T") : nil;
   return ERROR_OK();
 }
 
 Error builtin_numeq(Atom args, Atom *result)
 {
-  Atom a, b;
-
-  if (nilp(args) || nilp(cdr(args)) || !nilp(cdr(cdr(args))))
-    return ERROR(Error_Args, "Requires two arguments.");
-
-  a = car(args);
-  b = car(cdr(args));
-
-  if (!is_numeric(a) || !is_numeric(b))
-    return ERROR(Error_Type, "Arguments must be numeric.");
-
-  if (a.type == ATOM_REAL || b.type == ATOM_REAL)
-    *result = (get_real_value(a) == get_real_value(b)) ? make_symbol("T") : nil;
-  else
-    *result = (a.value.integer == b.value.integer) ? make_symbol("T") : nil;
-
-  return ERROR_OK();
+  return compare('=', args, result);
 }
 
 Error builtin_less(Atom args, Atom *result)
 {
-  Atom a, b;
-
-  if (nilp(args) || nilp(cdr(args)) || !nilp(cdr(cdr(args))))
-    return ERROR(Error_Args, "Requires two arguments.");
-
-  a = car(args);
-  b = car(cdr(args));
+  return compare('<', args, result);
+}
 
-  if (a.type != ATOM_INTEGER || b.type != ATOM_INTEGER)
-    return ERROR(Error_Type, "Arguments must be integers.");
+Error builtin_greater(Atom args, Atom *result)
+{
+  return compare('>', args, result);
+}
 
-  *result = (a.value.integer < b.value.integer) ? make_symbol("T") : nil;
+Error builtin_less_equal(Atom args, Atom *result)
+{
+  return compare('l', args, result);
+}
 
-  return ERROR_OK();
+Error builtin_greater_equal(Atom args, Atom *result)
+{
+  return compare('g', args, result);
 }
 
 Error builtin_car(Atom args, Atom *result)
@@ -145,7 +190,7 @@ Error builtin_car(Atom args, Atom *result)
 
   if (nilp(car(args))) {
     *result = nil;
-  } else if (car(args).type != ATOM_PAIR) {
+  } else if (atom_type(car(args)) != ATOM_PAIR) {
     print_expr(args);
     return ERROR(Error_Type, "CAR argument must be pair.");
   } else
@@ -161,7 +206,7 @@ Error builtin_cdr(Atom args, Atom *result)
 
   if (nilp(car(args))) {
     *result = nil;
-  } else if (car(args).type != ATOM_PAIR) {
+  } else if (atom_type(car(args)) != ATOM_PAIR) {
     print_expr(args);
     return ERROR(Error_Type, "Argument must be pair.");
   } else
@@ -190,10 +235,10 @@ Error builtin_stringeq(Atom args, Atom *result)
   a = car(args);
   b = car(cdr(args));
 
-  if (a.type != ATOM_STRING || b.type != ATOM_STRING)
+  if (atom_type(a) != ATOM_STRING || atom_type(b) != ATOM_STRING)
     return ERROR(Error_Type, "Arguments must be strings.");
 
-  *result = (strcmp(a.value.string, b.value.string) == 0) ? make_symbol("T") : nil;
+  *result = (string_compare(a, b) == 0) ? make_symbol("T") : nil;
 
   return ERROR_OK();
 }
@@ -208,11 +253,11 @@ Error builtin_stringless(Atom args, Atom *result)
   a = car(args);
   b = car(cdr(args));
 
-  if (a.type != ATOM_STRING || b.type != ATOM_STRING)
+  if (atom_type(a) != ATOM_STRING || atom_type(b) != ATOM_STRING)
     return ERROR(Error_Type, "Arguments must be strings.");
 
 
-  char *s1 = a.value.string, *s2 = b.value.string;
+  const char *s1 = string_chars(a), *s2 = string_chars(b);
   int index = 0;
   while( (*s1 != '\0') && (*s1 == *s2) ){
       s1++;
@@ -223,24 +268,187 @@ Error builtin_stringless(Atom args, Atom *result)
   return ERROR_OK();
 }
 
-Error builtin_stringconcat(Atom args, Atom *result)
+/* The two strings of args and, if given, a start offset after them */
+static Error string_args(Atom args, size_t *from)
 {
-  Atom a, b;
+  Atom start;
 
-  if (nilp(args) || nilp(cdr(args)) || !nilp(cdr(cdr(args))))
+  if (nilp(args) || nilp(cdr(args))
+      || (!nilp(cdr(cdr(args))) && !nilp(cdr(cdr(cdr(args))))))
+    return ERROR(Error_Args, "Requires two or three arguments.");
+  if (atom_type(car(args)) != ATOM_STRING
+      || atom_type(car(cdr(args))) != ATOM_STRING)
+    return ERROR(Error_Type, "Arguments must be strings.");
+
+  *from = 0;
+  if (!nilp(cdr(cdr(args)))) {
+    start = car(cdr(cdr(args)));
+    if (atom_type(start) != ATOM_INTEGER || atom_integer(start) < 0)
+      return ERROR(Error_Type, "Start must be a non-negative integer.");
+    *from = atom_integer(start);
+  }
+  return ERROR_OK();
+}
+
+/* (string-search s pattern [start]) is the offset of pattern in s */
+Error builtin_stringsearch(Atom args, Atom *result)
+{
+  size_t from = 0;
+  long i;
+  Error err = string_args(args, &from);
+
+  if (ERROR_RAISED(err))
+    return err;
+
+  i = string_search(car(args), car(cdr(args)), from);
+  *result = i < 0 ? nil : make_integer(i);
+  return ERROR_OK();
+}
+
+/* (string-index s chars [start]) is the offset of the first of chars in s */
+Error builtin_stringindex(Atom args, Atom *result)
+{
+  size_t from = 0;
+  long i;
+  Error err = string_args(args, &from);
+
+  if (ERROR_RAISED(err))
+    return err;
+
+  i = string_index(car(args), car(cdr(args)), from);
+  *result = i < 0 ? nil : make_integer(i);
+  return ERROR_OK();
+}
+
+/* (string-split s separator) is the list of the pieces of s between
+ * separators, each sharing the text of s */
+Error builtin_stringsplit(Atom args, Atom *result)
+{
+  Atom s, sep, head = nil, tail = nil, cell;
+  size_t from = 0;
+  long i;
+  Error err = string_args(args, &from);
+
+  if (ERROR_RAISED(err))
+    return err;
+  if (!nilp(cdr(cdr(args))))
     return ERROR(Error_Args, "Requires two arguments.");
 
-  a = car(args);
-  b = car(cdr(args));
+  s = car(args);
+  sep = car(cdr(args));
+  if (atom_string(sep)->length == 0)
+    return ERROR(Error_Type, "Separator must not be empty.");
+
+  for (;;) {
+    i = string_search(s, sep, from);
+    cell = cons(string_slice(s, from,
+          (i < 0 ? (long)atom_string(s)->length : i) - from), nil);
+    if (nilp(head))
+      head = cell;
+    else
+      cdr(tail) = cell;
+    tail = cell;
+    if (i < 0)
+      break;
+    from = i + atom_string(sep)->length;
+  }
+
+  *result = head;
+  return ERROR_OK();
+}
+
+/* (string-count s pattern) counts the occurrences of pattern in s that
+ * do not overlap */
+Error builtin_stringcount(Atom args, Atom *result)
+{
+  size_t from = 0;
+  long i, n = 0;
+  Error err = string_args(args, &from);
+
+  if (ERROR_RAISED(err))
+    return err;
+  if (!nilp(cdr(cdr(args))))
+    return ERROR(Error_Args, "Requires two arguments.");
+  if (atom_string(car(cdr(args)))->length == 0)
+    return ERROR(Error_Type, "Pattern must not be empty.");
+
+  while ((i = string_search(car(args), car(cdr(args)), from)) >= 0) {
+    n++;
+    from = i + atom_string(car(cdr(args)))->length;
+  }
+
+  *result = make_integer(n);
+  return ERROR_OK();
+}
 
-  if (a.type != ATOM_STRING || b.type != ATOM_STRING)
+/* (string-replace s old with) replaces every occurrence of old in s. The
+ * result is a rope of slices of s and with, see string.c. */
+Error builtin_stringreplace(Atom args, Atom *result)
+{
+  Atom s, old, with, r;
+  size_t from = 0;
+  long i;
+
+  if (nilp(args) || nilp(cdr(args)) || nilp(cdr(cdr(args)))
+      || !nilp(cdr(cdr(cdr(args)))))
+    return ERROR(Error_Args, "Requires three arguments.");
+
+  s = car(args);
+  old = car(cdr(args));
+  with = car(cdr(cdr(args)));
+  if (atom_type(s) != ATOM_STRING || atom_type(old) != ATOM_STRING
+      || atom_type(with) != ATOM_STRING)
     return ERROR(Error_Type, "Arguments must be strings.");
+  if (atom_string(old)->length == 0)
+    return ERROR(Error_Type, "Pattern must not be empty.");
+
+  r = make_string("");
+  while ((i = string_search(s, old, from)) >= 0) {
+    r = string_concat(r, string_slice(s, from, i - from));
+    r = string_concat(r, with);
+    from = i + atom_string(old)->length;
+  }
+  if (from == 0) {
+    *result = s;
+    return ERROR_OK();
+  }
+
+  *result = string_concat(r, string_slice(s, from,
+        atom_string(s)->length - from));
+  return ERROR_OK();
+}
+
+/* (string-concat s ...) joins its arguments without copying them, see
+ * string.c */
+Error builtin_stringconcat(Atom args, Atom *result)
+{
+  Atom a, r;
+
+  for (a = args; !nilp(a); a = cdr(a)) {
+    if (atom_type(car(a)) != ATOM_STRING)
+      return ERROR(Error_Type, "Arguments must be strings.");
+  }
+
+  if (nilp(args)) {
+    *result = make_string("");
+    return ERROR_OK();
+  }
+
+  r = car(args);
+  for (a = cdr(args); !nilp(a); a = cdr(a))
+    r = string_concat(r, car(a));
+  *result = r;
+  return ERROR_OK();
+}
+
+Error builtin_stringlength(Atom args, Atom *result)
+{
+  if (nilp(args) || !nilp(cdr(args)))
+    return ERROR(Error_Args, "Requires one argument.");
+  if (atom_type(car(args)) != ATOM_STRING)
+    return ERROR(Error_Type, "Argument must be a string.");
 
-  char *buf = malloc(strlen(a.value.string) + strlen(b.value.string) + 1);
-  strcat(buf, a.value.string);
-  strcat(buf, b.value.string);
-  *result = make_string(buf);
-  free(buf);
+  *result = make_integer(atom_string(car(args))->length);
   return ERROR_OK();
 }
 
@@ -265,32 +473,31 @@ Error builtin_stringsubstr(Atom args, Atom *result)
 {
   Atom a, b, c;
 
-  if (nilp(args) || nilp(cdr(args)) || nilp(cdr(cdr(args))) || !nilp(cdr(cdr(cdr(args)))))
+  if (nilp(args) || nilp(cdr(args))
+      || (!nilp(cdr(cdr(args))) && !nilp(cdr(cdr(cdr(args))))))
     return ERROR(Error_Args, "Requires two or three arguments.");
 
   a = car(args);
   b = car(cdr(args));
-  c = car(cdr(cdr(args)));
+  c = nilp(cdr(cdr(args))) ? nil : car(cdr(cdr(args)));
 
-  if (a.type != ATOM_STRING || b.type != ATOM_INTEGER || !(c.type == ATOM_INTEGER || c.type == ATOM_NIL))
+  if (atom_type(a) != ATOM_STRING || atom_type(b) != ATOM_INTEGER || !(atom_type(c) == ATOM_INTEGER || atom_type(c) == ATOM_NIL))
     return ERROR(Error_Type, "Arguments must be <string> <integer> <optional integer>.");
 
-  int maxlen = strlen(a.value.string);
-  int start = b.value.integer, len = 0;
-  if (c.type == ATOM_NIL) {
+  long maxlen = atom_string(a)->length;
+  long start = atom_integer(b), len = 0;
+  if (atom_type(c) == ATOM_NIL) {
     len = maxlen - start;
   } else {
-    len = c.value.integer;
+    len = atom_integer(c);
   }
 
-  if (start + len > maxlen) {
+  if (start < 0 || len < 0 || start + len > maxlen) {
     return ERROR(Error_OutOfBounds, "Index out of bounds.");
   }
 
-  char *buf = malloc(maxlen + 1);
-  strncpy(buf, a.value.string + start, len);
-  *result = make_string(buf);
-  free(buf);
+  /* The substring shares the text of a */
+  *result = string_slice(a, start, len);
   return ERROR_OK();
 }
 
@@ -323,31 +530,50 @@ Error builtin_eq(Atom args, Atom *result)
   b = car(cdr(args));
 
 
-  if (a.type == b.type) {
-    switch (a.type) {
+  if (atom_type(a) == atom_type(b)) {
+    switch (atom_type(a)) {
     case ATOM_NIL:
       eq = 1;
       break;
     case ATOM_PAIR:
     case ATOM_CLOSURE:
     case ATOM_MACRO:
-      eq = (a.value.pair == b.value.pair);
+    case ATOM_LOCAL:
+    case ATOM_EXPANSION:
+      eq = (atom_pair(a) == atom_pair(b));
+      break;
+    case ATOM_SCOPE:
+      eq = (atom_scope(a) == atom_scope(b));
+      break;
+    case ATOM_FRAME:
+      eq = (atom_frame(a) == atom_frame(b));
+      break;
+    case ATOM_VECTOR:
+      eq = (atom_vector(a) == atom_vector(b));
+      break;
+    case ATOM_HASHTABLE:
+      eq = (atom_hashtable(a) == atom_hashtable(b));
+      break;
+    case ATOM_ARRAY:
+      eq = (atom_array(a) == atom_array(b));
       break;
     case ATOM_STRING:
-      eq = (strcmp(a.value.string, b.value.string) == 0);
+      eq = (string_compare(a, b) == 0);
       break;
     case ATOM_SYMBOL:
-      eq = (a.value.symbol == b.value.symbol);
+      eq = (atom_symbol(a) == atom_symbol(b));
       break;
     case ATOM_INTEGER:
-      eq = (a.value.integer == b.value.integer);
+      eq = (atom_integer(a) == atom_integer(b));
+      break;
     case ATOM_REAL:
-      eq = (a.value.real == b.value.real);
+      eq = (atom_real(a) == atom_real(b));
       break;
     case ATOM_BUILTIN:
-      eq = (a.value.builtin == b.value.builtin);
+      eq = (atom_builtin(a) == atom_builtin(b));
       break;
     case ATOM_ERROR:
+    case ATOM_UNBOUND:
       eq = 0;
     }
   } else {
@@ -363,7 +589,7 @@ Error builtin_pairp(Atom args, Atom *result)
   if (nilp(args) || !nilp(cdr(args)))
     return ERROR(Error_Args, "Requires a single argument.");
 
-  *result = (car(args).type == ATOM_PAIR) ? make_symbol("T") : nil;
+  *result = (atom_type(car(args)) == ATOM_PAIR) ? make_symbol("T") : nil;
   return ERROR_OK();
 }
 
@@ -372,7 +598,7 @@ Error builtin_stringp(Atom args, Atom *result)
   if (nilp(args) || !nilp(cdr(args)))
     return ERROR(Error_Args, "Requires a single argument.");
 
-  *result = (car(args).type == ATOM_STRING) ? make_symbol("T") : nil;
+  *result = (atom_type(car(args)) == ATOM_STRING) ? make_symbol("T") : nil;
   return ERROR_OK();
 }
 
@@ -381,7 +607,7 @@ Error builtin_symbolp(Atom args, Atom *result)
   if (nilp(args) || !nilp(cdr(args)))
     return ERROR(Error_Args, "Requires a single argument.");
 
-  *result = (car(args).type == ATOM_SYMBOL) ? make_symbol("T") : nil;
+  *result = (atom_type(car(args)) == ATOM_SYMBOL) ? make_symbol("T") : nil;
   return ERROR_OK();
 }
 
@@ -402,7 +628,845 @@ Error builtin_error(Atom args, Atom *result)
   if (nilp(args) || !nilp(cdr(args)))
     return ERROR(Error_Args, "Requires a single argument.");
 
-  *result = (car(args).type == ATOM_STRING) ? car(args) : nil;
-  return ERROR(Error_Syntax, car(args).value.string);
+  if (atom_type(car(args)) != ATOM_STRING) {
+    *result = nil;
+    return ERROR(Error_Syntax, "ERROR called.");
+  }
+  *result = car(args);
+  return ERROR(Error_Syntax, string_chars(car(args)));
+}
+
+
+Error builtin_gc(Atom args, Atom *result)
+{
+  if (!nilp(args))
+    return ERROR(Error_Args, "Takes no arguments.");
+
+  *result = make_integer(cutie_gc());
+  return ERROR_OK();
+}
+
+Error builtin_gc_threshold(Atom args, Atom *result)
+{
+  Atom a;
+
+  if (!nilp(args) && !nilp(cdr(args)))
+    return ERROR(Error_Args, "Requires zero or one argument.");
+
+  if (!nilp(args)) {
+    a = car(args);
+    if (atom_type(a) != ATOM_INTEGER || atom_integer(a) <= 0)
+      return ERROR(Error_Type, "Argument must be a positive integer.");
+    cutie_gc_threshold(atom_integer(a));
+  }
+
+  *result = make_integer(cutie_gc_threshold(0));
+  return ERROR_OK();
+}
+
+Error builtin_macroexpand_all(Atom args, Atom *result)
+{
+  if (nilp(args) || !nilp(cdr(args)))
+    return ERROR(Error_Args, "Requires one argument.");
+
+  *result = macroexpand_all(car(args));
+  return ERROR_OK();
+}
+
+/* Lists. These walk their arguments iteratively, so they run in constant
+ * C stack however long the lists are. */
+
+/* Append val to the list being built in *head, *tail */
+static void list_push(Atom *head, Atom *tail, Atom val)
+{
+  Atom cell = cons(val, nil);
+
+  if (nilp(*head))
+    *head = cell;
+  else
+    cdr(*tail) = cell;
+  *tail = cell;
+}
+
+Error builtin_list(Atom args, Atom *result)
+{
+  *result = copy_list(args);
+  return ERROR_OK();
+}
+
+Error builtin_length(Atom args, Atom *result)
+{
+  Atom list;
+  long n = 0;
+
+  if (nilp(args) || !nilp(cdr(args)))
+    return ERROR(Error_Args, "Requires one argument.");
+
+  for (list = car(args); atom_type(list) == ATOM_PAIR; list = cdr(list))
+    n++;
+  if (!nilp(list))
+    return ERROR(Error_Type, "Argument must be a list.");
+
+  *result = make_integer(n);
+  return ERROR_OK();
+}
+
+Error builtin_reverse(Atom args, Atom *result)
+{
+  Atom list, r = nil;
+
+  if (nilp(args) || !nilp(cdr(args)))
+    return ERROR(Error_Args, "Requires one argument.");
+
+  for (list = car(args); atom_type(list) == ATOM_PAIR; list = cdr(list))
+    r = cons(car(list), r);
+  if (!nilp(list))
+    return ERROR(Error_Type, "Argument must be a list.");
+
+  *result = r;
+  return ERROR_OK();
+}
+
+/* A copy of every list but the last, ending in the last one itself */
+Error builtin_append(Atom args, Atom *result)
+{
+  Atom head, tail = nil, list, a;
+  size_t n = 0;
+
+  for (a = args; !nilp(a) && !nilp(cdr(a)); a = cdr(a)) {
+    for (list = car(a); atom_type(list) == ATOM_PAIR; list = cdr(list))
+      n++;
+    if (!nilp(list))
+      return ERROR(Error_Type, "Arguments must be lists.");
+  }
+
+  head = make_list(n);
+  for (a = head; !nilp(args) && !nilp(cdr(args)); args = cdr(args)) {
+    for (list = car(args); atom_type(list) == ATOM_PAIR; list = cdr(list)) {
+      car(a) = car(list);
+      tail = a;
+      a = cdr(a);
+    }
+  }
+
+  list = nilp(args) ? nil : car(args);
+  if (nilp(head))
+    *result = list;
+  else {
+    cdr(tail) = list;
+    *result = head;
+  }
+  return ERROR_OK();
+}
+
+/* The element at index pos, or nil past the end of the list */
+Error builtin_nth(Atom args, Atom *result)
+{
+  Atom pos, list;
+  long i;
+
+  if (nilp(args) || nilp(cdr(args)) || !nilp(cdr(cdr(args))))
+    return ERROR(Error_Args, "Requires two arguments.");
+
+  pos = car(args);
+  list = car(cdr(args));
+  if (atom_type(pos) != ATOM_INTEGER || atom_integer(pos) < 0)
+    return ERROR(Error_Type, "Index must be a non-negative integer.");
+
+  for (i = atom_integer(pos); i > 0 && atom_type(list) == ATOM_PAIR; i--)
+    list = cdr(list);
+
+  *result = atom_type(list) == ATOM_PAIR ? car(list) : nil;
+  return ERROR_OK();
+}
+
+Error builtin_last(Atom args, Atom *result)
+{
+  Atom list;
+
+  if (nilp(args) || !nilp(cdr(args)))
+    return ERROR(Error_Args, "Requires one argument.");
+
+  list = car(args);
+  if (nilp(list)) {
+    *result = nil;
+    return ERROR_OK();
+  }
+  if (atom_type(list) != ATOM_PAIR)
+    return ERROR(Error_Type, "Argument must be a list.");
+
+  while (atom_type(cdr(list)) == ATOM_PAIR)
+    list = cdr(list);
+
+  *result = car(list);
+  return ERROR_OK();
+}
+
+/* (map proc list ...) calls proc with the first element of each list,
+ * then the second and so on, for as long as the first list lasts. Lists
+ * that run out early supply nil. */
+Error builtin_map(Atom args, Atom *result)
+{
+  Atom fn, lists, head, tail = nil, out, l;
+  size_t n = 0;
+  Error err;
+
+  if (nilp(args))
+    return ERROR(Error_Args, "Requires at least one argument.");
+
+  fn = car(args);
+  lists = copy_list(cdr(args));
+  if (nilp(lists)) {
+    *result = nil;
+    return ERROR_OK();
+  }
+
+  /* The result is as long as the first list, so its spine can be made
+   * in one go. Should fn change the length of the first list, the
+   * result stops where either runs out. */
+  for (l = car(lists); atom_type(l) == ATOM_PAIR; l = cdr(l))
+    n++;
+  head = out = make_list(n);
+
+  while (atom_type(car(lists)) == ATOM_PAIR && !nilp(out)) {
+    Atom call = nil, call_tail = nil, val;
+
+    for (l = lists; !nilp(l); l = cdr(l)) {
+      if (atom_type(car(l)) == ATOM_PAIR) {
+        list_push(&call, &call_tail, car(car(l)));
+        car(l) = cdr(car(l));
+      } else if (nilp(car(l)))
+        list_push(&call, &call_tail, nil);
+      else
+        return ERROR(Error_Type, "Arguments must be lists.");
+    }
+
+    err = apply(fn, call, &val);
+    if (ERROR_RAISED(err))
+      return err;
+    car(out) = val;
+    tail = out;
+    out = cdr(out);
+  }
+  if (atom_type(car(lists)) != ATOM_PAIR && !nilp(car(lists)))
+    return ERROR(Error_Type, "Arguments must be lists.");
+
+  if (nilp(tail))
+    head = nil;
+  else
+    cdr(tail) = nil;
+
+  *result = head;
+  return ERROR_OK();
 }
 
+/* (foldl proc init list) is (proc (proc init x1) x2) ... */
+Error builtin_foldl(Atom args, Atom *result)
+{
+  Atom fn, acc, list;
+  Error err;
+
+  if (nilp(args) || nilp(cdr(args)) || nilp(cdr(cdr(args)))
+      || !nilp(cdr(cdr(cdr(args)))))
+    return ERROR(Error_Args, "Requires three arguments.");
+
+  fn = car(args);
+  acc = car(cdr(args));
+  for (list = car(cdr(cdr(args))); atom_type(list) == ATOM_PAIR; list = cdr(list)) {
+    err = apply(fn, cons(acc, cons(car(list), nil)), &acc);
+    if (ERROR_RAISED(err))
+      return err;
+  }
+  if (!nilp(list))
+    return ERROR(Error_Type, "Argument must be a list.");
+
+  *result = acc;
+  return ERROR_OK();
+}
+
+/* (foldr proc init list) is (proc x1 (proc x2 ... (proc xn init))),
+ * folded from a reversed copy of the list rather than by recursion */
+Error builtin_foldr(Atom args, Atom *result)
+{
+  Atom fn, acc, list, reversed;
+  Error err;
+
+  if (nilp(args) || nilp(cdr(args)) || nilp(cdr(cdr(args)))
+      || !nilp(cdr(cdr(cdr(args)))))
+    return ERROR(Error_Args, "Requires three arguments.");
+
+  fn = car(args);
+  acc = car(cdr(args));
+  err = builtin_reverse(cdr(cdr(args)), &reversed);
+  if (ERROR_RAISED(err))
+    return err;
+
+  for (list = reversed; !nilp(list); list = cdr(list)) {
+    err = apply(fn, cons(car(list), cons(acc, nil)), &acc);
+    if (ERROR_RAISED(err))
+      return err;
+  }
+
+  *result = acc;
+  return ERROR_OK();
+}
+
+/* Vectors */
+
+/* The vector in args and the index after it, checked against its length */
+static Error vector_index(Atom args, struct Vector **v, size_t *index)
+{
+  Atom pos;
+
+  if (atom_type(car(args)) != ATOM_VECTOR)
+    return ERROR(Error_Type, "First argument must be a vector.");
+  pos = car(cdr(args));
+  if (atom_type(pos) != ATOM_INTEGER)
+    return ERROR(Error_Type, "Index must be an integer.");
+
+  *v = atom_vector(car(args));
+  if (atom_integer(pos) < 0 || (size_t)atom_integer(pos) >= (*v)->length)
+    return ERROR(Error_OutOfBounds, "Vector index out of range.");
+  *index = atom_integer(pos);
+  return ERROR_OK();
+}
+
+/* (make-vector n [fill]) */
+Error builtin_make_vector(Atom args, Atom *result)
+{
+  Atom n;
+
+  if (nilp(args) || (!nilp(cdr(args)) && !nilp(cdr(cdr(args)))))
+    return ERROR(Error_Args, "Requires one or two arguments.");
+
+  n = car(args);
+  if (atom_type(n) != ATOM_INTEGER || atom_integer(n) < 0)
+    return ERROR(Error_Type, "Length must be a non-negative integer.");
+
+  *result = make_vector(atom_integer(n), nilp(cdr(args)) ? nil : car(cdr(args)));
+  return ERROR_OK();
+}
+
+Error builtin_vector(Atom args, Atom *result)
+{
+  *result = list_to_vector(args);
+  return ERROR_OK();
+}
+
+Error builtin_vector_ref(Atom args, Atom *result)
+{
+  struct Vector *v;
+  size_t i;
+  Error err;
+
+  if (nilp(args) || nilp(cdr(args)) || !nilp(cdr(cdr(args))))
+    return ERROR(Error_Args, "Requires two arguments.");
+
+  err = vector_index(args, &v, &i);
+  if (ERROR_RAISED(err))
+    return err;
+
+  *result = v->items[i];
+  return ERROR_OK();
+}
+
+/* (vector-set! vector index value) returns value */
+Error builtin_vector_set(Atom args, Atom *result)
+{
+  struct Vector *v;
+  size_t i;
+  Error err;
+
+  if (nilp(args) || nilp(cdr(args)) || nilp(cdr(cdr(args)))
+      || !nilp(cdr(cdr(cdr(args)))))
+    return ERROR(Error_Args, "Requires three arguments.");
+
+  err = vector_index(args, &v, &i);
+  if (ERROR_RAISED(err))
+    return err;
+
+  v->items[i] = car(cdr(cdr(args)));
+  *result = v->items[i];
+  return ERROR_OK();
+}
+
+Error builtin_vector_length(Atom args, Atom *result)
+{
+  if (nilp(args) || !nilp(cdr(args)))
+    return ERROR(Error_Args, "Requires one argument.");
+  if (atom_type(car(args)) != ATOM_VECTOR)
+    return ERROR(Error_Type, "Argument must be a vector.");
+
+  *result = make_integer(atom_vector(car(args))->length);
+  return ERROR_OK();
+}
+
+Error builtin_vector_to_list(Atom args, Atom *result)
+{
+  struct Vector *v;
+  Atom list, p;
+  size_t i;
+
+  if (nilp(args) || !nilp(cdr(args)))
+    return ERROR(Error_Args, "Requires one argument.");
+  if (atom_type(car(args)) != ATOM_VECTOR)
+    return ERROR(Error_Type, "Argument must be a vector.");
+
+  v = atom_vector(car(args));
+  list = make_list(v->length);
+  for (i = 0, p = list; !nilp(p); i++, p = cdr(p))
+    car(p) = v->items[i];
+
+  *result = list;
+  return ERROR_OK();
+}
+
+Error builtin_list_to_vector(Atom args, Atom *result)
+{
+  if (nilp(args) || !nilp(cdr(args)))
+    return ERROR(Error_Args, "Requires one argument.");
+  if (!listp(car(args)))
+    return ERROR(Error_Type, "Argument must be a list.");
+
+  *result = list_to_vector(car(args));
+  return ERROR_OK();
+}
+
+Error builtin_vectorp(Atom args, Atom *result)
+{
+  if (nilp(args) || !nilp(cdr(args)))
+    return ERROR(Error_Args, "Requires one argument.");
+
+  *result = (atom_type(car(args)) == ATOM_VECTOR) ? make_symbol("T") : nil;
+  return ERROR_OK();
+}
+
+Error builtin_equal(Atom args, Atom *result)
+{
+  if (nilp(args) || nilp(cdr(args)) || !nilp(cdr(cdr(args))))
+    return ERROR(Error_Args, "Requires two arguments.");
+
+  *result = atom_equal(car(args), car(cdr(args))) ? make_symbol("T") : nil;
+  return ERROR_OK();
+}
+
+/* Hash tables */
+
+Error builtin_make_hash_table(Atom args, Atom *result)
+{
+  if (!nilp(args))
+    return ERROR(Error_Args, "Takes no arguments.");
+
+  *result = make_hash_table();
+  return ERROR_OK();
+}
+
+/* (hash-ref table key [default]) */
+Error builtin_hash_ref(Atom args, Atom *result)
+{
+  Atom entry;
+
+  if (nilp(args) || nilp(cdr(args))
+      || (!nilp(cdr(cdr(args))) && !nilp(cdr(cdr(cdr(args))))))
+    return ERROR(Error_Args, "Requires two or three arguments.");
+  if (atom_type(car(args)) != ATOM_HASHTABLE)
+    return ERROR(Error_Type, "First argument must be a hash table.");
+
+  entry = hash_get(car(args), car(cdr(args)));
+  if (!nilp(entry))
+    *result = cdr(entry);
+  else
+    *result = nilp(cdr(cdr(args))) ? nil : car(cdr(cdr(args)));
+  return ERROR_OK();
+}
+
+/* (hash-set! table key value) returns value */
+Error builtin_hash_set(Atom args, Atom *result)
+{
+  if (nilp(args) || nilp(cdr(args)) || nilp(cdr(cdr(args)))
+      || !nilp(cdr(cdr(cdr(args)))))
+    return ERROR(Error_Args, "Requires three arguments.");
+  if (atom_type(car(args)) != ATOM_HASHTABLE)
+    return ERROR(Error_Type, "First argument must be a hash table.");
+
+  hash_put(car(args), car(cdr(args)), car(cdr(cdr(args))));
+  *result = car(cdr(cdr(args)));
+  return ERROR_OK();
+}
+
+/* (hash-remove! table key) is T if key was in the table */
+Error builtin_hash_remove(Atom args, Atom *result)
+{
+  if (nilp(args) || nilp(cdr(args)) || !nilp(cdr(cdr(args))))
+    return ERROR(Error_Args, "Requires two arguments.");
+  if (atom_type(car(args)) != ATOM_HASHTABLE)
+    return ERROR(Error_Type, "First argument must be a hash table.");
+
+  *result = hash_remove(car(args), car(cdr(args))) ? make_symbol("T") : nil;
+  return ERROR_OK();
+}
+
+Error builtin_hash_count(Atom args, Atom *result)
+{
+  if (nilp(args) || !nilp(cdr(args)))
+    return ERROR(Error_Args, "Requires one argument.");
+  if (atom_type(car(args)) != ATOM_HASHTABLE)
+    return ERROR(Error_Type, "Argument must be a hash table.");
+
+  *result = make_integer(atom_hashtable(car(args))->count);
+  return ERROR_OK();
+}
+
+Error builtin_hash_keys(Atom args, Atom *result)
+{
+  Atom p;
+
+  if (nilp(args) || !nilp(cdr(args)))
+    return ERROR(Error_Args, "Requires one argument.");
+  if (atom_type(car(args)) != ATOM_HASHTABLE)
+    return ERROR(Error_Type, "Argument must be a hash table.");
+
+  *result = hash_entries(car(args));
+  for (p = *result; !nilp(p); p = cdr(p))
+    car(p) = car(car(p));
+  return ERROR_OK();
+}
+
+/* The entries as an association list, in no particular order */
+Error builtin_hash_to_list(Atom args, Atom *result)
+{
+  if (nilp(args) || !nilp(cdr(args)))
+    return ERROR(Error_Args, "Requires one argument.");
+  if (atom_type(car(args)) != ATOM_HASHTABLE)
+    return ERROR(Error_Type, "Argument must be a hash table.");
+
+  *result = hash_entries(car(args));
+  return ERROR_OK();
+}
+
+/* (hash-for-each table proc) calls (proc key value) for each entry. It
+ * walks a snapshot, so proc may change the table. */
+Error builtin_hash_for_each(Atom args, Atom *result)
+{
+  Atom fn, entries;
+  Error err;
+
+  if (nilp(args) || nilp(cdr(args)) || !nilp(cdr(cdr(args))))
+    return ERROR(Error_Args, "Requires two arguments.");
+  if (atom_type(car(args)) != ATOM_HASHTABLE)
+    return ERROR(Error_Type, "First argument must be a hash table.");
+
+  fn = car(cdr(args));
+  for (entries = hash_entries(car(args)); !nilp(entries);
+      entries = cdr(entries)) {
+    Atom value;
+    err = apply(fn, cons(car(car(entries)), cons(cdr(car(entries)), nil)),
+        &value);
+    if (ERROR_RAISED(err))
+      return err;
+  }
+
+  *result = nil;
+  return ERROR_OK();
+}
+
+Error builtin_hash_tablep(Atom args, Atom *result)
+{
+  if (nilp(args) || !nilp(cdr(args)))
+    return ERROR(Error_Args, "Requires one argument.");
+
+  *result = (atom_type(car(args)) == ATOM_HASHTABLE) ? make_symbol("T") : nil;
+  return ERROR_OK();
+}
+
+/* Numeric arrays */
+
+static Error array_kind(Atom sym, int *kind)
+{
+  if (atom_type(sym) == ATOM_SYMBOL && strcmp(atom_symbol(sym)->name, "F64") == 0)
+    *kind = ARRAY_F64;
+  else if (atom_type(sym) == ATOM_SYMBOL && strcmp(atom_symbol(sym)->name, "I64") == 0)
+    *kind = ARRAY_I64;
+  else
+    return ERROR(Error_Type, "Array kind must be F64 or I64.");
+  return ERROR_OK();
+}
+
+static int numberp(Atom a)
+{
+  return atom_type(a) == ATOM_INTEGER || atom_type(a) == ATOM_REAL;
+}
+
+/* The single array argument of an operation */
+static Error one_array(Atom args)
+{
+  if (nilp(args) || !nilp(cdr(args)))
+    return ERROR(Error_Args, "Requires one argument.");
+  if (atom_type(car(args)) != ATOM_ARRAY)
+    return ERROR(Error_Type, "Argument must be an array.");
+  return ERROR_OK();
+}
+
+/* The two arrays of an elementwise operation */
+static Error two_arrays(Atom args)
+{
+  Atom a, b;
+
+  if (nilp(args) || nilp(cdr(args)) || !nilp(cdr(cdr(args))))
+    return ERROR(Error_Args, "Requires two arguments.");
+
+  a = car(args);
+  b = car(cdr(args));
+  if (atom_type(a) != ATOM_ARRAY || atom_type(b) != ATOM_ARRAY)
+    return ERROR(Error_Type, "Arguments must be arrays.");
+  if (atom_array(a)->kind != atom_array(b)->kind
+      || atom_array(a)->length != atom_array(b)->length)
+    return ERROR(Error_Type, "Arrays must be of the same kind and length.");
+  return ERROR_OK();
+}
+
+/* The array in args and the index after it, checked against its length */
+static Error array_index(Atom args, size_t *index)
+{
+  Atom pos;
+
+  if (atom_type(car(args)) != ATOM_ARRAY)
+    return ERROR(Error_Type, "First argument must be an array.");
+  pos = car(cdr(args));
+  if (atom_type(pos) != ATOM_INTEGER)
+    return ERROR(Error_Type, "Index must be an integer.");
+  if (atom_integer(pos) < 0
+      || (size_t)atom_integer(pos) >= atom_array(car(args))->length)
+    return ERROR(Error_OutOfBounds, "Array index out of range.");
+  *index = atom_integer(pos);
+  return ERROR_OK();
+}
+
+/* (make-array kind n [fill]) with kind F64 or I64 */
+Error builtin_make_array(Atom args, Atom *result)
+{
+  Atom n, fill;
+  size_t i;
+  int kind = ARRAY_F64;
+  Error err;
+
+  if (nilp(args) || nilp(cdr(args))
+      || (!nilp(cdr(cdr(args))) && !nilp(cdr(cdr(cdr(args))))))
+    return ERROR(Error_Args, "Requires two or three arguments.");
+
+  err = array_kind(car(args), &kind);
+  if (ERROR_RAISED(err))
+    return err;
+  n = car(cdr(args));
+  if (atom_type(n) != ATOM_INTEGER || atom_integer(n) < 0)
+    return ERROR(Error_Type, "Length must be a non-negative integer.");
+  fill = nilp(cdr(cdr(args))) ? make_integer(0) : car(cdr(cdr(args)));
+  if (!numberp(fill))
+    return ERROR(Error_Type, "Fill must be a number.");
+
+  *result = make_array(kind, atom_integer(n));
+  if (atom_type(fill) != ATOM_INTEGER || atom_integer(fill) != 0) {
+    for (i = 0; i < (size_t)atom_integer(n); i++)
+      array_set(*result, i, fill);
+  }
+  return ERROR_OK();
+}
+
+/* (list->array kind list) */
+Error builtin_list_to_array(Atom args, Atom *result)
+{
+  Atom list;
+  size_t n = 0;
+  int kind = ARRAY_F64;
+  Error err;
+
+  if (nilp(args) || nilp(cdr(args)) || !nilp(cdr(cdr(args))))
+    return ERROR(Error_Args, "Requires two arguments.");
+
+  err = array_kind(car(args), &kind);
+  if (ERROR_RAISED(err))
+    return err;
+  for (list = car(cdr(args)); atom_type(list) == ATOM_PAIR; list = cdr(list)) {
+    if (!numberp(car(list)))
+      return ERROR(Error_Type, "List items must be numbers.");
+    n++;
+  }
+  if (!nilp(list))
+    return ERROR(Error_Type, "Argument must be a list.");
+
+  *result = make_array(kind, n);
+  for (n = 0, list = car(cdr(args)); !nilp(list); list = cdr(list))
+    array_set(*result, n++, car(list));
+  return ERROR_OK();
+}
+
+Error builtin_array_to_list(Atom args, Atom *result)
+{
+  Atom p;
+  size_t i;
+  Error err = one_array(args);
+
+  if (ERROR_RAISED(err))
+    return err;
+
+  *result = make_list(atom_array(car(args))->length);
+  for (i = 0, p = *result; !nilp(p); i++, p = cdr(p))
+    car(p) = array_ref(car(args), i);
+  return ERROR_OK();
+}
+
+Error builtin_array_ref(Atom args, Atom *result)
+{
+  size_t i;
+  Error err;
+
+  if (nilp(args) || nilp(cdr(args)) || !nilp(cdr(cdr(args))))
+    return ERROR(Error_Args, "Requires two arguments.");
+
+  err = array_index(args, &i);
+  if (ERROR_RAISED(err))
+    return err;
+
+  *result = array_ref(car(args), i);
+  return ERROR_OK();
+}
+
+/* (array-set! array index number) returns the number as stored */
+Error builtin_array_set(Atom args, Atom *result)
+{
+  size_t i;
+  Error err;
+
+  if (nilp(args) || nilp(cdr(args)) || nilp(cdr(cdr(args)))
+      || !nilp(cdr(cdr(cdr(args)))))
+    return ERROR(Error_Args, "Requires three arguments.");
+
+  err = array_index(args, &i);
+  if (ERROR_RAISED(err))
+    return err;
+  if (!numberp(car(cdr(cdr(args)))))
+    return ERROR(Error_Type, "Value must be a number.");
+
+  array_set(car(args), i, car(cdr(cdr(args))));
+  *result = array_ref(car(args), i);
+  return ERROR_OK();
+}
+
+Error builtin_array_length(Atom args, Atom *result)
+{
+  Error err = one_array(args);
+
+  if (ERROR_RAISED(err))
+    return err;
+
+  *result = make_integer(atom_array(car(args))->length);
+  return ERROR_OK();
+}
+
+Error builtin_array_sum(Atom args, Atom *result)
+{
+  Error err = one_array(args);
+
+  if (ERROR_RAISED(err))
+    return err;
+
+  *result = array_sum(car(args));
+  return ERROR_OK();
+}
+
+Error builtin_array_dot(Atom args, Atom *result)
+{
+  Error err = two_arrays(args);
+
+  if (ERROR_RAISED(err))
+    return err;
+
+  *result = array_dot(car(args), car(cdr(args)));
+  return ERROR_OK();
+}
+
+Error builtin_array_add(Atom args, Atom *result)
+{
+  Error err = two_arrays(args);
+
+  if (ERROR_RAISED(err))
+    return err;
+
+  *result = array_add(car(args), car(cdr(args)));
+  return ERROR_OK();
+}
+
+Error builtin_array_scale(Atom args, Atom *result)
+{
+  if (nilp(args) || nilp(cdr(args)) || !nilp(cdr(cdr(args))))
+    return ERROR(Error_Args, "Requires two arguments.");
+  if (atom_type(car(args)) != ATOM_ARRAY || !numberp(car(cdr(args))))
+    return ERROR(Error_Type, "Arguments must be an array and a number.");
+
+  *result = array_scale(car(args), car(cdr(args)));
+  return ERROR_OK();
+}
+
+Error builtin_array_min(Atom args, Atom *result)
+{
+  Error err = one_array(args);
+
+  if (ERROR_RAISED(err))
+    return err;
+
+  *result = array_extreme(car(args), 0);
+  return ERROR_OK();
+}
+
+Error builtin_array_max(Atom args, Atom *result)
+{
+  Error err = one_array(args);
+
+  if (ERROR_RAISED(err))
+    return err;
+
+  *result = array_extreme(car(args), 1);
+  return ERROR_OK();
+}
+
+Error builtin_array_less(Atom args, Atom *result)
+{
+  Error err = two_arrays(args);
+
+  if (ERROR_RAISED(err))
+    return err;
+
+  *result = array_compare('<', car(args), car(cdr(args)));
+  return ERROR_OK();
+}
+
+Error builtin_array_greater(Atom args, Atom *result)
+{
+  Error err = two_arrays(args);
+
+  if (ERROR_RAISED(err))
+    return err;
+
+  *result = array_compare('>', car(args), car(cdr(args)));
+  return ERROR_OK();
+}
+
+Error builtin_array_numeq(Atom args, Atom *result)
+{
+  Error err = two_arrays(args);
+
+  if (ERROR_RAISED(err))
+    return err;
+
+  *result = array_compare('=', car(args), car(cdr(args)));
+  return ERROR_OK();
+}
+
+Error builtin_arrayp(Atom args, Atom *result)
+{
+  if (nilp(args) || !nilp(cdr(args)))
+    return ERROR(Error_Args, "Requires one argument.");
+
+  *result = (atom_type(car(args)) == ATOM_ARRAY) ? make_symbol("T") : nil;
+  return ERROR_OK();
+}
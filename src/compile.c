@@ -0,0 +1,721 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "cutie.h"
+
+/* BYTECODE COMPILER
+ *
+ * Closure bodies and top-level forms are compiled to the stack code run
+ * by vm.c. Every expression leaves exactly one value on the stack.
+ * Variables are found as resolve_body finds them: a slot in the frame of
+ * this or an enclosing closure becomes OP_LOCAL (still checked against
+ * the frame when it runs), a global becomes OP_GLOBAL, and anything that
+ * may be bound dynamically is looked up by name.
+ *
+ * Macro calls are not expanded here. Expanding them eagerly would never
+ * finish for macros like AND-LIST whose recursion depends on runtime
+ * data, so each call site expands when it is first reached and keeps
+ * the compiled expansion until the macro is redefined.
+ *
+ * Errors the tree walker would raise when a form is evaluated are
+ * compiled into OP_FAIL so they are raised at the same point. */
+
+struct Compiler {
+  struct Scope *scope;  /* frame layout, NULL when the code runs in env */
+  Atom env;             /* environment enclosing the code's frame */
+  int dynamic;          /* env has alist bindings that may shadow globals */
+  Atom constants;       /* reversed, kept as a list so the GC sees it */
+  size_t nconstants;
+  size_t nsites;
+  int captures;         /* may make something that refers to the frame */
+  int *ops;
+  size_t length;
+  size_t capacity;
+  int no_memory;        /* ops could not grow; the code is given up */
+  long depth;
+  long max_depth;
+};
+
+static void compile_expr(struct Compiler *c, Atom expr, int tail);
+
+static void emit(struct Compiler *c, int word)
+{
+  if (c->length == c->capacity) {
+    size_t capacity = c->capacity ? c->capacity * 2 : 64;
+    int *ops = realloc(c->ops, capacity * sizeof(*c->ops));
+
+    if (!ops) {
+      c->no_memory = 1;
+      return;
+    }
+    c->ops = ops;
+    c->capacity = capacity;
+  }
+  if (!c->no_memory)
+    c->ops[c->length++] = word;
+}
+
+/* Point the jump operand at position at here */
+static void patch(struct Compiler *c, size_t at)
+{
+  if (!c->no_memory)
+    c->ops[at] = c->length;
+}
+
+/* Emit an instruction that changes the stack depth by effect */
+static void emit_op(struct Compiler *c, Opcode op, long effect)
+{
+  switch (op) {
+  case OP_CLOSURE:
+  case OP_MACRO:
+  case OP_LOAD:
+  case OP_REQUIRE:
+  case OP_PROVIDE:
+  case OP_EXPAND:
+  case OP_TAIL_EXPAND:
+  case OP_MACRO_GUARD:
+    c->captures = 1;
+    break;
+  default:
+    break;
+  }
+
+  emit(c, op);
+  c->depth += effect;
+  if (c->depth > c->max_depth)
+    c->max_depth = c->depth;
+}
+
+static int constant(struct Compiler *c, Atom value)
+{
+  Atom p = c->constants;
+  size_t i = c->nconstants;
+
+  /* The same symbols come up over and over, so share them */
+  if (atom_type(value) == ATOM_SYMBOL) {
+    while (i-- > 0) {
+      if (atom_type(car(p)) == ATOM_SYMBOL
+          && atom_symbol(car(p)) == atom_symbol(value))
+        return i;
+      p = cdr(p);
+    }
+  }
+
+  c->constants = cons(value, c->constants);
+  return c->nconstants++;
+}
+
+static void compile_fail(struct Compiler *c, Error err)
+{
+  emit_op(c, OP_FAIL, 1);
+  emit(c, err.type);
+  emit(c, constant(c, make_string(err.message)));
+}
+
+static void compile_constant(struct Compiler *c, Atom value)
+{
+  if (nilp(value)) {
+    emit_op(c, OP_NIL, 1);
+    return;
+  }
+  emit_op(c, OP_CONST, 1);
+  emit(c, constant(c, value));
+}
+
+static void compile_variable(struct Compiler *c, Atom symbol)
+{
+  long depth, index;
+
+  switch (lookup_local(symbol, c->scope, c->env, &depth, &index)) {
+  case LOCAL_SLOT:
+    emit_op(c, OP_LOCAL, 1);
+    emit(c, constant(c, make_local(symbol, depth, index)));
+    return;
+  case LOCAL_NONE:
+    if (!c->dynamic) {
+      emit_op(c, OP_GLOBAL, 1);
+      emit(c, constant(c, symbol));
+      return;
+    }
+    /* fall through */
+  default:
+    emit_op(c, OP_NAME, 1);
+    emit(c, constant(c, symbol));
+    return;
+  }
+}
+
+/* Store the value on top of the stack in the variable named by target,
+ * leaving the variable's name, as DEFINE and SET! return it. */
+static void compile_store(struct Compiler *c, Atom target, int define)
+{
+  long depth, index;
+
+  if (atom_type(target) == ATOM_LOCAL) {
+    emit_op(c, define ? OP_DEFINE_LOCAL : OP_SET_LOCAL, 0);
+    emit(c, constant(c, target));
+    return;
+  }
+
+  if (lookup_local(target, c->scope, c->env, &depth, &index) == LOCAL_SLOT
+      && (depth == 0 || !define)) {
+    emit_op(c, define ? OP_DEFINE_LOCAL : OP_SET_LOCAL, 0);
+    emit(c, constant(c, make_local(target, depth, index)));
+    return;
+  }
+
+  emit_op(c, define ? OP_DEFINE_NAME : OP_SET_NAME, 0);
+  emit(c, constant(c, target));
+}
+
+/* DEFINE and SET! share their syntax */
+static void compile_assignment(struct Compiler *c, Atom args, int define)
+{
+  Atom target;
+
+  if (nilp(args) || nilp(cdr(args))) {
+    compile_fail(c, define
+        ? ERROR(Error_Args, "DEFINE requires two arguments.")
+        : ERROR(Error_Args, "SET! requires two arguments."));
+    return;
+  }
+
+  target = car(args);
+  if (atom_type(target) == ATOM_PAIR) {
+    if (atom_type(car(target)) != ATOM_SYMBOL) {
+      compile_fail(c, define
+          ? ERROR(Error_Type, "DEFINE first argument must be symbol.")
+          : ERROR(Error_Type, "SET! first argument not symbol"));
+      return;
+    }
+    emit_op(c, OP_CLOSURE, 1);
+    emit(c, constant(c, cons(cdr(target), cdr(args))));
+    compile_store(c, car(target), define);
+  } else if (atom_type(target) == ATOM_SYMBOL || atom_type(target) == ATOM_LOCAL) {
+    if (!nilp(cdr(cdr(args)))) {
+      compile_fail(c, define
+          ? ERROR(Error_Args, "DEFINE argument error.")
+          : ERROR(Error_Args, "SET! argument error."));
+      return;
+    }
+    compile_expr(c, car(cdr(args)), 0);
+    compile_store(c, target, define);
+  } else {
+    compile_fail(c, define
+        ? ERROR(Error_Type, "DEFINE argument error.")
+        : ERROR(Error_Type, "SET! argument error."));
+  }
+}
+
+static void compile_body(struct Compiler *c, Atom body, int tail)
+{
+  if (nilp(body)) {
+    emit_op(c, OP_NIL, 1);
+    return;
+  }
+
+  while (!nilp(cdr(body))) {
+    compile_expr(c, car(body), 0);
+    emit_op(c, OP_POP, -1);
+    body = cdr(body);
+  }
+  compile_expr(c, car(body), tail);
+}
+
+static void compile_if(struct Compiler *c, Atom args, int tail)
+{
+  size_t else_jump, end_jump;
+
+  if (nilp(args) || nilp(cdr(args)) || nilp(cdr(cdr(args)))
+      || !nilp(cdr(cdr(cdr(args))))) {
+    compile_fail(c, ERROR(Error_Args, "IF requires three arguments."));
+    return;
+  }
+
+  compile_expr(c, car(args), 0);
+  emit_op(c, OP_JUMP_IF_NIL, -1);
+  else_jump = c->length;
+  emit(c, 0);
+
+  compile_expr(c, car(cdr(args)), tail);
+  emit_op(c, OP_JUMP, -1);
+  end_jump = c->length;
+  emit(c, 0);
+
+  patch(c, else_jump);
+  compile_expr(c, car(cdr(cdr(args))), tail);
+  patch(c, end_jump);
+}
+
+static void compile_while(struct Compiler *c, Atom args)
+{
+  size_t top = c->length, end_jump;
+
+  if (nilp(args) || nilp(cdr(args)) || !nilp(cdr(cdr(args)))) {
+    compile_fail(c, ERROR(Error_Args, "WHILE requires two arguments."));
+    return;
+  }
+
+  compile_expr(c, car(args), 0);
+  emit_op(c, OP_JUMP_IF_NIL, -1);
+  end_jump = c->length;
+  emit(c, 0);
+
+  compile_expr(c, car(cdr(args)), 0);
+  emit_op(c, OP_POP, -1);
+  emit_op(c, OP_JUMP, 0);
+  emit(c, top);
+
+  patch(c, end_jump);
+  emit_op(c, OP_NIL, 1);
+}
+
+/* Forward jumps to the same place are chained through their operands
+ * until the place is known. No operand is at position 0, which ends the
+ * chain. */
+static size_t emit_jump(struct Compiler *c, Opcode op, long effect,
+    size_t chain)
+{
+  emit_op(c, op, effect);
+  emit(c, chain);
+  return c->length - 1;
+}
+
+static void patch_jumps(struct Compiler *c, size_t chain)
+{
+  while (chain && !c->no_memory) {
+    size_t next = c->ops[chain];
+    c->ops[chain] = c->length;
+    chain = next;
+  }
+}
+
+static void compile_cond(struct Compiler *c, Atom args, int tail)
+{
+  size_t ends = 0, next;
+  Atom clause;
+
+  for (; !nilp(args); args = cdr(args)) {
+    clause = car(args);
+    if (atom_type(clause) != ATOM_PAIR || !listp(clause)) {
+      compile_fail(c, ERROR(Error_Syntax, "COND clause must be a list."));
+      patch_jumps(c, ends);
+      return;
+    }
+
+    compile_expr(c, car(clause), 0);
+    if (nilp(cdr(clause))) {
+      /* a clause with no body gives the value of its test */
+      ends = emit_jump(c, OP_JUMP_IF_TRUE_OR_POP, -1, ends);
+      continue;
+    }
+    next = emit_jump(c, OP_JUMP_IF_NIL, -1, 0);
+    compile_body(c, cdr(clause), tail);
+    ends = emit_jump(c, OP_JUMP, -1, ends);
+    patch_jumps(c, next);
+  }
+
+  emit_op(c, OP_NIL, 1);
+  patch_jumps(c, ends);
+}
+
+/* The body of a LET runs inline in a frame of its own, pushed by OP_LET
+ * and popped by OP_UNLET. It is resolved against a stand-in for the
+ * frame of this code, which is where the LET's frame will hang. */
+static void compile_let(struct Compiler *c, Atom args, int tail)
+{
+  struct Scope *scope, *outer_scope = c->scope;
+  Atom outer_env = c->env, env, bindings;
+  size_t n = 0;
+  Error err;
+
+  if (nilp(args)) {
+    compile_fail(c, ERROR(Error_Args, "LET requires bindings."));
+    return;
+  }
+
+  env = c->scope ? make_frame(c->env, c->scope) : c->env;
+  err = resolve_let(env, args, &scope);
+  if (ERROR_RAISED(err)) {
+    compile_fail(c, err);
+    return;
+  }
+
+  for (bindings = car(args); !nilp(bindings); bindings = cdr(bindings)) {
+    if (nilp(cdr(car(bindings))))
+      emit_op(c, OP_NIL, 1);
+    else
+      compile_expr(c, car(cdr(car(bindings))), 0);
+    n++;
+  }
+  emit_op(c, OP_LET, -(long)n);
+  emit(c, constant(c, car(cdr(args))));
+
+  c->scope = scope;
+  c->env = env;
+  compile_body(c, cdr(cdr(args)), tail);
+  c->scope = outer_scope;
+  c->env = outer_env;
+
+  emit_op(c, OP_UNLET, 0);
+}
+
+/* AND and OR stop at the first argument that decides their value */
+static void compile_and(struct Compiler *c, Atom args, int tail)
+{
+  size_t fails = 0, end;
+
+  if (nilp(args)) {
+    compile_constant(c, make_symbol("T"));
+    return;
+  }
+
+  while (!nilp(cdr(args))) {
+    compile_expr(c, car(args), 0);
+    fails = emit_jump(c, OP_JUMP_IF_NIL, -1, fails);
+    args = cdr(args);
+  }
+  compile_expr(c, car(args), tail);
+  if (!fails)
+    return;
+
+  end = emit_jump(c, OP_JUMP, -1, 0);
+  patch_jumps(c, fails);
+  emit_op(c, OP_NIL, 1);
+  patch_jumps(c, end);
+}
+
+static void compile_or(struct Compiler *c, Atom args, int tail)
+{
+  size_t ends = 0;
+
+  if (nilp(args)) {
+    emit_op(c, OP_NIL, 1);
+    return;
+  }
+
+  while (!nilp(cdr(args))) {
+    compile_expr(c, car(args), 0);
+    ends = emit_jump(c, OP_JUMP_IF_TRUE_OR_POP, -1, ends);
+    args = cdr(args);
+  }
+  compile_expr(c, car(args), tail);
+  patch_jumps(c, ends);
+}
+
+/* (WHEN c body...) and (UNLESS c body...) are nil when skipped */
+static void compile_when(struct Compiler *c, Atom args, int tail, int when)
+{
+  size_t skip, end;
+
+  if (nilp(args)) {
+    compile_fail(c, ERROR(Error_Args,
+        "WHEN and UNLESS require a condition."));
+    return;
+  }
+
+  compile_expr(c, car(args), 0);
+  skip = emit_jump(c, OP_JUMP_IF_NIL, -1, 0);
+  if (when)
+    compile_body(c, cdr(args), tail);
+  else
+    emit_op(c, OP_NIL, 1);
+  end = emit_jump(c, OP_JUMP, -1, 0);
+
+  patch_jumps(c, skip);
+  if (when)
+    emit_op(c, OP_NIL, 1);
+  else
+    compile_body(c, cdr(args), tail);
+  patch_jumps(c, end);
+}
+
+/* Is op certainly bound to a macro, or to a function, when this code runs?
+ * Globals are assumed to keep the kind they have when it is compiled. */
+static int global_kind(struct Compiler *c, Atom op)
+{
+  long depth, index;
+
+  if (atom_type(op) != ATOM_SYMBOL || c->dynamic
+      || !atom_symbol(op)->bound
+      || lookup_local(op, c->scope, c->env, &depth, &index) != LOCAL_NONE)
+    return ATOM_NIL;
+  return atom_type(atom_symbol(op)->value);
+}
+
+/* A macro call site: the form, then a constant for the macro its cached
+ * expansion was made with, then the site's index. */
+static void compile_site(struct Compiler *c, Atom expr)
+{
+  emit(c, constant(c, expr));
+  constant(c, nil);
+  emit(c, c->nsites++);
+}
+
+static void compile_call(struct Compiler *c, Atom expr, Atom op, int tail)
+{
+  Atom p;
+  int kind = global_kind(c, op);
+  size_t guard = 0, n = 0;
+
+  if (kind == ATOM_MACRO) {
+    emit_op(c, tail ? OP_TAIL_EXPAND : OP_EXPAND, 1);
+    compile_site(c, expr);
+    return;
+  }
+
+  compile_expr(c, op, 0);
+
+  /* An operator that is not known to be a function may turn out to be a
+   * macro, in which case the arguments must not be evaluated */
+  if ((atom_type(op) == ATOM_SYMBOL || atom_type(op) == ATOM_LOCAL)
+      && kind != ATOM_BUILTIN && kind != ATOM_CLOSURE) {
+    emit_op(c, OP_MACRO_GUARD, 0);
+    compile_site(c, expr);
+    guard = c->length;
+    emit(c, 0);
+  }
+
+  for (p = cdr(expr); !nilp(p); p = cdr(p)) {
+    compile_expr(c, car(p), 0);
+    n++;
+  }
+
+  emit_op(c, tail ? OP_TAIL_CALL : OP_CALL, -(long)n);
+  emit(c, n);
+
+  if (guard)
+    patch(c, guard);
+}
+
+static void compile_expr(struct Compiler *c, Atom expr, int tail)
+{
+  Atom op, args;
+
+  if (atom_type(expr) == ATOM_SYMBOL) {
+    if (atom_symbol(expr)->name[0] == ':')
+      compile_constant(c, expr);
+    else
+      compile_variable(c, expr);
+    return;
+  } else if (atom_type(expr) == ATOM_LOCAL) {
+    emit_op(c, OP_LOCAL, 1);
+    emit(c, constant(c, expr));
+    return;
+  } else if (atom_type(expr) != ATOM_PAIR) {
+    compile_constant(c, expr);
+    return;
+  }
+
+  if (!listp(expr)) {
+    compile_fail(c, ERROR(Error_Syntax, "Expression must be list."));
+    return;
+  }
+
+  op = car(expr);
+  args = cdr(expr);
+
+  /* A call that has been expanded already is compiled as it was written;
+   * its site starts out with the expansion kept in the call */
+  if (atom_type(op) == ATOM_EXPANSION)
+    op = car(op);
+
+  if (atom_type(op) == ATOM_SYMBOL) {
+    switch (atom_symbol(op)->special) {
+    case SPECIAL_QUOTE:
+      if (nilp(args) || !nilp(cdr(args)))
+        compile_fail(c, ERROR(Error_Args, "QUOTE requires an argument."));
+      else
+        compile_constant(c, car(args));
+      return;
+
+    case SPECIAL_DEFINE:
+      compile_assignment(c, args, 1);
+      return;
+
+    case SPECIAL_SET:
+      compile_assignment(c, args, 0);
+      return;
+
+    case SPECIAL_PROGN:
+      compile_body(c, args, tail);
+      return;
+
+    case SPECIAL_WHILE:
+      compile_while(c, args);
+      return;
+
+    case SPECIAL_LAMBDA:
+      if (nilp(args) || nilp(cdr(args))) {
+        compile_fail(c, ERROR(Error_Args, "LAMBDA requires two arguments."));
+        return;
+      }
+      emit_op(c, OP_CLOSURE, 1);
+      emit(c, constant(c, args));
+      return;
+
+    case SPECIAL_IF:
+      compile_if(c, args, tail);
+      return;
+
+    case SPECIAL_DEFMACRO:
+      emit_op(c, OP_MACRO, 1);
+      emit(c, constant(c, args));
+      return;
+
+    case SPECIAL_LOAD:
+      if (nilp(args)) {
+        compile_fail(c, ERROR(Error_Args, "LOAD takes one argument."));
+        return;
+      }
+      compile_expr(c, car(args), 0);
+      emit_op(c, OP_LOAD, 0);
+      return;
+
+    case SPECIAL_REQUIRE:
+      if (nilp(args) || (!nilp(cdr(args)) && !nilp(cdr(cdr(args))))) {
+        compile_fail(c,
+            ERROR(Error_Args, "REQUIRE takes one or two arguments."));
+        return;
+      }
+      compile_expr(c, car(args), 0);
+      if (nilp(cdr(args)))
+        emit_op(c, OP_NIL, 1);
+      else
+        compile_expr(c, car(cdr(args)), 0);
+      emit_op(c, OP_REQUIRE, -1);
+      return;
+
+    case SPECIAL_PROVIDE:
+      if (nilp(args) || !nilp(cdr(args))) {
+        compile_fail(c, ERROR(Error_Args, "PROVIDE takes one argument."));
+        return;
+      }
+      compile_expr(c, car(args), 0);
+      emit_op(c, OP_PROVIDE, 0);
+      return;
+
+    case SPECIAL_COND:
+      compile_cond(c, args, tail);
+      return;
+
+    case SPECIAL_LET:
+      compile_let(c, args, tail);
+      return;
+
+    case SPECIAL_AND:
+      compile_and(c, args, tail);
+      return;
+
+    case SPECIAL_OR:
+      compile_or(c, args, tail);
+      return;
+
+    case SPECIAL_WHEN:
+    case SPECIAL_UNLESS:
+      compile_when(c, args, tail,
+          atom_symbol(op)->special == SPECIAL_WHEN);
+      return;
+
+    default:
+      break;
+    }
+  }
+
+  compile_call(c, expr, op, tail);
+}
+
+static void start(struct Compiler *c, struct Scope *scope, Atom env)
+{
+  Atom e = env;
+
+  c->scope = scope;
+  c->env = env;
+  c->dynamic = 0;
+  c->constants = nil;
+  c->nconstants = 0;
+  c->nsites = 0;
+  c->captures = 0;
+  c->ops = NULL;
+  c->length = 0;
+  c->capacity = 0;
+  c->no_memory = 0;
+  c->depth = 0;
+  c->max_depth = 0;
+
+  while (atom_type(e) == ATOM_FRAME)
+    e = atom_frame(e)->parent;
+  while (atom_type(e) == ATOM_PAIR && !nilp(car(e))) {
+    c->dynamic = 1;
+    e = car(e);
+  }
+}
+
+static Error finish(struct Compiler *c, struct Code **result)
+{
+  struct Code *code;
+  Atom p;
+  size_t i;
+
+  emit_op(c, OP_RETURN, -1);
+  if (c->no_memory) {
+    free(c->ops);
+    return ERROR(Error_IO, "Out of memory for compiled code.");
+  }
+
+  code = gc_alloc(GC_CODE, sizeof(struct Code)
+      + c->nconstants * sizeof(Atom)
+      + c->nsites * sizeof(struct Code*)
+      + c->length * sizeof(int));
+  code->length = c->length;
+  code->max_stack = c->max_depth;
+  code->nconstants = c->nconstants;
+  code->nsites = c->nsites;
+  code->captures = c->captures;
+  code->spare = NULL;
+  code->constants = (Atom*)(code + 1);
+  code->sites = (struct Code**)(code->constants + c->nconstants);
+  code->ops = (int*)(code->sites + c->nsites);
+
+  p = c->constants;
+  for (i = c->nconstants; i-- > 0; p = cdr(p))
+    code->constants[i] = car(p);
+  for (i = 0; i < c->nsites; i++)
+    code->sites[i] = NULL;
+  memcpy(code->ops, c->ops, c->length * sizeof(int));
+
+  free(c->ops);
+  *result = code;
+  return ERROR_OK();
+}
+
+/* Compile expr to run directly in env, as load_file and the REPL do */
+Error compile_thunk(Atom expr, Atom env, struct Code **code)
+{
+  struct Compiler c;
+
+  start(&c, NULL, env);
+  compile_expr(&c, expr, 1);
+  return finish(&c, code);
+}
+
+/* Compile a closure's body once for its scope; later closures made from
+ * the same LAMBDA share the code. */
+Error compile_closure(Atom fn, struct Code **code)
+{
+  struct Compiler c;
+  Atom body = cdr(cdr(fn));
+  struct Scope *scope = atom_scope(car(body));
+  Error err;
+
+  if (!scope->code) {
+    start(&c, scope, car(fn));
+    compile_body(&c, cdr(body), 1);
+    err = finish(&c, &scope->code);
+    if (ERROR_RAISED(err))
+      return err;
+  }
+
+  *code = scope->code;
+  return ERROR_OK();
+}
@@ -5,8 +5,14 @@ Atom create_env(Atom parent) {
   return cons(parent, nil);
 }
 
+/* The root environment, with every builtin bound. Root bindings live in
+ * the symbols' global value cells, so there is only one root environment
+ * per process: calling this again rebinds the builtins and resets
+ * *MODULES* for every root made before, and a redefined builtin is
+ * restored. */
 Atom setup_env() {
   Atom env = create_env(nil);
+  cutie_gc_protect(env);
   env_set(env, make_symbol("+"), make_builtin(builtin_add));
   env_set(env, make_symbol("-"), make_builtin(builtin_subtract));
   env_set(env, make_symbol("*"), make_builtin(builtin_multiply));
@@ -14,63 +20,219 @@ Atom setup_env() {
   env_set(env, make_symbol("CAR"), make_builtin(builtin_car));
   env_set(env, make_symbol("CDR"), make_builtin(builtin_cdr));
   env_set(env, make_symbol("CONS"), make_builtin(builtin_cons));
+  env_set(env, make_symbol("LIST"), make_builtin(builtin_list));
+  env_set(env, make_symbol("LENGTH"), make_builtin(builtin_length));
+  env_set(env, make_symbol("REVERSE"), make_builtin(builtin_reverse));
+  env_set(env, make_symbol("APPEND"), make_builtin(builtin_append));
+  env_set(env, make_symbol("NTH"), make_builtin(builtin_nth));
+  env_set(env, make_symbol("LAST"), make_builtin(builtin_last));
+  env_set(env, make_symbol("MAP"), make_builtin(builtin_map));
+  env_set(env, make_symbol("FOLDL"), make_builtin(builtin_foldl));
+  env_set(env, make_symbol("FOLDR"), make_builtin(builtin_foldr));
+  env_set(env, make_symbol("MAKE-VECTOR"), make_builtin(builtin_make_vector));
+  env_set(env, make_symbol("VECTOR"), make_builtin(builtin_vector));
+  env_set(env, make_symbol("VECTOR-REF"), make_builtin(builtin_vector_ref));
+  env_set(env, make_symbol("VECTOR-SET!"), make_builtin(builtin_vector_set));
+  env_set(env, make_symbol("VECTOR-LENGTH"), make_builtin(builtin_vector_length));
+  env_set(env, make_symbol("VECTOR->LIST"), make_builtin(builtin_vector_to_list));
+  env_set(env, make_symbol("LIST->VECTOR"), make_builtin(builtin_list_to_vector));
+  env_set(env, make_symbol("MAKE-HASH-TABLE"), make_builtin(builtin_make_hash_table));
+  env_set(env, make_symbol("HASH-REF"), make_builtin(builtin_hash_ref));
+  env_set(env, make_symbol("HASH-SET!"), make_builtin(builtin_hash_set));
+  env_set(env, make_symbol("HASH-REMOVE!"), make_builtin(builtin_hash_remove));
+  env_set(env, make_symbol("HASH-COUNT"), make_builtin(builtin_hash_count));
+  env_set(env, make_symbol("HASH-KEYS"), make_builtin(builtin_hash_keys));
+  env_set(env, make_symbol("HASH->LIST"), make_builtin(builtin_hash_to_list));
+  env_set(env, make_symbol("HASH-FOR-EACH"), make_builtin(builtin_hash_for_each));
+  env_set(env, make_symbol("MAKE-ARRAY"), make_builtin(builtin_make_array));
+  env_set(env, make_symbol("LIST->ARRAY"), make_builtin(builtin_list_to_array));
+  env_set(env, make_symbol("ARRAY->LIST"), make_builtin(builtin_array_to_list));
+  env_set(env, make_symbol("ARRAY-REF"), make_builtin(builtin_array_ref));
+  env_set(env, make_symbol("ARRAY-SET!"), make_builtin(builtin_array_set));
+  env_set(env, make_symbol("ARRAY-LENGTH"), make_builtin(builtin_array_length));
+  env_set(env, make_symbol("ARRAY-SUM"), make_builtin(builtin_array_sum));
+  env_set(env, make_symbol("ARRAY-DOT"), make_builtin(builtin_array_dot));
+  env_set(env, make_symbol("ARRAY-MAP+"), make_builtin(builtin_array_add));
+  env_set(env, make_symbol("ARRAY-SCALE"), make_builtin(builtin_array_scale));
+  env_set(env, make_symbol("ARRAY-MIN"), make_builtin(builtin_array_min));
+  env_set(env, make_symbol("ARRAY-MAX"), make_builtin(builtin_array_max));
+  env_set(env, make_symbol("ARRAY<"), make_builtin(builtin_array_less));
+  env_set(env, make_symbol("ARRAY>"), make_builtin(builtin_array_greater));
+  env_set(env, make_symbol("ARRAY="), make_builtin(builtin_array_numeq));
   env_set(env, make_symbol("="), make_builtin(builtin_numeq));
   env_set(env, make_symbol("<"), make_builtin(builtin_less));
+  env_set(env, make_symbol(">"), make_builtin(builtin_greater));
+  env_set(env, make_symbol("<="), make_builtin(builtin_less_equal));
+  env_set(env, make_symbol(">="), make_builtin(builtin_greater_equal));
   env_set(env, make_symbol("APPLY"), make_builtin(builtin_apply));
   env_set(env, make_symbol("EQ?"), make_builtin(builtin_eq));
+  env_set(env, make_symbol("EQUAL?"), make_builtin(builtin_equal));
   env_set(env, make_symbol("PAIR?"), make_builtin(builtin_pairp));
   env_set(env, make_symbol("SYMBOL?"), make_builtin(builtin_symbolp));
   env_set(env, make_symbol("STRING?"), make_builtin(builtin_stringp));
   env_set(env, make_symbol("NUMBER?"), make_builtin(builtin_numberp));
+  env_set(env, make_symbol("VECTOR?"), make_builtin(builtin_vectorp));
+  env_set(env, make_symbol("HASH-TABLE?"), make_builtin(builtin_hash_tablep));
+  env_set(env, make_symbol("ARRAY?"), make_builtin(builtin_arrayp));
   env_set(env, make_symbol("ERROR"), make_builtin(builtin_error));
   env_set(env, make_symbol("T"), make_symbol("T"));
+  env_set(env, make_symbol("*MODULES*"), make_hash_table());
+  env_set(env, make_symbol("*LOAD-ONCE*"), nil);
   env_set(env, make_symbol("STRING-EQUAL"), make_builtin(builtin_stringeq));
   env_set(env, make_symbol("STRING-LESSP"), make_builtin(builtin_stringless));
   env_set(env, make_symbol("STRING-CONCAT"), make_builtin(builtin_stringconcat));
   env_set(env, make_symbol("STRING-SUBSTR"), make_builtin(builtin_stringsubstr));
+  env_set(env, make_symbol("STRING-LENGTH"), make_builtin(builtin_stringlength));
+  env_set(env, make_symbol("STRING-SEARCH"), make_builtin(builtin_stringsearch));
+  env_set(env, make_symbol("STRING-INDEX"), make_builtin(builtin_stringindex));
+  env_set(env, make_symbol("STRING-SPLIT"), make_builtin(builtin_stringsplit));
+  env_set(env, make_symbol("STRING-COUNT"), make_builtin(builtin_stringcount));
+  env_set(env, make_symbol("STRING-REPLACE"), make_builtin(builtin_stringreplace));
   env_set(env, make_symbol("PRINT"), make_builtin(builtin_print));
+  env_set(env, make_symbol("GC"), make_builtin(builtin_gc));
+  env_set(env, make_symbol("GC-THRESHOLD"), make_builtin(builtin_gc_threshold));
+  env_set(env, make_symbol("MACROEXPAND-ALL"), make_builtin(builtin_macroexpand_all));
 
   /* these are implemented in eval */
+  init_special_forms();
+  env_set(env, make_symbol("AND"), make_symbol("AND"));
+  env_set(env, make_symbol("COND"), make_symbol("COND"));
   env_set(env, make_symbol("DEFINE"), make_symbol("DEFINE"));
   env_set(env, make_symbol("DEFMACRO"), make_symbol("DEFMACRO"));
   env_set(env, make_symbol("IF"), make_symbol("IF"));
   env_set(env, make_symbol("LAMBDA"), make_symbol("LAMBDA"));
+  env_set(env, make_symbol("LET"), make_symbol("LET"));
   env_set(env, make_symbol("LOAD"), make_symbol("LOAD"));
+  env_set(env, make_symbol("OR"), make_symbol("OR"));
   env_set(env, make_symbol("PROGN"), make_symbol("PROGN"));
+  env_set(env, make_symbol("PROVIDE"), make_symbol("PROVIDE"));
   env_set(env, make_symbol("QUOTE"), make_symbol("QUOTE"));
+  env_set(env, make_symbol("REQUIRE"), make_symbol("REQUIRE"));
   env_set(env, make_symbol("SET!"), make_symbol("SET!"));
+  env_set(env, make_symbol("UNLESS"), make_symbol("UNLESS"));
+  env_set(env, make_symbol("WHEN"), make_symbol("WHEN"));
   env_set(env, make_symbol("WHILE"), make_symbol("WHILE"));
+
+  /* Before anything is rebound, so images can name builtins */
+  image_register_builtins();
   return env;
 }
 
+/* The root environment (the one without a parent) keeps its bindings in
+ * the symbols' global value cells rather than in an association list,
+ * so every root shares them; see setup_env().
+ * Closure calls get an ATOM_FRAME whose slots are laid out by the
+ * closure's Scope; other environments are (parent . bindings) pairs. */
+
+Atom make_frame(Atom parent, struct Scope *scope)
+{
+  Atom env = atom_pointer(ATOM_FRAME, gc_alloc(GC_FRAME,
+      sizeof(struct Frame) + scope->count * sizeof(Atom)));
+  size_t i;
+
+  atom_frame(env)->parent = parent;
+  atom_frame(env)->extra = nil;
+  atom_frame(env)->scope = scope;
+  atom_frame(env)->slots = (Atom*)(atom_frame(env) + 1);
+  for (i = 0; i < scope->count; i++)
+    atom_frame(env)->slots[i] = atom_pointer(ATOM_UNBOUND, NULL);
+  return env;
+}
+
+/* The environment at the top of env's chain of parents */
+Atom env_root(Atom env)
+{
+  for (;;) {
+    Atom parent = atom_type(env) == ATOM_FRAME
+      ? atom_frame(env)->parent : car(env);
+
+    if (nilp(parent))
+      return env;
+    env = parent;
+  }
+}
+
+/* Later names shadow earlier ones, as repeated env_set calls would */
+long scope_index(struct Scope *scope, struct Symbol *symbol)
+{
+  size_t i = scope->count;
+
+  while (i-- > 0) {
+    if (scope->names[i] == symbol)
+      return i;
+  }
+  return -1;
+}
+
+static Atom *frame_slot(Atom env, Atom symbol)
+{
+  struct Frame *frame = atom_frame(env);
+  long i = scope_index(frame->scope, atom_symbol(symbol));
+
+  if (i < 0 || atom_type(frame->slots[i]) == ATOM_UNBOUND)
+    return NULL;
+  return &frame->slots[i];
+}
+
 Error env_get(Atom env, Atom symbol, Atom *result)
 {
-  Atom parent = car(env);
-  Atom bs = cdr(env);
+  Atom parent, bs;
+
+  if (atom_type(env) == ATOM_FRAME) {
+    Atom *slot = frame_slot(env, symbol);
+    if (slot) {
+      *result = *slot;
+      return ERROR_OK();
+    }
+    parent = atom_frame(env)->parent;
+    bs = atom_frame(env)->extra;
+  } else {
+    parent = car(env);
+    bs = cdr(env);
+
+    if (nilp(parent)) {
+      if (!atom_symbol(symbol)->bound)
+        return ERROR(Error_UnBound, atom_symbol(symbol)->name);
+      *result = atom_symbol(symbol)->value;
+      return ERROR_OK();
+    }
+  }
 
   while (!nilp(bs)) {
     Atom b = car(bs);
-    if (car(b).value.symbol == symbol.value.symbol) {
+    if (atom_symbol(car(b)) == atom_symbol(symbol)) {
       *result = cdr(b);
       return ERROR_OK();
     }
     bs = cdr(bs);
   }
 
-  if (nilp(parent))
-    return ERROR(Error_UnBound, symbol.value.symbol);
-
   return env_get(parent, symbol, result);
 }
 
 Error env_set(Atom env, Atom symbol, Atom value)
 {
-  Atom bs = cdr(env);
-  Atom b = nil;
+  Atom bs, b = nil;
+
+  if (atom_type(env) == ATOM_FRAME) {
+    long i = scope_index(atom_frame(env)->scope, atom_symbol(symbol));
+    if (i >= 0) {
+      atom_frame(env)->slots[i] = value;
+      return ERROR_OK();
+    }
+    bs = atom_frame(env)->extra;
+  } else {
+    if (nilp(car(env))) {
+      atom_symbol(symbol)->value = value;
+      atom_symbol(symbol)->bound = 1;
+      return ERROR_OK();
+    }
+    bs = cdr(env);
+  }
 
   while (!nilp(bs)) {
     b = car(bs);
-    if (car(b).value.symbol == symbol.value.symbol) {
+    if (atom_symbol(car(b)) == atom_symbol(symbol)) {
       cdr(b) = value;
       return ERROR_OK();
     }
@@ -78,27 +240,106 @@ Error env_set(Atom env, Atom symbol, Atom value)
   }
 
   b = cons(symbol, value);
-  cdr(env) = cons(b, cdr(env));
+  if (atom_type(env) == ATOM_FRAME)
+    atom_frame(env)->extra = cons(b, atom_frame(env)->extra);
+  else
+    cdr(env) = cons(b, cdr(env));
 
   return ERROR_OK();
 }
 
 Error env_set_existing(Atom env, Atom symbol, Atom value)
 {
-  Atom parent = car(env);
-  Atom bs = cdr(env);
+  Atom parent, bs;
+
+  if (atom_type(env) == ATOM_FRAME) {
+    Atom *slot = frame_slot(env, symbol);
+    if (slot) {
+      *slot = value;
+      return ERROR_OK();
+    }
+    parent = atom_frame(env)->parent;
+    bs = atom_frame(env)->extra;
+  } else {
+    parent = car(env);
+    bs = cdr(env);
+
+    if (nilp(parent)) {
+      if (!atom_symbol(symbol)->bound)
+        return ERROR(Error_UnBound, atom_symbol(symbol)->name);
+      atom_symbol(symbol)->value = value;
+      return ERROR_OK();
+    }
+  }
 
   while (!nilp(bs)) {
     Atom b = car(bs);
-    if (car(b).value.symbol == symbol.value.symbol) {
+    if (atom_symbol(car(b)) == atom_symbol(symbol)) {
       cdr(b) = value;
       return ERROR_OK();
     }
     bs = cdr(bs);
   }
 
-  if (nilp(parent))
-    return ERROR(Error_UnBound, symbol.value.symbol);
-
   return env_set_existing(parent, symbol, value);
 }
+
+/* An ATOM_LOCAL is a (symbol . depth/index) pair made by resolve_body.
+ * The slot is only trusted if the frame found at that depth really has
+ * the symbol at that index; otherwise, e.g. when a macro has moved the
+ * reference into another scope, we fall back to a lookup by name. */
+static Atom *local_slot(Atom env, Atom ref)
+{
+  long depth = LOCAL_DEPTH(ref);
+  long index = LOCAL_INDEX(ref);
+  struct Frame *frame;
+
+  while (depth-- > 0) {
+    if (atom_type(env) != ATOM_FRAME)
+      return NULL;
+    env = atom_frame(env)->parent;
+  }
+
+  if (atom_type(env) != ATOM_FRAME)
+    return NULL;
+
+  frame = atom_frame(env);
+  if ((size_t)index >= frame->scope->count
+      || frame->scope->names[index] != atom_symbol(car(ref)))
+    return NULL;
+
+  return &frame->slots[index];
+}
+
+Error local_get(Atom env, Atom ref, Atom *result)
+{
+  Atom *slot = local_slot(env, ref);
+
+  if (!slot || atom_type(*slot) == ATOM_UNBOUND)
+    return env_get(env, car(ref), result);
+
+  *result = *slot;
+  return ERROR_OK();
+}
+
+Error local_set(Atom env, Atom ref, Atom value)
+{
+  Atom *slot = local_slot(env, ref);
+
+  if (!slot || atom_type(*slot) == ATOM_UNBOUND)
+    return env_set_existing(env, car(ref), value);
+
+  *slot = value;
+  return ERROR_OK();
+}
+
+Error local_define(Atom env, Atom ref, Atom value)
+{
+  Atom *slot = local_slot(env, ref);
+
+  if (!slot)
+    return env_set(env, car(ref), value);
+
+  *slot = value;
+  return ERROR_OK();
+}
@@ -5,20 +5,20 @@
 
 #include "cutie.h"
 
-const Atom nil = {ATOM_NIL, {0}};
+const Atom nil = NIL_INITIALIZER;
 
 /* IO */
 
 int nilp(Atom atom)
 {
-  return atom.type == ATOM_NIL;
+  return atom_type(atom) == ATOM_NIL;
 }
 
 /* Evaluation */
 int listp(Atom expr)
 {
   while (!nilp(expr)) {
-    if (expr.type != ATOM_PAIR)
+    if (atom_type(expr) != ATOM_PAIR)
       return 0;
     expr = cdr(expr);
   }
@@ -28,57 +28,81 @@ int listp(Atom expr)
 Atom copy_list(Atom list)
 {
   Atom a, p;
+  size_t n = 0;
 
-  if (nilp(list))
-    return nil;
+  for (p = list; !nilp(p); p = cdr(p))
+    n++;
 
-  a = cons(car(list), nil);
-  p = a;
-  list = cdr(list);
-
-  while (!nilp(list)) {
-    cdr(p) = cons(car(list), nil);
-    p = cdr(p);
+  a = make_list(n);
+  for (p = a; !nilp(p); p = cdr(p)) {
+    car(p) = car(list);
     list = cdr(list);
   }
 
   return a;
 }
 
-Error apply(Atom fn, Atom args, Atom *result)
+/* Make the frame for a closure call and bind the arguments in it.
+ * Returns the frame in *env and the body forms in *body. */
+static Error bind_arguments(Atom fn, Atom args, Atom *env, Atom *body)
 {
-  Atom env, arg_names, body;
+  struct Scope *scope;
+  size_t i;
 
-  if (fn.type == ATOM_BUILTIN)
-    return (*fn.value.builtin)(args, result);
-  else if (fn.type != ATOM_CLOSURE) {
-    print_expr(fn);
-    return ERROR(Error_Type, "Type must be closure.");
-  }
+  /* The body starts with the ATOM_SCOPE left by resolve_body */
+  *body = cdr(cdr(fn));
+  scope = atom_scope(car(*body));
+  *body = cdr(*body);
+  *env = make_frame(car(fn), scope);
 
-  env = create_env(car(fn));
-  arg_names = car(cdr(fn));
-  body = cdr(cdr(fn));
-
-  /* Bind the arguments */
-  while (!nilp(arg_names)) {
-    if (arg_names.type == ATOM_SYMBOL) {
-      env_set(env, arg_names, args);
-      args = nil;
-      break;
-    } 
+  for (i = 0; i < scope->params; i++) {
     if (nilp(args))
       return ERROR(Error_Args, "Argument required.");
-    env_set(env, car(arg_names), car(args));
-    arg_names = cdr(arg_names);
+    atom_frame(*env)->slots[i] = car(args);
     args = cdr(args);
   }
+  if (scope->rest) {
+    atom_frame(*env)->slots[i] = args;
+    args = nil;
+  }
   if (!nilp(args))
     return ERROR(Error_Args, "Argument required.");
 
+  return ERROR_OK();
+}
+
+/* Which engine eval_expr and apply hand closures and forms to */
+static int engine = ENGINE_TREE;
+
+int cutie_engine(int e)
+{
+  if (e >= 0)
+    engine = e;
+  return engine;
+}
+
+Error apply(Atom fn, Atom args, Atom *result)
+{
+  Atom env, body;
+  Error err;
+
+  if (atom_type(fn) == ATOM_BUILTIN)
+    return (*atom_builtin(fn))(args, result);
+  else if (atom_type(fn) != ATOM_CLOSURE) {
+    print_expr(fn);
+    return ERROR(Error_Type, "Type must be closure.");
+  }
+
+  if (engine == ENGINE_VM)
+    return vm_apply(fn, args, result);
+
+  err = bind_arguments(fn, args, &env, &body);
+  if (ERROR_RAISED(err))
+    return err;
+
   /* Evaluate the body */
   while (!nilp(body)) {
-    Error err = eval_expr(car(body), env, result);
+    err = eval_expr(car(body), env, result);
     if (ERROR_RAISED(err))
       return err;
     body = cdr(body);
@@ -87,212 +111,477 @@ Error apply(Atom fn, Atom args, Atom *result)
   return ERROR_OK();
 }
 
+/* Tag the special form symbols so eval_expr can dispatch on them
+ * without comparing names. */
+void init_special_forms()
+{
+  atom_symbol(make_symbol("QUOTE"))->special = SPECIAL_QUOTE;
+  atom_symbol(make_symbol("DEFINE"))->special = SPECIAL_DEFINE;
+  atom_symbol(make_symbol("SET!"))->special = SPECIAL_SET;
+  atom_symbol(make_symbol("PROGN"))->special = SPECIAL_PROGN;
+  atom_symbol(make_symbol("WHILE"))->special = SPECIAL_WHILE;
+  atom_symbol(make_symbol("LAMBDA"))->special = SPECIAL_LAMBDA;
+  atom_symbol(make_symbol("IF"))->special = SPECIAL_IF;
+  atom_symbol(make_symbol("DEFMACRO"))->special = SPECIAL_DEFMACRO;
+  atom_symbol(make_symbol("LOAD"))->special = SPECIAL_LOAD;
+  atom_symbol(make_symbol("REQUIRE"))->special = SPECIAL_REQUIRE;
+  atom_symbol(make_symbol("PROVIDE"))->special = SPECIAL_PROVIDE;
+  atom_symbol(make_symbol("COND"))->special = SPECIAL_COND;
+  atom_symbol(make_symbol("LET"))->special = SPECIAL_LET;
+  atom_symbol(make_symbol("AND"))->special = SPECIAL_AND;
+  atom_symbol(make_symbol("OR"))->special = SPECIAL_OR;
+  atom_symbol(make_symbol("WHEN"))->special = SPECIAL_WHEN;
+  atom_symbol(make_symbol("UNLESS"))->special = SPECIAL_UNLESS;
+}
+
 Error eval_expr(Atom expr, Atom env, Atom *result)
 {
   Atom op, args, p;
   Error err;
 
-  if (expr.type == ATOM_SYMBOL) {
-    if (expr.value.symbol[0] == ':') {
+  if (engine == ENGINE_VM)
+    return vm_eval(expr, env, result);
+
+  /* Calls in tail position replace expr and env and go round the loop
+   * again instead of recursing, so they run in constant C stack. */
+  for (;;) {
+    if (atom_type(expr) == ATOM_SYMBOL) {
+      if (atom_symbol(expr)->name[0] == ':') {
+        *result = expr;
+        return ERROR_OK();
+      }
+      return env_get(env, expr, result);
+    } else if (atom_type(expr) == ATOM_LOCAL) {
+      return local_get(env, expr, result);
+    } else if (atom_type(expr) != ATOM_PAIR) {
       *result = expr;
       return ERROR_OK();
     }
-    return env_get(env, expr, result);
-  } else if (expr.type != ATOM_PAIR) {
-    *result = expr;
-    return ERROR_OK();
-  }
 
-  if (!listp(expr)) {
-    return ERROR(Error_Syntax, "Expression must be list.");
-  }
+    if (!listp(expr)) {
+      return ERROR(Error_Syntax, "Expression must be list.");
+    }
 
-  op = car(expr);
-  args = cdr(expr);
+    op = car(expr);
+    args = cdr(expr);
 
-  if (op.type == ATOM_SYMBOL) {
-    if (strcmp(op.value.symbol, "QUOTE") == 0) {
-      if (nilp(args) || !nilp(cdr(args)))
-        return ERROR(Error_Args, "QUOTE requires an argument.");
+    if (atom_type(op) == ATOM_SYMBOL) {
+      switch (atom_symbol(op)->special) {
+      case SPECIAL_QUOTE: {
+        if (nilp(args) || !nilp(cdr(args)))
+          return ERROR(Error_Args, "QUOTE requires an argument.");
 
-      *result = car(args);
-      return ERROR_OK();
+        *result = car(args);
+        return ERROR_OK();
+      }
+
+      case SPECIAL_DEFINE: {
+        Atom sym, val;
+
+        if (nilp(args) || nilp(cdr(args)))
+          return ERROR(Error_Args, "DEFINE requires two arguments.");
+
+        sym = car(args);
+        if (atom_type(sym) == ATOM_PAIR) {
+          err = make_closure(env, cdr(sym), cdr(args), &val);
+          sym = car(sym);
+          if (atom_type(sym) != ATOM_SYMBOL)
+            return ERROR(Error_Type, "DEFINE first argument must be symbol.");
+        } else if (atom_type(sym) == ATOM_SYMBOL || atom_type(sym) == ATOM_LOCAL) {
+          if (!nilp(cdr(cdr(args))))
+            return ERROR(Error_Args, "DEFINE argument error.");
+          err = eval_expr(car(cdr(args)), env, &val);
+        } else {
+          return ERROR(Error_Type, "DEFINE argument error.");
+        }
+
+        if (ERROR_RAISED(err))
+          return err;
 
-    } else if (strcmp(op.value.symbol, "DEFINE") == 0) {
-      Atom sym, val;
-
-      if (nilp(args) || nilp(cdr(args)))
-        return ERROR(Error_Args, "DEFINE requires two arguments.");
-
-      sym = car(args);
-      if (sym.type == ATOM_PAIR) {
-        err = make_closure(env, cdr(sym), cdr(args), &val);
-        sym = car(sym);
-        if (sym.type != ATOM_SYMBOL)
-          return ERROR(Error_Type, "DEFINE first argument must be symbol.");
-      } else if (sym.type == ATOM_SYMBOL) {
-        if (!nilp(cdr(cdr(args))))
-          return ERROR(Error_Args, "DEFINE argument error.");
-        err = eval_expr(car(cdr(args)), env, &val);
-      } else {
-        return ERROR(Error_Type, "DEFINE argument error.");
+        if (atom_type(sym) == ATOM_LOCAL) {
+          *result = car(sym);
+          return local_define(env, sym, val);
+        }
+
+        *result = sym;
+        return env_set(env, sym, val);
       }
 
-      if (ERROR_RAISED(err))
-        return err;
+      case SPECIAL_SET: {
+        Atom sym, val;
+
+        if (nilp(args) || nilp(cdr(args)))
+          return ERROR(Error_Args, "SET! requires two arguments.");
+
+        sym = car(args);
+        if (atom_type(sym) == ATOM_PAIR) {
+          err = make_closure(env, cdr(sym), cdr(args), &val);
+          sym = car(sym);
+          if (atom_type(sym) != ATOM_SYMBOL)
+            return ERROR(Error_Type, "SET! first argument not symbol");
+        } else if (atom_type(sym) == ATOM_SYMBOL || atom_type(sym) == ATOM_LOCAL) {
+          if (!nilp(cdr(cdr(args))))
+            return ERROR(Error_Args, "SET! argument error.");
+          err = eval_expr(car(cdr(args)), env, &val);
+        } else {
+          return ERROR(Error_Type, "SET! argument error.");
+        }
+
+        if (ERROR_RAISED(err))
+          return err;
 
-      *result = sym;
-      return env_set(env, sym, val);
-
-    } else if (strcmp(op.value.symbol, "SET!") == 0) {
-      Atom sym, val;
-
-      if (nilp(args) || nilp(cdr(args)))
-        return ERROR(Error_Args, "SET! requires two arguments.");
-
-      sym = car(args);
-      if (sym.type == ATOM_PAIR) {
-        err = make_closure(env, cdr(sym), cdr(args), &val);
-        sym = car(sym);
-        if (sym.type != ATOM_SYMBOL)
-          return ERROR(Error_Type, "SET! first argument not symbol");
-      } else if (sym.type == ATOM_SYMBOL) {
-        if (!nilp(cdr(cdr(args))))
-          return ERROR(Error_Args, "SET! argument error.");
-        err = eval_expr(car(cdr(args)), env, &val);
-      } else {
-        return ERROR(Error_Type, "SET! argument error.");
+        if (atom_type(sym) == ATOM_LOCAL) {
+          *result = car(sym);
+          return local_set(env, sym, val);
+        }
+
+        *result = sym;
+        return env_set_existing(env, sym, val);
       }
 
-      if (ERROR_RAISED(err))
+      case SPECIAL_PROGN: {
+        Atom body = args;
+
+        if (nilp(body))
+          return ERROR_OK();
+
+        /* Evaluate the body, the last form in tail position */
+        while (!nilp(cdr(body))) {
+          Error err = eval_expr(car(body), env, result);
+          if (ERROR_RAISED(err))
+            return err;
+          body = cdr(body);
+        }
+        expr = car(body);
+        continue;
+      }
+
+      case SPECIAL_WHILE: {
+        Atom cond;
+
+        if (nilp(args) || nilp(cdr(args)) || !nilp(cdr(cdr(args))))
+          return ERROR(Error_Args, "WHILE requires two arguments.");
+
+        *result = nil;
+        Error err = eval_expr(car(args), env, &cond);
+        Atom res;
+
+        while (!nilp(cond) && !ERROR_RAISED(err)) {
+          err = eval_expr(car(cdr(args)), env, &res);
+          if (ERROR_RAISED(err))
+            return err;
+
+          err = eval_expr(car(args), env, &cond);
+        }
+
         return err;
+      }
+
+      case SPECIAL_LAMBDA: {
+        if (nilp(args) || nilp(cdr(args)))
+          return ERROR(Error_Args, "LAMBDA requires two arguments.");
+
+        return make_closure(env, car(args), cdr(args), result);
+      }
 
-      *result = sym;
-      return env_set_existing(env, sym, val);
+      case SPECIAL_IF: {
+        Atom cond;
 
-    } else if (strcmp(op.value.symbol, "PROGN") == 0) {
-      Atom body = args;
+        if (nilp(args) || nilp(cdr(args)) || nilp(cdr(cdr(args)))
+            || !nilp(cdr(cdr(cdr(args)))))
+          return ERROR(Error_Args, "IF requires three arguments.");
 
-      /* Evaluate the body */
-      while (!nilp(body)) {
-        Error err = eval_expr(car(body), env, result);
+        err = eval_expr(car(args), env, &cond);
         if (ERROR_RAISED(err))
           return err;
-        body = cdr(body);
+
+        expr = nilp(cond) ? car(cdr(cdr(args))) : car(cdr(args));
+        continue;
       }
-      return ERROR_OK();
 
-    } else if (strcmp(op.value.symbol, "WHILE") == 0) {
-      Atom cond;
+      case SPECIAL_DEFMACRO: {
+        Atom name, macro;
+        Error err;
+
+        if (nilp(args) || nilp(cdr(args)))
+          return ERROR(Error_Args, "DEFMACRO requires two arguments.");
 
-      if (nilp(args) || nilp(cdr(args)) || !nilp(cdr(cdr(args))))
-        return ERROR(Error_Args, "WHILE requires two arguments.");
+        if (atom_type(car(args)) != ATOM_PAIR)
+          return ERROR(Error_Syntax, "DEFMACRO syntax error.");
 
-      *result = nil;
-      Error err = eval_expr(car(args), env, &cond);
-      Atom res;
+        name = car(car(args));
+        if (atom_type(name) != ATOM_SYMBOL)
+          return ERROR(Error_Type, "DEFMACRO type error.");
 
-      while (!nilp(cond) && !ERROR_RAISED(err)) {
-        err = eval_expr(car(cdr(args)), env, &res);
+        err = make_closure(env, cdr(car(args)),
+          cdr(args), &macro);
         if (ERROR_RAISED(err))
           return err;
 
-        err = eval_expr(car(args), env, &cond);
+        macro = atom_retype(macro, ATOM_MACRO);
+        *result = name;
+        return env_set(env, name, macro);
       }
 
-      return err;
+      case SPECIAL_LOAD: {
+        Atom a;
 
-    } else if (strcmp(op.value.symbol, "LAMBDA") == 0) {
-      if (nilp(args) || nilp(cdr(args)))
-        return ERROR(Error_Args, "LAMBDA requires two arguments.");
+        if (nilp(args))
+          return ERROR(Error_Args, "LOAD takes one argument.");
 
-      return make_closure(env, car(args), cdr(args), result);
+        a = car(args);
 
-    } else if (strcmp(op.value.symbol, "IF") == 0) {
-      Atom cond, val;
+        err = eval_expr(a, env, &a);
+        if (ERROR_RAISED(err))
+          return err;
 
-      if (nilp(args) || nilp(cdr(args)) || nilp(cdr(cdr(args)))
-          || !nilp(cdr(cdr(cdr(args)))))
-        return ERROR(Error_Args, "IF requires three arguments.");
+        if (atom_type(a) != ATOM_STRING)
+          return ERROR(Error_Type, "LOAD argument must be a string.");
 
-      err = eval_expr(car(args), env, &cond);
-      if (ERROR_RAISED(err))
-        return err;
+        err = load_path(env, string_chars(a));
+        if (ERROR_RAISED(err))
+          return err;
+        *result = make_symbol("T");
+        return ERROR_OK();
+      }
 
-      val = nilp(cond) ? car(cdr(cdr(args))) : car(cdr(args));
-      return eval_expr(val, env, result);
+      case SPECIAL_REQUIRE: {
+        Atom module, path = nil;
 
-    } else if (strcmp(op.value.symbol, "DEFMACRO") == 0) {
-      Atom name, macro;
-      Error err;
+        if (nilp(args) || (!nilp(cdr(args)) && !nilp(cdr(cdr(args)))))
+          return ERROR(Error_Args, "REQUIRE takes one or two arguments.");
 
-      if (nilp(args) || nilp(cdr(args)))
-        return ERROR(Error_Args, "DEFMACRO requires two arguments.");
+        err = eval_expr(car(args), env, &module);
+        if (ERROR_RAISED(err))
+          return err;
+        if (!nilp(cdr(args))) {
+          err = eval_expr(car(cdr(args)), env, &path);
+          if (ERROR_RAISED(err))
+            return err;
+        }
+        return require_module(env, module, path, result);
+      }
+
+      case SPECIAL_PROVIDE: {
+        Atom feature;
+
+        if (nilp(args) || !nilp(cdr(args)))
+          return ERROR(Error_Args, "PROVIDE takes one argument.");
+
+        err = eval_expr(car(args), env, &feature);
+        if (ERROR_RAISED(err))
+          return err;
+        return provide_feature(env, feature, result);
+      }
 
-      if (car(args).type != ATOM_PAIR)
-        return ERROR(Error_Syntax, "DEFMACRO syntax error.");
+      case SPECIAL_COND: {
+        Atom clause = nil, test, body;
+
+        /* The first clause whose test is true gives the value of its
+         * body, or of the test itself if it has no body */
+        for (; !nilp(args); args = cdr(args)) {
+          clause = car(args);
+          if (atom_type(clause) != ATOM_PAIR || !listp(clause))
+            return ERROR(Error_Syntax, "COND clause must be a list.");
+
+          err = eval_expr(car(clause), env, &test);
+          if (ERROR_RAISED(err))
+            return err;
+          if (!nilp(test))
+            break;
+        }
+
+        if (nilp(args)) {
+          *result = nil;
+          return ERROR_OK();
+        }
+        *result = test;
+        body = cdr(clause);
+        if (nilp(body))
+          return ERROR_OK();
+        while (!nilp(cdr(body))) {
+          err = eval_expr(car(body), env, result);
+          if (ERROR_RAISED(err))
+            return err;
+          body = cdr(body);
+        }
+        expr = car(body);
+        continue;
+      }
 
-      name = car(car(args));
-      if (name.type != ATOM_SYMBOL)
-        return ERROR(Error_Type, "DEFMACRO type error.");
+      case SPECIAL_LET: {
+        struct Scope *scope;
+        Atom frame, bindings, body;
+        size_t i;
+
+        if (nilp(args))
+          return ERROR(Error_Args, "LET requires bindings.");
+
+        err = resolve_let(env, args, &scope);
+        if (ERROR_RAISED(err))
+          return err;
+
+        /* The values are evaluated outside the new frame */
+        frame = make_frame(env, scope);
+        bindings = car(args);
+        for (i = 0; !nilp(bindings); bindings = cdr(bindings), i++) {
+          Atom *slot = &atom_frame(frame)->slots[i];
+
+          if (nilp(cdr(car(bindings)))) {
+            *slot = nil;
+            continue;
+          }
+          err = eval_expr(car(cdr(car(bindings))), env, slot);
+          if (ERROR_RAISED(err))
+            return err;
+        }
+
+        env = frame;
+        body = cdr(cdr(args));
+        if (nilp(body)) {
+          *result = nil;
+          return ERROR_OK();
+        }
+        while (!nilp(cdr(body))) {
+          err = eval_expr(car(body), env, result);
+          if (ERROR_RAISED(err))
+            return err;
+          body = cdr(body);
+        }
+        expr = car(body);
+        continue;
+      }
+
+      case SPECIAL_AND:
+      case SPECIAL_OR: {
+        int and = atom_symbol(op)->special == SPECIAL_AND;
+
+        if (nilp(args)) {
+          *result = and ? make_symbol("T") : nil;
+          return ERROR_OK();
+        }
+
+        /* Stop at the first nil for AND, the first true value for OR;
+         * the last argument is in tail position */
+        while (!nilp(cdr(args))) {
+          err = eval_expr(car(args), env, result);
+          if (ERROR_RAISED(err))
+            return err;
+          if (nilp(*result) == and)
+            return ERROR_OK();
+          args = cdr(args);
+        }
+        expr = car(args);
+        continue;
+      }
+
+      case SPECIAL_WHEN:
+      case SPECIAL_UNLESS: {
+        Atom cond, body;
+
+        if (nilp(args))
+          return ERROR(Error_Args, "WHEN and UNLESS require a condition.");
+
+        err = eval_expr(car(args), env, &cond);
+        if (ERROR_RAISED(err))
+          return err;
+
+        body = cdr(args);
+        if (nilp(cond) == (atom_symbol(op)->special == SPECIAL_WHEN)
+            || nilp(body)) {
+          *result = nil;
+          return ERROR_OK();
+        }
+        while (!nilp(cdr(body))) {
+          err = eval_expr(car(body), env, result);
+          if (ERROR_RAISED(err))
+            return err;
+          body = cdr(body);
+        }
+        expr = car(body);
+        continue;
+      }
 
-      err = make_closure(env, cdr(car(args)),
-        cdr(args), &macro);
+      default:
+        break;
+      }
+    }
+
+    /* A macro call expanded before: use the expansion as long as the
+     * operator still names the same macro, otherwise put the call back
+     * the way it was and expand it again */
+    if (atom_type(op) == ATOM_EXPANSION) {
+      err = eval_expr(car(op), env, &p);
       if (ERROR_RAISED(err))
         return err;
 
-      macro.type = ATOM_MACRO;
-      *result = name;
-      return env_set(env, name, macro);
-
-    } else if (strcmp(op.value.symbol, "LOAD") == 0) {
-      Atom a;
+      if (atom_type(p) == ATOM_MACRO) {
+        err = expand_call(expr, p, &expr);
+        if (ERROR_RAISED(err))
+          return err;
+        continue;
+      }
+      car(expr) = car(op);
+      continue;
+    }
 
-      if (nilp(args))
-        return ERROR(Error_Args, "LOAD takes one argument.");
+    /* Evaluate operator */
+    err = eval_expr(op, env, &p);
+    if (ERROR_RAISED(err))
+      return err;
 
-      a = car(args);
+    /* Is it a macro? Expand it and keep the expansion in the call */
+    if (atom_type(p) == ATOM_MACRO) {
+      err = expand_call(expr, p, &expr);
+      if (ERROR_RAISED(err))
+        return err;
+      continue;
+    }
+    op = p;
 
-      err = eval_expr(a, env, &a);
+    /* Evaluate arguments */
+    args = copy_list(args);
+    p = args;
+    while (!nilp(p)) {
+      err = eval_expr(car(p), env, &car(p));
       if (ERROR_RAISED(err))
         return err;
 
-      if (a.type != ATOM_STRING)
-        return ERROR(Error_Type, "LOAD argument must be a string.");
+      p = cdr(p);
+    }
 
-      load_file(env, a.value.string);
-      *result = make_symbol("T");
-      return ERROR_OK();
+    /* (APPLY f args) in tail position is a tail call to f */
+    if (atom_type(op) == ATOM_BUILTIN && atom_builtin(op) == builtin_apply
+        && !nilp(args) && !nilp(cdr(args)) && nilp(cdr(cdr(args)))
+        && listp(car(cdr(args)))) {
+      op = car(args);
+      args = car(cdr(args));
     }
-  }
 
-  /* Evaluate operator */
-  err = eval_expr(op, env, &op);
-  if (ERROR_RAISED(err))
-    return err;
+    if (atom_type(op) != ATOM_CLOSURE)
+      return apply(op, args, result);
 
-  /* Is it a macro? */
-  if (op.type == ATOM_MACRO) {
-    Atom expansion;
-    op.type = ATOM_CLOSURE;
-    err = apply(op, args, &expansion);
-    if (ERROR_RAISED(err))
-      return err;
-    return eval_expr(expansion, env, result);
-  }
+    /* Closure call: evaluate the body in a new frame, with the last
+     * form in tail position */
+    {
+      Atom body;
 
-  /* Evaluate arguments */
-  args = copy_list(args);
-  p = args;
-  while (!nilp(p)) {
-    err = eval_expr(car(p), env, &car(p));
-    if (ERROR_RAISED(err))
-      return err;
+      err = bind_arguments(op, args, &env, &body);
+      if (ERROR_RAISED(err))
+        return err;
 
-    p = cdr(p);
-  }
+      if (nilp(body))
+        return ERROR_OK();
 
-  return apply(op, args, result);
+      while (!nilp(cdr(body))) {
+        err = eval_expr(car(body), env, result);
+        if (ERROR_RAISED(err))
+          return err;
+        body = cdr(body);
+      }
+      expr = car(body);
+    }
+  }
 }
 
 int error_raised(Error err) {
@@ -0,0 +1,206 @@
+#include "cutie.h"
+
+/* MACRO EXPANSION
+ *
+ * Macro calls are expanded ahead of time: make_closure walks a body when
+ * the closure is first made, and load_file walks each top-level form as
+ * it is read. An expanded call keeps its expansion in place of its
+ * operator (an ATOM_EXPANSION), so the evaluator only has to check that
+ * the operator still names the same macro to go straight to it.
+ *
+ * The pass is best effort. Calls to macros not defined yet and calls
+ * whose expansion fails are left alone, to be expanded (or raise their
+ * error) when they are evaluated. So are expansions nested deeper than
+ * MAX_EXPANSION_DEPTH: some macros, such as AND-LIST, recurse on data only
+ * known at runtime and would otherwise expand forever. */
+
+#define MAX_EXPANSION_DEPTH 64
+
+/* Expand the call form with macro, reusing the expansion already kept in
+ * the call if it was made by the same macro. */
+Error expand_call(Atom form, Atom macro, Atom *expansion)
+{
+  Atom op = car(form), fn;
+  Error err;
+
+  if (atom_type(op) == ATOM_EXPANSION) {
+    if (atom_pair(car(cdr(op))) == atom_pair(macro)) {
+      *expansion = cdr(cdr(op));
+      return ERROR_OK();
+    }
+    op = car(op);
+  }
+
+  fn = atom_retype(macro, ATOM_CLOSURE);
+  err = apply(fn, cdr(form), expansion);
+  if (ERROR_RAISED(err))
+    return err;
+
+  car(form) = atom_retype(cons(op, cons(macro, *expansion)),
+      ATOM_EXPANSION);
+  return ERROR_OK();
+}
+
+/* bound is a list of the parameter lists of the LAMBDAs being walked,
+ * or the binding lists of LETs */
+static int macro_binding(Atom op, Atom bound, Atom env, Atom *macro)
+{
+  long depth, index;
+  Atom p;
+
+  if (!atom_symbol(op)->bound || atom_type(atom_symbol(op)->value) != ATOM_MACRO)
+    return 0;
+
+  for (; !nilp(bound); bound = cdr(bound)) {
+    for (p = car(bound); atom_type(p) == ATOM_PAIR; p = cdr(p)) {
+      Atom name = atom_type(car(p)) == ATOM_PAIR ? car(car(p)) : car(p);
+      if (atom_symbol(name) == atom_symbol(op))
+        return 0;
+    }
+    if (atom_type(p) == ATOM_SYMBOL && atom_symbol(p) == atom_symbol(op))
+      return 0;
+  }
+
+  if (lookup_local(op, NULL, env, &depth, &index) != LOCAL_NONE)
+    return 0;
+
+  *macro = atom_symbol(op)->value;
+  return 1;
+}
+
+static void expand_expr(Atom expr, Atom bound, Atom env, int depth);
+
+static void expand_list(Atom list, Atom bound, Atom env, int depth)
+{
+  for (; atom_type(list) == ATOM_PAIR; list = cdr(list))
+    expand_expr(car(list), bound, env, depth);
+}
+
+static void expand_expr(Atom expr, Atom bound, Atom env, int depth)
+{
+  Atom op, args, macro, expansion, p;
+
+  if (atom_type(expr) != ATOM_PAIR || !listp(expr))
+    return;
+
+  op = car(expr);
+  args = cdr(expr);
+
+  if (atom_type(op) == ATOM_EXPANSION)
+    return;
+
+  if (atom_type(op) == ATOM_SYMBOL) {
+    switch (atom_symbol(op)->special) {
+    case SPECIAL_QUOTE:
+    case SPECIAL_DEFMACRO:
+      /* a macro's body is expanded when the macro is made */
+      return;
+
+    case SPECIAL_LAMBDA:
+      if (!nilp(args))
+        expand_list(cdr(args), cons(car(args), bound), env, depth);
+      return;
+
+    case SPECIAL_LET:
+      if (nilp(args))
+        return;
+      for (p = car(args); atom_type(p) == ATOM_PAIR; p = cdr(p)) {
+        if (atom_type(car(p)) == ATOM_PAIR)
+          expand_list(cdr(car(p)), bound, env, depth);
+      }
+      expand_list(cdr(args), cons(car(args), bound), env, depth);
+      return;
+
+    case SPECIAL_COND:
+      for (; !nilp(args); args = cdr(args))
+        expand_list(car(args), bound, env, depth);
+      return;
+
+    case SPECIAL_DEFINE:
+    case SPECIAL_SET:
+      if (!nilp(args) && atom_type(car(args)) == ATOM_PAIR)
+        expand_list(cdr(args), cons(cdr(car(args)), bound), env, depth);
+      else if (!nilp(args))
+        expand_list(cdr(args), bound, env, depth);
+      return;
+
+    case SPECIAL_NONE:
+      if (!macro_binding(op, bound, env, &macro))
+        break;
+      if (depth < MAX_EXPANSION_DEPTH
+          && !ERROR_RAISED(expand_call(expr, macro, &expansion)))
+        expand_expr(expansion, bound, env, depth + 1);
+      return;
+
+    default:
+      expand_list(args, bound, env, depth);
+      return;
+    }
+  }
+
+  expand_list(expr, bound, env, depth);
+}
+
+/* Expand the body of a closure with parameters args made in env */
+void expand_body(Atom env, Atom args, Atom body)
+{
+  expand_list(body, cons(args, nil), env, 0);
+}
+
+/* Expand a top-level form to be evaluated in env */
+void expand_form(Atom env, Atom expr)
+{
+  expand_expr(expr, nil, env, 0);
+}
+
+static Atom copy_tree(Atom expr)
+{
+  Atom head = nil, tail = nil;
+
+  if (atom_type(expr) != ATOM_PAIR)
+    return expr;
+
+  while (atom_type(expr) == ATOM_PAIR) {
+    Atom cell = cons(copy_tree(car(expr)), nil);
+    if (nilp(head))
+      head = cell;
+    else
+      cdr(tail) = cell;
+    tail = cell;
+    expr = cdr(expr);
+  }
+  cdr(tail) = expr;
+  return head;
+}
+
+/* A copy of expr with each expanded call replaced by its expansion */
+static Atom strip_expansions(Atom expr)
+{
+  Atom head = nil, tail = nil;
+
+  while (atom_type(expr) == ATOM_PAIR && atom_type(car(expr)) == ATOM_EXPANSION)
+    expr = cdr(cdr(car(expr)));
+  if (atom_type(expr) != ATOM_PAIR)
+    return expr;
+
+  while (atom_type(expr) == ATOM_PAIR) {
+    Atom cell = cons(strip_expansions(car(expr)), nil);
+    if (nilp(head))
+      head = cell;
+    else
+      cdr(tail) = cell;
+    tail = cell;
+    expr = cdr(expr);
+  }
+  cdr(tail) = expr;
+  return head;
+}
+
+/* The form with every macro call expanded, as far as the expansion pass
+ * goes, using the global macro definitions. */
+Atom macroexpand_all(Atom expr)
+{
+  expr = copy_tree(expr);
+  expand_expr(expr, nil, nil, 0);
+  return strip_expansions(expr);
+}
@@ -0,0 +1,312 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "cutie.h"
+
+/* HASH TABLES
+ *
+ * A table chains its entries: each bucket is a list whose items are
+ * (key . value) pairs. Keys are hashed structurally and compared with
+ * atom_equal(), so strings, numbers and lists find their entries by
+ * content and symbols by their interned pointer.
+ *
+ * Growing is incremental. Once the table holds as many entries as it has
+ * buckets, a bucket array twice the size is put in place and the old one
+ * is kept alongside; every later operation moves the next few old buckets
+ * across, relinking the existing cells. Until all are moved, lookups
+ * check the unmoved old bucket as well. No single insert ever rehashes
+ * the whole table. */
+
+#define HASH_INITIAL_BUCKETS 8
+#define HASH_MIGRATE_STEP    4
+
+/* Lists and vectors are hashed no further than this many items deep or
+ * long; equal keys still hash alike, they just share more buckets. */
+#define HASH_MAX_ITEMS 16
+
+static unsigned long hash_bytes(unsigned long h, const void *p, size_t len)
+{
+  const unsigned char *s = p;
+  size_t i;
+
+  for (i = 0; i < len; i++) {
+    h ^= s[i];
+    h *= 1099511628211UL;
+  }
+  return h;
+}
+
+static unsigned long hash_mix(unsigned long h, unsigned long x)
+{
+  return hash_bytes(h, &x, sizeof(x));
+}
+
+static unsigned long hash_limited(Atom key, int *budget)
+{
+  unsigned long h = hash_mix(14695981039346656037UL, atom_type(key));
+  size_t i;
+
+  if (--*budget < 0)
+    return h;
+
+  switch (atom_type(key)) {
+    case ATOM_NIL:
+      return h;
+    case ATOM_INTEGER:
+      return hash_mix(h, (unsigned long)atom_integer(key));
+    case ATOM_REAL: {
+      double x = atom_real(key);
+      /* 0.0 and -0.0 are equal */
+      return x == 0.0 ? h : hash_bytes(h, &x, sizeof(x));
+    }
+    case ATOM_STRING:
+      return hash_bytes(h, string_bytes(key), atom_string(key)->length);
+    case ATOM_SYMBOL:
+      return hash_mix(h, (uintptr_t)atom_symbol(key));
+    case ATOM_PAIR:
+      for (; atom_type(key) == ATOM_PAIR && *budget > 0; key = cdr(key))
+        h = hash_mix(h, hash_limited(car(key), budget));
+      if (atom_type(key) != ATOM_PAIR)
+        h = hash_mix(h, hash_limited(key, budget));
+      return h;
+    case ATOM_VECTOR:
+      for (i = 0; i < atom_vector(key)->length && *budget > 0; i++)
+        h = hash_mix(h, hash_limited(atom_vector(key)->items[i], budget));
+      return h;
+    case ATOM_BUILTIN:
+      return hash_mix(h, (uintptr_t)atom_builtin(key));
+    case ATOM_ARRAY:
+      return hash_mix(hash_mix(h, atom_array(key)->kind),
+          atom_array(key)->length);
+    default:
+      return hash_mix(h, (uintptr_t)atom_pair(key));
+  }
+}
+
+unsigned long hash_atom(Atom key)
+{
+  int budget = HASH_MAX_ITEMS;
+  return hash_limited(key, &budget);
+}
+
+/* Structural equality: strings and numbers by value, lists, vectors and
+ * arrays item by item, anything else by identity as with EQ?. */
+int atom_equal(Atom a, Atom b)
+{
+  size_t i;
+
+  for (;;) {
+    if (atom_type(a) != atom_type(b))
+      return 0;
+
+    switch (atom_type(a)) {
+      case ATOM_NIL:
+        return 1;
+      case ATOM_INTEGER:
+        return atom_integer(a) == atom_integer(b);
+      case ATOM_REAL:
+        return atom_real(a) == atom_real(b);
+      case ATOM_STRING:
+        return string_compare(a, b) == 0;
+      case ATOM_SYMBOL:
+        return atom_symbol(a) == atom_symbol(b);
+      case ATOM_BUILTIN:
+        return atom_builtin(a) == atom_builtin(b);
+      case ATOM_PAIR:
+        if (atom_pair(a) == atom_pair(b))
+          return 1;
+        if (!atom_equal(car(a), car(b)))
+          return 0;
+        a = cdr(a);
+        b = cdr(b);
+        break;
+      case ATOM_VECTOR:
+        if (atom_vector(a) == atom_vector(b))
+          return 1;
+        if (atom_vector(a)->length != atom_vector(b)->length)
+          return 0;
+        for (i = 0; i < atom_vector(a)->length; i++) {
+          if (!atom_equal(atom_vector(a)->items[i], atom_vector(b)->items[i]))
+            return 0;
+        }
+        return 1;
+      case ATOM_ARRAY: {
+        struct Array *x = atom_array(a), *y = atom_array(b);
+        if (x->kind != y->kind || x->length != y->length)
+          return 0;
+        for (i = 0; i < x->length; i++) {
+          if (x->kind == ARRAY_F64 ? x->data.f64[i] != y->data.f64[i]
+              : x->data.i64[i] != y->data.i64[i])
+            return 0;
+        }
+        return 1;
+      }
+      default:
+        return atom_pair(a) == atom_pair(b);
+    }
+  }
+}
+
+static Atom *make_buckets(size_t n)
+{
+  Atom *buckets = gc_alloc(GC_DATA, n * sizeof(Atom));
+  size_t i;
+
+  for (i = 0; i < n; i++)
+    buckets[i] = nil;
+  return buckets;
+}
+
+Atom make_hash_table(void)
+{
+  Atom t = atom_pointer(ATOM_HASHTABLE,
+      gc_alloc(GC_HASHTABLE, sizeof(struct HashTable)));
+  struct HashTable *table = atom_hashtable(t);
+
+  table->count = 0;
+  table->capacity = 0;
+  table->buckets = NULL;
+  table->old = NULL;
+  table->old_capacity = 0;
+  table->migrated = 0;
+
+  table->buckets = make_buckets(HASH_INITIAL_BUCKETS);
+  table->capacity = HASH_INITIAL_BUCKETS;
+  return t;
+}
+
+/* Move the next few old buckets into the current array */
+static void hash_migrate(struct HashTable *table)
+{
+  int step;
+
+  for (step = 0; step < HASH_MIGRATE_STEP && table->old; step++) {
+    Atom cell = table->old[table->migrated];
+
+    table->old[table->migrated] = nil;
+    while (!nilp(cell)) {
+      Atom next = cdr(cell);
+      size_t i = hash_atom(car(car(cell))) & (table->capacity - 1);
+
+      cdr(cell) = table->buckets[i];
+      table->buckets[i] = cell;
+      cell = next;
+    }
+
+    if (++table->migrated == table->old_capacity) {
+      table->old = NULL;
+      table->old_capacity = 0;
+      table->migrated = 0;
+    }
+  }
+}
+
+static void hash_grow(struct HashTable *table)
+{
+  Atom *buckets = make_buckets(table->capacity * 2);
+
+  table->old = table->buckets;
+  table->old_capacity = table->capacity;
+  table->migrated = 0;
+  table->buckets = buckets;
+  table->capacity *= 2;
+}
+
+/* The bucket key is on if it is in the table: the current one unless it
+ * is still waiting in an old bucket not moved yet */
+static Atom *hash_bucket(struct HashTable *table, Atom key, unsigned long h)
+{
+  Atom *bucket = &table->buckets[h & (table->capacity - 1)];
+  size_t i;
+
+  if (table->old) {
+    Atom p;
+
+    for (p = *bucket; !nilp(p); p = cdr(p)) {
+      if (atom_equal(car(car(p)), key))
+        return bucket;
+    }
+    i = h & (table->old_capacity - 1);
+    if (i >= table->migrated)
+      return &table->old[i];
+  }
+  return bucket;
+}
+
+static Atom hash_lookup(struct HashTable *table, Atom key, unsigned long h)
+{
+  Atom p;
+
+  for (p = *hash_bucket(table, key, h); !nilp(p); p = cdr(p)) {
+    if (atom_equal(car(car(p)), key))
+      return car(p);
+  }
+  return nil;
+}
+
+/* The (key . value) entry for key, or nil */
+Atom hash_get(Atom table, Atom key)
+{
+  struct HashTable *t = atom_hashtable(table);
+
+  hash_migrate(t);
+  return hash_lookup(t, key, hash_atom(key));
+}
+
+void hash_put(Atom table, Atom key, Atom value)
+{
+  struct HashTable *t = atom_hashtable(table);
+  unsigned long h = hash_atom(key);
+  Atom entry, *bucket;
+
+  hash_migrate(t);
+  entry = hash_lookup(t, key, h);
+
+  if (!nilp(entry)) {
+    cdr(entry) = value;
+    return;
+  }
+
+  if (!t->old && t->count >= t->capacity)
+    hash_grow(t);
+
+  entry = cons(key, value);
+  bucket = &t->buckets[h & (t->capacity - 1)];
+  *bucket = cons(entry, *bucket);
+  t->count++;
+}
+
+int hash_remove(Atom table, Atom key)
+{
+  struct HashTable *t = atom_hashtable(table);
+  Atom *link;
+
+  hash_migrate(t);
+  for (link = hash_bucket(t, key, hash_atom(key)); !nilp(*link);
+      link = &cdr(*link)) {
+    if (atom_equal(car(car(*link)), key)) {
+      *link = cdr(*link);
+      t->count--;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* A fresh list of the table's (key . value) entries */
+Atom hash_entries(Atom table)
+{
+  struct HashTable *t = atom_hashtable(table);
+  Atom result = nil, p;
+  size_t i;
+
+  for (i = 0; i < t->capacity; i++) {
+    for (p = t->buckets[i]; !nilp(p); p = cdr(p))
+      result = cons(cons(car(car(p)), cdr(car(p))), result);
+  }
+  for (i = t->migrated; t->old && i < t->old_capacity; i++) {
+    for (p = t->old[i]; !nilp(p); p = cdr(p))
+      result = cons(cons(car(car(p)), cdr(car(p))), result);
+  }
+  return result;
+}
@@ -0,0 +1,822 @@
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cutie.h"
+
+/* HEAP IMAGES
+ *
+ * An image holds the global bindings of an environment and everything
+ * they reach, so a session can start from a saved one instead of
+ * evaluating its libraries again. It holds no addresses: objects are
+ * numbered in the order they are found and refer to one another by
+ * number, symbols are written by name, and builtins by the name they
+ * were bound to when setup_env() registered them. An image therefore
+ * stays good across builds and for either Atom representation, as long
+ * as the byte order is the same.
+ *
+ * Loading maps the file and relocates it in two passes over the object
+ * records: the first allocates every object, the second fills in the
+ * references now that each number has an address. Hash tables are filled
+ * last, since their keys have to be complete before they are hashed.
+ * The collector is held off until the globals are bound, as the new
+ * objects are only reachable from the relocation table before that.
+ *
+ * Ropes and slices are saved as flat strings. Bytecode is not saved;
+ * closures are compiled again the first time the VM calls them. */
+
+#define IMAGE_MAGIC   "CUTIEIMG"
+#define IMAGE_VERSION 1
+
+/* Atom types are written as AtomType, or this for the environment the
+ * image was saved from, which becomes the one it is loaded into */
+#define IMAGE_ROOT 0xff
+
+enum {
+  OBJ_PAIR,
+  OBJ_STRING,
+  OBJ_VECTOR,
+  OBJ_HASHTABLE,
+  OBJ_ARRAY,
+  OBJ_SCOPE,
+  OBJ_FRAME,
+};
+
+/* BUILTIN NAMES */
+
+struct BuiltinName {
+  Builtin fn;
+  const char *name;
+};
+
+static struct BuiltinName *builtin_names = NULL;
+static size_t builtin_count = 0;
+
+/* Record the name every builtin is bound to, while the environment is
+ * fresh and nothing has been rebound */
+void image_register_builtins(void)
+{
+  size_t i = 0, n = 0;
+  Atom sym;
+
+  while (symbol_next(&i, &sym)) {
+    if (atom_symbol(sym)->bound
+        && atom_type(atom_symbol(sym)->value) == ATOM_BUILTIN)
+      n++;
+  }
+
+  free(builtin_names);
+  builtin_names = malloc(n * sizeof(struct BuiltinName));
+  builtin_count = 0;
+  for (i = 0; builtin_names && symbol_next(&i, &sym);) {
+    if (atom_symbol(sym)->bound
+        && atom_type(atom_symbol(sym)->value) == ATOM_BUILTIN) {
+      builtin_names[builtin_count].fn = atom_builtin(atom_symbol(sym)->value);
+      builtin_names[builtin_count].name = atom_symbol(sym)->name;
+      builtin_count++;
+    }
+  }
+}
+
+static const char *builtin_name(Builtin fn)
+{
+  size_t i;
+
+  for (i = 0; i < builtin_count; i++) {
+    if (builtin_names[i].fn == fn)
+      return builtin_names[i].name;
+  }
+  return NULL;
+}
+
+static Builtin builtin_named(const char *name, size_t len)
+{
+  size_t i;
+
+  for (i = 0; i < builtin_count; i++) {
+    if (strlen(builtin_names[i].name) == len
+        && memcmp(builtin_names[i].name, name, len) == 0)
+      return builtin_names[i].fn;
+  }
+  return NULL;
+}
+
+/* WRITING */
+
+struct Buffer {
+  char *data;
+  size_t length;
+  size_t capacity;
+};
+
+static void put_bytes(struct Buffer *b, const void *p, size_t len)
+{
+  size_t padded = (len + 7) & ~(size_t)7;
+
+  if (b->length + padded > b->capacity) {
+    while (b->length + padded > b->capacity)
+      b->capacity = b->capacity ? b->capacity * 2 : 4096;
+    b->data = realloc(b->data, b->capacity);
+    if (!b->data) {
+      fputs("Out of memory.\n", stderr);
+      abort();
+    }
+  }
+  memcpy(b->data + b->length, p, len);
+  memset(b->data + b->length + len, 0, padded - len);
+  b->length += padded;
+}
+
+static void put_u64(struct Buffer *b, uint64_t x)
+{
+  put_bytes(b, &x, sizeof(x));
+}
+
+/* Numbers given to the pointers met so far, by open addressing */
+struct Numbering {
+  uintptr_t *keys;
+  uint64_t *numbers;
+  size_t capacity;
+  size_t count;
+};
+
+static uint64_t *number_slot(struct Numbering *n, uintptr_t key)
+{
+  size_t i;
+
+  if ((n->count + 1) * 2 > n->capacity) {
+    struct Numbering grown;
+
+    grown.capacity = n->capacity ? n->capacity * 2 : 1024;
+    grown.count = 0;
+    grown.keys = calloc(grown.capacity, sizeof(uintptr_t));
+    grown.numbers = malloc(grown.capacity * sizeof(uint64_t));
+    for (i = 0; i < n->capacity; i++) {
+      if (n->keys[i])
+        *number_slot(&grown, n->keys[i]) = n->numbers[i];
+    }
+    free(n->keys);
+    free(n->numbers);
+    *n = grown;
+  }
+
+  i = (key >> 4) * 11400714819323198485ULL & (n->capacity - 1);
+  while (n->keys[i] && n->keys[i] != key)
+    i = (i + 1) & (n->capacity - 1);
+  if (!n->keys[i]) {
+    n->keys[i] = key;
+    n->numbers[i] = UINT64_MAX;
+    n->count++;
+  }
+  return &n->numbers[i];
+}
+
+static void numbering_free(struct Numbering *n)
+{
+  free(n->keys);
+  free(n->numbers);
+}
+
+struct Writer {
+  Atom root;
+  Error err;
+
+  struct Numbering object_numbers;
+  Atom *objects;
+  size_t object_count;
+  size_t object_capacity;
+
+  struct Numbering symbol_numbers;
+  struct Buffer symbols;
+  size_t symbol_count;
+
+  struct Numbering builtin_numbers;
+  struct Buffer builtins;
+  size_t builtin_count;
+};
+
+static uint64_t object_number(struct Writer *w, Atom a)
+{
+  uint64_t *number = number_slot(&w->object_numbers,
+      (uintptr_t)atom_pair(a));
+
+  if (*number != UINT64_MAX)
+    return *number;
+
+  /* A frame is allocated from its scope, so the scope comes first */
+  if (atom_type(a) == ATOM_FRAME) {
+    object_number(w, atom_pointer(ATOM_SCOPE, atom_frame(a)->scope));
+    number = number_slot(&w->object_numbers, (uintptr_t)atom_pair(a));
+  }
+
+  if (w->object_count == w->object_capacity) {
+    w->object_capacity = w->object_capacity ? w->object_capacity * 2 : 1024;
+    w->objects = realloc(w->objects, w->object_capacity * sizeof(Atom));
+  }
+  w->objects[w->object_count] = a;
+  *number = w->object_count;
+  return w->object_count++;
+}
+
+static uint64_t symbol_number(struct Writer *w, struct Symbol *sym)
+{
+  uint64_t *number = number_slot(&w->symbol_numbers, (uintptr_t)sym);
+
+  if (*number == UINT64_MAX) {
+    put_u64(&w->symbols, sym->length);
+    put_bytes(&w->symbols, sym->name, sym->length);
+    *number = w->symbol_count++;
+  }
+  return *number;
+}
+
+static uint64_t builtin_number(struct Writer *w, Builtin fn)
+{
+  uint64_t *number = number_slot(&w->builtin_numbers, (uintptr_t)fn);
+  const char *name;
+
+  if (*number == UINT64_MAX) {
+    name = builtin_name(fn);
+    if (!name) {
+      w->err = ERROR(Error_Type,
+          "Image can not hold an unregistered builtin.");
+      name = "";
+    }
+    put_u64(&w->builtins, strlen(name));
+    put_bytes(&w->builtins, name, strlen(name));
+    *number = w->builtin_count++;
+  }
+  return *number;
+}
+
+static void put_atom(struct Writer *w, struct Buffer *b, Atom a)
+{
+  uint64_t type = atom_type(a), payload = 0;
+
+  switch (atom_type(a)) {
+    case ATOM_NIL:
+    case ATOM_UNBOUND:
+      break;
+    case ATOM_INTEGER:
+      payload = (uint64_t)atom_integer(a);
+      break;
+    case ATOM_REAL: {
+      double x = atom_real(a);
+      memcpy(&payload, &x, sizeof(payload));
+      break;
+    }
+    case ATOM_SYMBOL:
+      payload = symbol_number(w, atom_symbol(a));
+      break;
+    case ATOM_BUILTIN:
+      payload = builtin_number(w, atom_builtin(a));
+      break;
+    case ATOM_PAIR:
+      if (atom_pair(a) == atom_pair(w->root)) {
+        type = IMAGE_ROOT;
+        break;
+      }
+      /* fall through */
+    case ATOM_CLOSURE:
+    case ATOM_MACRO:
+    case ATOM_LOCAL:
+    case ATOM_EXPANSION:
+      payload = object_number(w, atom_retype(a, ATOM_PAIR));
+      break;
+    case ATOM_STRING:
+    case ATOM_VECTOR:
+    case ATOM_HASHTABLE:
+    case ATOM_ARRAY:
+    case ATOM_SCOPE:
+    case ATOM_FRAME:
+      payload = object_number(w, a);
+      break;
+    default:
+      w->err = ERROR(Error_Type, "Image can not hold this value.");
+      type = ATOM_NIL;
+      break;
+  }
+  put_u64(b, type);
+  put_u64(b, payload);
+}
+
+/* Write the (key . value) entries of a table, from its current buckets
+ * and any old ones not moved yet, or with no buffer just count them */
+static size_t put_entries(struct Writer *w, struct Buffer *b,
+    struct HashTable *t)
+{
+  size_t i, n = 0;
+  Atom p, *buckets = t->buckets;
+  size_t from = 0, to = t->capacity;
+
+  for (;;) {
+    for (i = from; i < to; i++) {
+      for (p = buckets[i]; !nilp(p); p = cdr(p), n++) {
+        if (b) {
+          put_atom(w, b, car(car(p)));
+          put_atom(w, b, cdr(car(p)));
+        }
+      }
+    }
+    if (buckets != t->buckets || !t->old)
+      return n;
+    buckets = t->old;
+    from = t->migrated;
+    to = t->old_capacity;
+  }
+}
+
+static void put_object(struct Writer *w, struct Buffer *b, Atom a)
+{
+  size_t i;
+
+  switch (atom_type(a)) {
+    case ATOM_PAIR:
+      put_u64(b, OBJ_PAIR);
+      put_atom(w, b, car(a));
+      put_atom(w, b, cdr(a));
+      break;
+    case ATOM_STRING:
+      put_u64(b, OBJ_STRING);
+      put_u64(b, atom_string(a)->length);
+      put_bytes(b, string_bytes(a), atom_string(a)->length);
+      break;
+    case ATOM_VECTOR:
+      put_u64(b, OBJ_VECTOR);
+      put_u64(b, atom_vector(a)->length);
+      for (i = 0; i < atom_vector(a)->length; i++)
+        put_atom(w, b, atom_vector(a)->items[i]);
+      break;
+    case ATOM_HASHTABLE:
+      put_u64(b, OBJ_HASHTABLE);
+      put_u64(b, put_entries(w, NULL, atom_hashtable(a)));
+      put_entries(w, b, atom_hashtable(a));
+      break;
+    case ATOM_ARRAY:
+      put_u64(b, OBJ_ARRAY);
+      put_u64(b, atom_array(a)->kind);
+      put_u64(b, atom_array(a)->length);
+      put_bytes(b, atom_array(a)->data.f64,
+          atom_array(a)->length * sizeof(double));
+      break;
+    case ATOM_SCOPE: {
+      struct Scope *scope = atom_scope(a);
+
+      put_u64(b, OBJ_SCOPE);
+      put_u64(b, scope->count);
+      put_u64(b, scope->params);
+      put_u64(b, scope->rest);
+      for (i = 0; i < scope->count; i++)
+        put_u64(b, symbol_number(w, scope->names[i]));
+      break;
+    }
+    case ATOM_FRAME: {
+      struct Frame *frame = atom_frame(a);
+
+      put_u64(b, OBJ_FRAME);
+      put_u64(b, object_number(w, atom_pointer(ATOM_SCOPE, frame->scope)));
+      put_atom(w, b, frame->parent);
+      put_atom(w, b, frame->extra);
+      for (i = 0; i < frame->scope->count; i++)
+        put_atom(w, b, frame->slots[i]);
+      break;
+    }
+    default:
+      break;
+  }
+}
+
+/* Save the global bindings of env, and all they reach, to path */
+Error image_save(Atom env, const char *path)
+{
+  struct Writer w;
+  struct Buffer header = {NULL, 0, 0}, objects = {NULL, 0, 0},
+                globals = {NULL, 0, 0};
+  size_t i = 0, nglobals = 0;
+  Atom sym;
+  FILE *out;
+
+  memset(&w, 0, sizeof(w));
+  w.root = env;
+  w.err = ERROR_OK();
+
+  while (symbol_next(&i, &sym)) {
+    if (!atom_symbol(sym)->bound)
+      continue;
+    put_u64(&globals, symbol_number(&w, atom_symbol(sym)));
+    put_atom(&w, &globals, atom_symbol(sym)->value);
+    nglobals++;
+  }
+
+  /* Writing an object finds the ones it refers to */
+  for (i = 0; i < w.object_count; i++)
+    put_object(&w, &objects, w.objects[i]);
+
+  put_bytes(&header, IMAGE_MAGIC, 8);
+  put_u64(&header, IMAGE_VERSION);
+  put_u64(&header, w.symbol_count);
+  put_u64(&header, w.builtin_count);
+  put_u64(&header, w.object_count);
+  put_u64(&header, nglobals);
+
+  if (!ERROR_RAISED(w.err)) {
+    out = fopen(path, "wb");
+    if (!out
+        || fwrite(header.data, 1, header.length, out) != header.length
+        || fwrite(w.symbols.data, 1, w.symbols.length, out) != w.symbols.length
+        || fwrite(w.builtins.data, 1, w.builtins.length, out)
+          != w.builtins.length
+        || fwrite(objects.data, 1, objects.length, out) != objects.length
+        || fwrite(globals.data, 1, globals.length, out) != globals.length)
+      w.err = ERROR(Error_IO, "Could not write image.");
+    if (out && fclose(out) != 0)
+      w.err = ERROR(Error_IO, "Could not write image.");
+  }
+
+  numbering_free(&w.object_numbers);
+  numbering_free(&w.symbol_numbers);
+  numbering_free(&w.builtin_numbers);
+  free(w.objects);
+  free(w.symbols.data);
+  free(w.builtins.data);
+  free(header.data);
+  free(objects.data);
+  free(globals.data);
+  return w.err;
+}
+
+/* LOADING */
+
+struct Reader {
+  const char *data;
+  size_t size;
+  size_t pos;
+  int bad;
+
+  Atom env;
+  Atom *symbols;
+  size_t symbol_count;
+  Builtin *builtins;
+  size_t builtin_count;
+  Atom *objects;
+  size_t object_count;
+};
+
+static uint64_t get_u64(struct Reader *r)
+{
+  uint64_t x = 0;
+
+  if (r->size - r->pos < sizeof(x)) {
+    r->bad = 1;
+    return 0;
+  }
+  memcpy(&x, r->data + r->pos, sizeof(x));
+  r->pos += sizeof(x);
+  return x;
+}
+
+static const char *get_bytes(struct Reader *r, uint64_t len)
+{
+  const char *p = r->data + r->pos;
+  uint64_t padded = (len + 7) & ~(uint64_t)7;
+
+  if (len > r->size - r->pos || padded > r->size - r->pos) {
+    r->bad = 1;
+    return NULL;
+  }
+  r->pos += padded;
+  return p;
+}
+
+/* A count of items of at least size bytes each that the rest of the
+ * image could actually hold */
+static uint64_t get_count(struct Reader *r, size_t size)
+{
+  uint64_t n = get_u64(r);
+
+  if (n > (r->size - r->pos) / size) {
+    r->bad = 1;
+    return 0;
+  }
+  return n;
+}
+
+static void skip_atoms(struct Reader *r, uint64_t n)
+{
+  get_bytes(r, n * 16);
+}
+
+static Atom get_atom(struct Reader *r)
+{
+  uint64_t type = get_u64(r), payload = get_u64(r);
+  Atom a;
+  double x;
+
+  switch (type) {
+    case ATOM_NIL:
+      return nil;
+    case ATOM_UNBOUND:
+      return atom_pointer(ATOM_UNBOUND, NULL);
+    case ATOM_INTEGER:
+      return make_integer((long)(int64_t)payload);
+    case ATOM_REAL:
+      memcpy(&x, &payload, sizeof(x));
+      return make_real(x);
+    case ATOM_SYMBOL:
+      if (payload < r->symbol_count)
+        return r->symbols[payload];
+      break;
+    case ATOM_BUILTIN:
+      if (payload < r->builtin_count)
+        return make_builtin(r->builtins[payload]);
+      break;
+    case IMAGE_ROOT:
+      return r->env;
+    case ATOM_PAIR:
+    case ATOM_CLOSURE:
+    case ATOM_MACRO:
+    case ATOM_LOCAL:
+    case ATOM_EXPANSION:
+      if (payload < r->object_count) {
+        a = r->objects[payload];
+        if (atom_type(a) == ATOM_PAIR)
+          return atom_retype(a, (AtomType)type);
+      }
+      break;
+    case ATOM_STRING:
+    case ATOM_VECTOR:
+    case ATOM_HASHTABLE:
+    case ATOM_ARRAY:
+    case ATOM_SCOPE:
+    case ATOM_FRAME:
+      if (payload < r->object_count
+          && atom_type(r->objects[payload]) == (AtomType)type)
+        return r->objects[payload];
+      break;
+  }
+  r->bad = 1;
+  return nil;
+}
+
+/* Read the names in a symbol or builtin section */
+static const char *get_name(struct Reader *r, uint64_t *len)
+{
+  *len = get_u64(r);
+  return get_bytes(r, *len);
+}
+
+/* First pass: allocate object i from its record, filling in everything
+ * but its references to other objects */
+static void allocate_object(struct Reader *r, size_t i)
+{
+  uint64_t kind = get_u64(r), n, j;
+  struct Pair *pair;
+  struct Scope *scope;
+  const char *bytes;
+
+  switch (kind) {
+    case OBJ_PAIR:
+      pair = gc_alloc_pair();
+      pair->atom[0] = nil;
+      pair->atom[1] = nil;
+      r->objects[i] = atom_pointer(ATOM_PAIR, pair);
+      skip_atoms(r, 2);
+      return;
+    case OBJ_STRING:
+      n = get_u64(r);
+      bytes = get_bytes(r, n);
+      if (bytes)
+        r->objects[i] = make_string_n(bytes, n);
+      return;
+    case OBJ_VECTOR:
+      n = get_count(r, 16);
+      r->objects[i] = make_vector(n, nil);
+      skip_atoms(r, n);
+      return;
+    case OBJ_HASHTABLE:
+      n = get_count(r, 32);
+      r->objects[i] = make_hash_table();
+      skip_atoms(r, n * 2);
+      return;
+    case OBJ_ARRAY:
+      kind = get_u64(r);
+      n = get_count(r, sizeof(double));
+      bytes = get_bytes(r, n * sizeof(double));
+      if (!bytes || (kind != ARRAY_F64 && kind != ARRAY_I64))
+        break;
+      r->objects[i] = make_array(kind, n);
+      memcpy(atom_array(r->objects[i])->data.f64, bytes, n * sizeof(double));
+      return;
+    case OBJ_SCOPE:
+      n = get_count(r, 8);
+      scope = gc_alloc(GC_SCOPE, sizeof(struct Scope)
+          + n * sizeof(struct Symbol *));
+      scope->count = n;
+      scope->params = get_u64(r);
+      scope->rest = get_u64(r) != 0;
+      scope->names = (struct Symbol **)(scope + 1);
+      scope->code = NULL;
+      for (j = 0; j < n; j++) {
+        uint64_t name = get_u64(r);
+        if (name >= r->symbol_count) {
+          r->bad = 1;
+          return;
+        }
+        scope->names[j] = atom_symbol(r->symbols[name]);
+      }
+      if (scope->params > n)
+        break;
+      r->objects[i] = atom_pointer(ATOM_SCOPE, scope);
+      return;
+    case OBJ_FRAME:
+      n = get_u64(r);
+      if (n >= i || atom_type(r->objects[n]) != ATOM_SCOPE)
+        break;
+      r->objects[i] = make_frame(nil, atom_scope(r->objects[n]));
+      skip_atoms(r, 2 + atom_scope(r->objects[n])->count);
+      return;
+  }
+  r->bad = 1;
+}
+
+/* Second pass: fill in the references of object i */
+static void relocate_object(struct Reader *r, size_t i)
+{
+  uint64_t kind = get_u64(r), n, j;
+  Atom a = r->objects[i];
+
+  switch (kind) {
+    case OBJ_PAIR:
+      car(a) = get_atom(r);
+      cdr(a) = get_atom(r);
+      break;
+    case OBJ_STRING:
+      get_bytes(r, get_u64(r));
+      break;
+    case OBJ_VECTOR:
+      n = get_u64(r);
+      for (j = 0; j < n; j++)
+        atom_vector(a)->items[j] = get_atom(r);
+      break;
+    case OBJ_HASHTABLE:
+      skip_atoms(r, get_u64(r) * 2);
+      break;
+    case OBJ_ARRAY:
+      get_u64(r);
+      get_bytes(r, get_u64(r) * sizeof(double));
+      break;
+    case OBJ_SCOPE:
+      n = get_u64(r);
+      get_bytes(r, (n + 2) * 8);
+      break;
+    case OBJ_FRAME:
+      get_u64(r);
+      atom_frame(a)->parent = get_atom(r);
+      atom_frame(a)->extra = get_atom(r);
+      for (j = 0; j < atom_frame(a)->scope->count; j++)
+        atom_frame(a)->slots[j] = get_atom(r);
+      break;
+  }
+}
+
+/* Third pass: hash the entries of a table, now all keys are complete */
+static void fill_table(struct Reader *r, size_t i)
+{
+  uint64_t kind = get_u64(r), n, j;
+
+  if (kind != OBJ_HASHTABLE)
+    return;
+  n = get_u64(r);
+  for (j = 0; j < n && !r->bad; j++) {
+    Atom key = get_atom(r);
+    Atom value = get_atom(r);
+    hash_put(r->objects[i], key, value);
+  }
+}
+
+static Error read_image(struct Reader *r)
+{
+  uint64_t nsymbols, nbuiltins, nobjects, nglobals, i, len;
+  size_t *offsets;
+  const char *name;
+
+  name = get_bytes(r, 8);
+  if (!name || memcmp(name, IMAGE_MAGIC, 8) != 0
+      || get_u64(r) != IMAGE_VERSION)
+    return ERROR(Error_Syntax, "Not a cutie image.");
+
+  nsymbols = get_count(r, 8);
+  nbuiltins = get_count(r, 8);
+  nobjects = get_count(r, 8);
+  nglobals = get_count(r, 8);
+  if (r->bad)
+    return ERROR(Error_Syntax, "Corrupt image.");
+
+  r->symbols = malloc(nsymbols * sizeof(Atom) + 1);
+  r->builtins = malloc(nbuiltins * sizeof(Builtin) + 1);
+  r->objects = malloc(nobjects * sizeof(Atom) + 1);
+  offsets = malloc(nobjects * sizeof(size_t) + 1);
+  if (!r->symbols || !r->builtins || !r->objects || !offsets) {
+    free(offsets);
+    return ERROR(Error_IO, "Image too large.");
+  }
+
+  for (i = 0; i < nsymbols && !r->bad; i++) {
+    name = get_name(r, &len);
+    if (name)
+      r->symbols[r->symbol_count++] = make_symbol_n(name, len);
+  }
+
+  for (i = 0; i < nbuiltins && !r->bad; i++) {
+    name = get_name(r, &len);
+    if (name && !(r->builtins[r->builtin_count++] = builtin_named(name, len))) {
+      free(offsets);
+      return ERROR(Error_UnBound, "Image uses a builtin this build lacks.");
+    }
+  }
+
+  for (i = 0; i < nobjects && !r->bad; i++) {
+    r->objects[i] = nil;
+    offsets[i] = r->pos;
+    allocate_object(r, i);
+    r->object_count = i + 1;
+  }
+
+  if (!r->bad) {
+    size_t end = r->pos;
+
+    for (i = 0; i < nobjects && !r->bad; i++) {
+      r->pos = offsets[i];
+      relocate_object(r, i);
+    }
+    for (i = 0; i < nobjects && !r->bad; i++) {
+      r->pos = offsets[i];
+      fill_table(r, i);
+    }
+    r->pos = end;
+  }
+
+  /* Nothing is bound unless the whole image is good */
+  if (!r->bad) {
+    size_t start = r->pos;
+
+    for (i = 0; i < nglobals && !r->bad; i++) {
+      if (get_u64(r) >= r->symbol_count)
+        r->bad = 1;
+      get_atom(r);
+    }
+    r->pos = start;
+    for (i = 0; i < nglobals && !r->bad; i++) {
+      Atom symbol = r->symbols[get_u64(r)];
+      env_set(r->env, symbol, get_atom(r));
+    }
+  }
+
+  free(offsets);
+  return r->bad ? ERROR(Error_Syntax, "Corrupt image.") : ERROR_OK();
+}
+
+/* Bind the globals saved in the image at path in env, a root
+ * environment */
+Error image_load(Atom env, const char *path)
+{
+  struct Reader r;
+  struct stat st;
+  size_t threshold;
+  void *data;
+  Error err;
+  int fd;
+
+  fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return ERROR(Error_IO, "Could not open image.");
+  if (fstat(fd, &st) < 0 || st.st_size == 0) {
+    close(fd);
+    return ERROR(Error_Syntax, "Not a cutie image.");
+  }
+  data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED)
+    return ERROR(Error_IO, "Could not map image.");
+
+  memset(&r, 0, sizeof(r));
+  r.data = data;
+  r.size = st.st_size;
+  r.env = env;
+
+  threshold = cutie_gc_threshold(0);
+  cutie_gc_threshold(SIZE_MAX);
+  err = read_image(&r);
+  cutie_gc_threshold(threshold);
+
+  free(r.symbols);
+  free(r.builtins);
+  free(r.objects);
+  munmap(data, st.st_size);
+  return err;
+}
@@ -1,5 +1,10 @@
+#include <ctype.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "cutie.h"
 
@@ -28,31 +33,190 @@ char *slurp(const char *path)
   return buf;
 }
 
-int load_file(Atom env, const char *path)
+/* Evaluate each expression read from port in turn, stopping at the
+ * first error */
+int load_port(Atom env, struct Port *port)
 {
-  char *text;
-  int status = 0;
+  Atom expr;
+  Error err;
 
-//  printf("Reading %s...\n", path);
-  text = slurp(path);
-  if (text) {
-    const char *p = text;
-    Atom expr;
-    while (read_expr(p, &p, &expr).type == Error_OK) {
-      Atom result;
-      Error err = eval_expr(expr, env, &result);
-      if (ERROR_RAISED(err)) {
-        print_error(err);
-        putchar('\n');
-        printf("Error in expression:\n\t");
-        print_expr(expr);
-        putchar('\n');
-        status = 1;
-        break;
-      } 
+  while (!ERROR_RAISED(err = port_read(port, &expr))) {
+    Atom result;
+
+    expand_form(env, expr);
+    err = eval_expr(expr, env, &result);
+    if (ERROR_RAISED(err)) {
+      print_error(err);
+      putchar('\n');
+      printf("Error in expression:\n\t");
+      print_expr(expr);
+      putchar('\n');
+      return 1;
     }
-    free(text);
   }
+
+  /* The end of the input, or a syntax error, ends a load quietly; a
+   * failure to read the source does not */
+  if (err.type == Error_IO) {
+    print_error(err);
+    putchar('\n');
+    return 1;
+  }
+  return 0;
+}
+
+/* Regular files are mapped and parsed in place; anything else, such as
+ * a pipe, is read as a stream an expression at a time. See port.c. */
+int load_file(Atom env, const char *path)
+{
+  struct Port *port;
+  int status;
+
+//  printf("Reading %s...\n", path);
+  port = port_open_file(path);
+  if (!port)
+    return 0;
+  status = load_port(env, port);
+  port_close(port);
   return status;
 }
 
+
+/* MODULES
+ *
+ * REQUIRE loads a file once per process, not once per environment. Root
+ * bindings live in the symbols' value cells (see setup_env()), so the
+ * *MODULES* table that records what has been loaded is shared by every
+ * root environment, and a later setup_env() starts it afresh. Modules
+ * are always loaded at top level, whatever frame REQUIRE is called from,
+ * so their definitions outlive the call that loaded them.
+ *
+ * *MODULES* maps each loaded file, by its canonical path, to the mtime
+ * it had when it was loaded, so a later REQUIRE of the same file,
+ * however its path is spelled, is a single lookup; the file is only
+ * loaded again if it has changed. Features named by PROVIDE are kept in
+ * the same table, keyed by their symbol.
+ *
+ * Setting *LOAD-ONCE* makes LOAD go through the table as well, so that
+ * loading an unchanged file again does nothing. */
+
+static Error module_table(Atom env, Atom *table)
+{
+  Error err = env_get(env_root(env), make_symbol("*MODULES*"), table);
+
+  if (ERROR_RAISED(err) || atom_type(*table) != ATOM_HASHTABLE)
+    return ERROR(Error_Type, "*MODULES* must be a hash table.");
+  return ERROR_OK();
+}
+
+/* Load path into the root of env unless this version of it has been
+ * already. Sets *loaded to say which. */
+Error load_module(Atom env, const char *path, int *loaded)
+{
+  char canonical[PATH_MAX];
+  struct stat st;
+  Atom table, key, stamp, entry;
+  Error err;
+
+  *loaded = 0;
+  env = env_root(env);
+  err = module_table(env, &table);
+  if (ERROR_RAISED(err))
+    return err;
+  if (!realpath(path, canonical) || stat(canonical, &st) < 0)
+    return ERROR(Error_Args, "Module file not found.");
+
+  key = make_string(canonical);
+  stamp = cons(make_integer(st.st_mtim.tv_sec),
+      make_integer(st.st_mtim.tv_nsec));
+  entry = hash_get(table, key);
+  if (!nilp(entry) && atom_equal(cdr(entry), stamp))
+    return ERROR_OK();
+
+  /* Entered first, so that a module requiring itself stops here */
+  hash_put(table, key, stamp);
+  if (load_file(env, canonical) != 0) {
+    hash_remove(table, key);
+    return ERROR(Error_Args, "Module failed to load.");
+  }
+  *loaded = 1;
+  return ERROR_OK();
+}
+
+/* LOAD: the whole file every time, or with *LOAD-ONCE* set only when it
+ * is new or has changed */
+Error load_path(Atom env, const char *path)
+{
+  Atom once;
+  int loaded;
+
+  if (!ERROR_RAISED(env_get(env, make_symbol("*LOAD-ONCE*"), &once))
+      && !nilp(once) && access(path, R_OK) == 0)
+    return load_module(env, path, &loaded);
+  load_file(env, path);
+  return ERROR_OK();
+}
+
+/* (REQUIRE "file"), (REQUIRE 'feature) or (REQUIRE 'feature "file"). A
+ * feature already provided needs nothing; otherwise its file, by default
+ * its name in lower case with ".lsp" added, is loaded as a module. The
+ * result is T if a file was loaded and NIL if not. */
+Error require_module(Atom env, Atom module, Atom path, Atom *result)
+{
+  Atom table;
+  int loaded;
+  Error err;
+
+  *result = nil;
+  if (atom_type(module) == ATOM_STRING && nilp(path))
+    path = module;
+  else if (atom_type(module) == ATOM_SYMBOL) {
+    err = module_table(env, &table);
+    if (ERROR_RAISED(err))
+      return err;
+    if (!nilp(hash_get(table, module)))
+      return ERROR_OK();
+    if (nilp(path)) {
+      const char *name = atom_symbol(module)->name;
+      char *file = malloc(strlen(name) + sizeof(".lsp"));
+      size_t i;
+
+      if (!file)
+        return ERROR(Error_IO, "Out of memory for the module file name.");
+
+      for (i = 0; name[i]; i++)
+        file[i] = tolower((unsigned char)name[i]);
+      strcpy(file + i, ".lsp");
+      path = make_string(file);
+      free(file);
+    }
+  } else
+    return ERROR(Error_Type,
+        "REQUIRE needs a feature symbol or a file name.");
+
+  if (atom_type(path) != ATOM_STRING)
+    return ERROR(Error_Type, "REQUIRE file name must be a string.");
+
+  err = load_module(env, string_chars(path), &loaded);
+  if (ERROR_RAISED(err))
+    return err;
+  if (loaded)
+    *result = make_symbol("T");
+  return ERROR_OK();
+}
+
+/* (PROVIDE 'feature) records that feature is loaded */
+Error provide_feature(Atom env, Atom feature, Atom *result)
+{
+  Atom table;
+  Error err;
+
+  if (atom_type(feature) != ATOM_SYMBOL)
+    return ERROR(Error_Type, "PROVIDE argument must be a symbol.");
+  err = module_table(env, &table);
+  if (ERROR_RAISED(err))
+    return err;
+  hash_put(table, feature, make_symbol("T"));
+  *result = feature;
+  return ERROR_OK();
+}
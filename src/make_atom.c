@@ -1,3 +1,4 @@
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -28,14 +29,41 @@ Error make_error(
 }
 
 Atom cons(Atom car_val, Atom cdr_val) {
-  Atom p;
-  p.type = ATOM_PAIR;
-  p.value.pair = (struct Pair*)cutie_malloc(sizeof(struct Pair));
+  Atom p = atom_pointer(ATOM_PAIR, gc_alloc_pair());
   car(p) = car_val;
   cdr(p) = cdr_val;
   return p;
 }
 
+/* A fresh proper list of n nils whose cells lie next to each other in
+ * memory as far as the allocator can manage. Callers fill in the cars. */
+Atom make_list(size_t n)
+{
+  Atom head = nil, tail = nil;
+
+  while (n > 0) {
+    size_t got, i;
+    struct Pair *cells = gc_alloc_pairs(n, &got);
+
+    for (i = 0; i < got; i++) {
+      cells[i].atom[0] = nil;
+      cells[i].atom[1] = i + 1 < got
+        ? atom_pointer(ATOM_PAIR, &cells[i + 1]) : nil;
+    }
+
+    if (nilp(head))
+      head = atom_pointer(ATOM_PAIR, cells);
+    else
+      cdr(tail) = atom_pointer(ATOM_PAIR, cells);
+    tail = atom_pointer(ATOM_PAIR, &cells[got - 1]);
+    n -= got;
+  }
+
+  return head;
+}
+
+#ifndef CUTIE_NAN_BOXING
+
 Atom make_integer(long x) {
   Atom p;
   p.type = ATOM_INTEGER;
@@ -50,39 +78,217 @@ Atom make_real(double x) {
   return p;
 }
 
-Atom make_string(const char *s) {
+Atom make_builtin(Builtin fn)
+{
   Atom a;
-  a.type = ATOM_STRING;
-  a.value.string = strdup(s);
+  a.type = ATOM_BUILTIN;
+  a.value.builtin = fn;
   return a;
 }
- 
-Atom sym_table = {ATOM_NIL, {0}};
+
+#else
+
+#define FIXNUM_MAX (((long)1 << 46) - 1)
+#define FIXNUM_MIN (-((long)1 << 46))
+
+Atom make_integer(long x) {
+  if (x < FIXNUM_MIN || x > FIXNUM_MAX)
+    return make_real((double)x);
+  return atom_box(ATOM_INTEGER, (uint64_t)x);
+}
+
+Atom make_real(double x) {
+  union { double real; uint64_t bits; } u;
+  Atom p;
+
+  /* Any NaN is stored as the one that no other type uses. This looks at
+   * the bits, since -ffinite-math-only lets x != x be folded away. */
+  u.real = x;
+  if ((u.bits & 0x7ff0000000000000ULL) == 0x7ff0000000000000ULL
+      && (u.bits & 0x000fffffffffffffULL))
+    p.bits = NANBOX_QNAN;
+  else
+    p.bits = u.bits;
+  return p;
+}
+
+Atom make_builtin(Builtin fn)
+{
+  return atom_box(ATOM_BUILTIN, (uintptr_t)fn);
+}
+
+#endif
+
+/* A vector of n items, each set to fill */
+Atom make_vector(size_t n, Atom fill)
+{
+  Atom v = atom_pointer(ATOM_VECTOR, gc_alloc(GC_VECTOR,
+      sizeof(struct Vector) + n * sizeof(Atom)));
+  size_t i;
+
+  atom_vector(v)->length = n;
+  atom_vector(v)->items = (Atom*)(atom_vector(v) + 1);
+  for (i = 0; i < n; i++)
+    atom_vector(v)->items[i] = fill;
+  return v;
+}
+
+/* A vector of the items of a proper list */
+Atom list_to_vector(Atom list)
+{
+  Atom v, p;
+  size_t n = 0;
+
+  for (p = list; !nilp(p); p = cdr(p))
+    n++;
+
+  v = make_vector(n, nil);
+  for (n = 0; !nilp(list); list = cdr(list))
+    atom_vector(v)->items[n++] = car(list);
+  return v;
+}
+
+/* SYMBOL TABLE
+ *
+ * Symbols are interned in an open-addressing hash table with linear
+ * probing. Each symbol keeps its hash and length, so a probe only falls
+ * back to memcmp when both already match. The table doubles once it is
+ * more than 70% full. */
+
+static struct Symbol **sym_table = NULL;
+static size_t sym_capacity = 0;
+static size_t sym_count = 0;
+static unsigned long sym_lookups = 0;
+static unsigned long sym_probes = 0;
+
+/* Reader input is folded to upper case as it is interned */
+static unsigned char upcase(unsigned char c)
+{
+  return c >= 'a' && c <= 'z' ? c - ('a' - 'A') : c;
+}
+
+static unsigned long hash_symbol(const char *s, size_t len, int fold)
+{
+  unsigned long h = 14695981039346656037UL;
+  size_t i;
+
+  for (i = 0; i < len; i++) {
+    h ^= fold ? upcase(s[i]) : (unsigned char)s[i];
+    h *= 1099511628211UL;
+  }
+  return h;
+}
+
+static int symbol_matches(const struct Symbol *sym, const char *s, size_t len,
+    int fold)
+{
+  size_t i;
+
+  if (!fold)
+    return memcmp(sym->name, s, len) == 0;
+  for (i = 0; i < len; i++) {
+    if ((unsigned char)sym->name[i] != upcase(s[i]))
+      return 0;
+  }
+  return 1;
+}
+
+static void grow_sym_table()
+{
+  size_t capacity = sym_capacity ? sym_capacity * 2 : 1024;
+  struct Symbol **table = calloc(capacity, sizeof(*table));
+  size_t i;
+
+  for (i = 0; i < sym_capacity; i++) {
+    struct Symbol *sym = sym_table[i];
+    size_t j;
+
+    if (!sym)
+      continue;
+    j = sym->hash & (capacity - 1);
+    while (table[j])
+      j = (j + 1) & (capacity - 1);
+    table[j] = sym;
+  }
+
+  free(sym_table);
+  sym_table = table;
+  sym_capacity = capacity;
+}
+
+static Atom intern(const char *s, size_t len, int fold)
+{
+  unsigned long hash = hash_symbol(s, len, fold);
+  struct Symbol *sym;
+  size_t i, j;
+
+  if ((sym_count + 1) * 10 > sym_capacity * 7)
+    grow_sym_table();
+
+  sym_lookups++;
+  i = hash & (sym_capacity - 1);
+  while ((sym = sym_table[i]) != NULL) {
+    sym_probes++;
+    if (sym->hash == hash && sym->length == len
+        && symbol_matches(sym, s, len, fold))
+      break;
+    i = (i + 1) & (sym_capacity - 1);
+  }
+
+  if (!sym) {
+    sym = malloc(sizeof(struct Symbol) + len + 1);
+    sym->hash = hash;
+    sym->length = len;
+    sym->special = SPECIAL_NONE;
+    sym->bound = 0;
+    sym->value = nil;
+    sym->name = (char*)(sym + 1);
+    for (j = 0; j < len; j++)
+      sym->name[j] = fold ? upcase(s[j]) : s[j];
+    sym->name[len] = '\0';
+    sym_table[i] = sym;
+    sym_count++;
+  }
+
+  return atom_pointer(ATOM_SYMBOL, sym);
+}
+
+Atom make_symbol_n(const char *s, size_t len)
+{
+  return intern(s, len, 0);
+}
+
+/* The symbol named by s folded to upper case, as the reader spells it */
+Atom make_symbol_upcase(const char *s, size_t len)
+{
+  return intern(s, len, 1);
+}
 
 Atom make_symbol(const char *s) {
-  Atom a, p;
+  return make_symbol_n(s, strlen(s));
+}
 
-  p = sym_table;
-  while(!nilp(p)) {
-    a = car(p);
-    if (strcmp(a.value.symbol, s) == 0) {
-      return a;
+/* Iterate over every interned symbol, starting with *index = 0. */
+int symbol_next(size_t *index, Atom *symbol)
+{
+  while (*index < sym_capacity) {
+    struct Symbol *sym = sym_table[(*index)++];
+    if (sym) {
+      *symbol = atom_pointer(ATOM_SYMBOL, sym);
+      return 1;
     }
-    p = cdr(p);
   }
-
-  a.type = ATOM_SYMBOL;
-  a.value.symbol = strdup(s);
-  sym_table = cons(a, sym_table);
-  return a;
+  return 0;
 }
 
-Atom make_builtin(Builtin fn)
+void cutie_symbols()
 {
-  Atom a;
-  a.type = ATOM_BUILTIN;
-  a.value.builtin = fn;
-  return a;
+  printf("(symbols %zu)\n", sym_count);
+  printf("(symbol-capacity %zu)\n", sym_capacity);
+  printf("(symbol-load %.3f)\n",
+      sym_capacity ? (double)sym_count / sym_capacity : 0.0);
+  printf("(symbol-probes-per-lookup %.3f)\n",
+      sym_lookups ? (double)sym_probes / sym_lookups : 0.0);
 }
 
 Error make_closure(Atom env, Atom args, Atom body, Atom *result)
@@ -95,15 +301,19 @@ Error make_closure(Atom env, Atom args, Atom body, Atom *result)
   /* Check argument names are all symbols */
   p = args;
   while (!nilp(p)) {
-    if (p.type == ATOM_SYMBOL) {
+    if (atom_type(p) == ATOM_SYMBOL) {
       break;
-    } else if (p.type != ATOM_PAIR || car(p).type != ATOM_SYMBOL) {
+    } else if (atom_type(p) != ATOM_PAIR || atom_type(car(p)) != ATOM_SYMBOL) {
       return ERROR(Error_Type, "Arguments need to be symbols");
     }
     p = cdr(p);
   }
 
-  *result = cons(env, cons(args, body));
-  result->type = ATOM_CLOSURE;
+  /* Expand and resolve a body the first time it is made */
+  if (nilp(body) || atom_type(car(body)) != ATOM_SCOPE)
+    expand_body(env, args, body);
+  body = resolve_body(env, args, body);
+
+  *result = atom_retype(cons(env, cons(args, body)), ATOM_CLOSURE);
   return ERROR_OK();
 }
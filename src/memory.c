@@ -1,9 +1,19 @@
+#define _GNU_SOURCE
 #include <ctype.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "cutie.h"
 
+/* Build with -DCUTIE_PAIR_POOL=0 to allocate every pair with malloc */
+#ifndef CUTIE_PAIR_POOL
+#define CUTIE_PAIR_POOL 1
+#endif
+
 static long int allocations = 0;
 
 void* cutie_malloc(unsigned int sz) {
@@ -19,7 +29,678 @@ void cutie_free(void *p) {
 //  printf("Freed memory at %li. (%li)\n", (long)p, allocations);
 }
 
+/* GARBAGE COLLECTOR
+ *
+ * Every heap object handed out by gc_alloc() carries a small header and
+ * sits on a single linked list. A collection marks everything reachable
+ * from the global value cells of the symbols, the protected roots and the
+ * C stack, then sweeps
+ * the list and frees whatever was not marked.
+ *
+ * The C stack is scanned conservatively: any word that points into an
+ * object keeps it alive. This is what lets eval_expr, apply and the
+ * builtins keep Atoms in plain local variables. */
+
+struct Allocation {
+  struct Allocation *next;
+  size_t size;
+  unsigned char kind;
+  unsigned char mark;
+};
+
+#define HEADER_SIZE ((sizeof(struct Allocation) + 15) & ~(size_t)15)
+#define PAYLOAD(a) ((void *)((char *)(a) + HEADER_SIZE))
+#define HEADER(p) ((struct Allocation *)((char *)(p) - HEADER_SIZE))
+
+static struct Allocation *heap = NULL;
+static Atom gc_roots = NIL_INITIALIZER;
+
+static size_t heap_live = 0;
+static size_t heap_reclaimed = 0;
+static size_t heap_since_gc = 0;
+static size_t gc_threshold = 4 * 1024 * 1024;
+static size_t gc_trigger = 4 * 1024 * 1024;
+static long int gc_runs = 0;
+
+static void *stack_bottom = NULL;
+static uintptr_t heap_lo = UINTPTR_MAX;
+static uintptr_t heap_hi = 0;
+
+void *gc_alloc(int kind, size_t sz)
+{
+  struct Allocation *a;
+
+  if (heap_since_gc + sz > gc_trigger)
+    cutie_gc();
+
+  a = cutie_malloc(HEADER_SIZE + sz);
+  if (!a) {
+    cutie_gc();
+    a = cutie_malloc(HEADER_SIZE + sz);
+    if (!a) {
+      fputs("Out of memory.\n", stderr);
+      abort();
+    }
+  }
+
+  a->next = heap;
+  a->size = sz;
+  a->kind = kind;
+  a->mark = 0;
+  heap = a;
+
+  if ((uintptr_t)PAYLOAD(a) < heap_lo)
+    heap_lo = (uintptr_t)PAYLOAD(a);
+  if ((uintptr_t)PAYLOAD(a) + sz > heap_hi)
+    heap_hi = (uintptr_t)PAYLOAD(a) + sz;
+
+  heap_live += sz;
+  heap_since_gc += sz;
+  return PAYLOAD(a);
+}
+
+#if CUTIE_PAIR_POOL
+/* PAIR POOL
+ *
+ * Pairs are carved out of large, aligned chunks instead of being
+ * malloc'd one at a time. A fresh chunk is handed out by bumping an index;
+ * cells freed by the collector go on a free list that is rebuilt in
+ * address order on every sweep, so a list consed up in one go ends up in
+ * neighbouring cells. Mark and allocation bits live in bitmaps at the
+ * front of each chunk, which keeps every cell exactly one struct Pair.
+ *
+ * gc_alloc_pairs() hands out runs of adjacent cells, from the head of the
+ * free list when it is contiguous for long enough and from the bump chunk
+ * otherwise, so the spine of a list whose length is known up front lies
+ * in one stretch of memory. */
+
+#define CHUNK_SIZE ((size_t)1 << 18)
+#define CHUNK_CELLS ((CHUNK_SIZE - 4096) / sizeof(struct Pair))
+#define BITMAP_WORDS ((CHUNK_CELLS + 63) / 64)
+
+struct PairChunk {
+  size_t used;
+  uint64_t marks[BITMAP_WORDS];
+  uint64_t allocated[BITMAP_WORDS];
+  struct Pair cells[CHUNK_CELLS];
+};
+
+#define CHUNK_OF(p) \
+  ((struct PairChunk *)((uintptr_t)(p) & ~(uintptr_t)(CHUNK_SIZE - 1)))
+#define CELL_INDEX(c, p) ((size_t)((struct Pair *)(p) - (c)->cells))
+#define BIT_TEST(map, i) ((map)[(i) / 64] & ((uint64_t)1 << ((i) % 64)))
+#define BIT_SET(map, i) ((map)[(i) / 64] |= ((uint64_t)1 << ((i) % 64)))
+
+static struct PairChunk **chunks = NULL;
+static size_t chunk_count = 0;
+static size_t chunk_capacity = 0;
+static struct PairChunk *bump_chunk = NULL;
+static struct Pair *free_cells = NULL;
+
+static struct PairChunk *new_chunk(void)
+{
+  struct PairChunk *c;
+  void *mem;
+  size_t i;
+
+  if (chunk_count == chunk_capacity) {
+    size_t cap = chunk_capacity ? chunk_capacity * 2 : 16;
+    struct PairChunk **grown = realloc(chunks, cap * sizeof(*chunks));
+    if (!grown)
+      return NULL;
+    chunks = grown;
+    chunk_capacity = cap;
+  }
+
+  if (posix_memalign(&mem, CHUNK_SIZE, sizeof(struct PairChunk)) != 0)
+    return NULL;
+  allocations++;
+
+  c = mem;
+  c->used = 0;
+  memset(c->marks, 0, sizeof(c->marks));
+  memset(c->allocated, 0, sizeof(c->allocated));
+
+  /* Keep the chunk table sorted so the stack scan can binary search it */
+  i = chunk_count++;
+  while (i > 0 && chunks[i - 1] > c) {
+    chunks[i] = chunks[i - 1];
+    i--;
+  }
+  chunks[i] = c;
+
+  if ((uintptr_t)c->cells < heap_lo)
+    heap_lo = (uintptr_t)c->cells;
+  if ((uintptr_t)(c->cells + CHUNK_CELLS) > heap_hi)
+    heap_hi = (uintptr_t)(c->cells + CHUNK_CELLS);
+
+  return c;
+}
+
+struct Pair *gc_alloc_pair(void)
+{
+  struct PairChunk *c;
+  struct Pair *p;
+
+  if (heap_since_gc + sizeof(struct Pair) > gc_trigger)
+    cutie_gc();
+
+  if (free_cells) {
+    p = free_cells;
+    free_cells = atom_pair(p->atom[1]);
+  } else {
+    if (!bump_chunk || bump_chunk->used == CHUNK_CELLS) {
+      bump_chunk = new_chunk();
+      if (!bump_chunk) {
+        fputs("Out of memory.\n", stderr);
+        abort();
+      }
+    }
+    p = &bump_chunk->cells[bump_chunk->used++];
+  }
+
+  c = CHUNK_OF(p);
+  BIT_SET(c->allocated, CELL_INDEX(c, p));
+
+  heap_live += sizeof(struct Pair);
+  heap_since_gc += sizeof(struct Pair);
+  return p;
+}
+
+/* Up to n adjacent cells, at least one; the count is left in *got */
+struct Pair *gc_alloc_pairs(size_t n, size_t *got)
+{
+  struct PairChunk *c;
+  struct Pair *p, *q;
+  size_t i, run = 0;
+
+  if (heap_since_gc + n * sizeof(struct Pair) > gc_trigger)
+    cutie_gc();
+
+  for (q = free_cells; q && run < n; q = atom_pair(q->atom[1])) {
+    if (q != free_cells + run)
+      break;
+    run++;
+  }
+
+  if (run == n) {
+    p = free_cells;
+    free_cells = q;
+  } else {
+    /* Leave the rest of a bump chunk too short for the run to the
+     * next sweep, which puts it on the free list */
+    if (bump_chunk && CHUNK_CELLS - bump_chunk->used < n
+        && bump_chunk->used > 0)
+      bump_chunk->used = CHUNK_CELLS;
+    if (!bump_chunk || bump_chunk->used == CHUNK_CELLS) {
+      bump_chunk = new_chunk();
+      if (!bump_chunk) {
+        fputs("Out of memory.\n", stderr);
+        abort();
+      }
+    }
+    run = CHUNK_CELLS - bump_chunk->used;
+    if (run > n)
+      run = n;
+    p = &bump_chunk->cells[bump_chunk->used];
+    bump_chunk->used += run;
+  }
+
+  c = CHUNK_OF(p);
+  for (i = 0; i < run; i++)
+    BIT_SET(c->allocated, CELL_INDEX(c, p) + i);
+
+  heap_live += run * sizeof(struct Pair);
+  heap_since_gc += run * sizeof(struct Pair);
+  *got = run;
+  return p;
+}
+
+static int mark_pair(struct Pair *p)
+{
+  struct PairChunk *c = CHUNK_OF(p);
+  size_t i = CELL_INDEX(c, p);
+
+  if (BIT_TEST(c->marks, i))
+    return 1;
+  BIT_SET(c->marks, i);
+  return 0;
+}
+
+static struct PairChunk *find_chunk(uintptr_t p)
+{
+  struct PairChunk *c = CHUNK_OF(p);
+  size_t lo = 0, hi = chunk_count;
+
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (chunks[mid] == c)
+      return c;
+    if (chunks[mid] < c)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return NULL;
+}
+
+static void pool_mark_word(uintptr_t p)
+{
+  struct PairChunk *c = find_chunk(p);
+  size_t i;
+
+  if (!c || p < (uintptr_t)c->cells)
+    return;
+
+  i = (p - (uintptr_t)c->cells) / sizeof(struct Pair);
+  if (i >= c->used || !BIT_TEST(c->allocated, i))
+    return;
+
+  gc_mark(atom_pointer(ATOM_PAIR, &c->cells[i]));
+}
+
+static size_t pool_sweep(void)
+{
+  struct Pair *last = NULL;
+  size_t freed = 0, free_count = 0, kept = 0;
+  size_t i, w;
+
+  for (i = 0; i < chunk_count; i++) {
+    struct PairChunk *c = chunks[i];
+    size_t live = 0;
+
+    for (w = 0; w < BITMAP_WORDS; w++) {
+      freed += __builtin_popcountll(c->allocated[w] & ~c->marks[w]);
+      live += __builtin_popcountll(c->marks[w]);
+      c->allocated[w] = c->marks[w];
+      c->marks[w] = 0;
+    }
+
+    /* Hand empty chunks back once there is a chunk's worth of free
+     * cells elsewhere. */
+    if (live == 0 && c != bump_chunk && free_count >= CHUNK_CELLS) {
+      free(c);
+      allocations--;
+      continue;
+    }
+    chunks[kept++] = c;
+
+    for (w = 0; w * 64 < c->used; w++) {
+      uint64_t bits = ~c->allocated[w];
+      while (bits) {
+        size_t j = w * 64 + __builtin_ctzll(bits);
+        struct Pair *cell;
+        if (j >= c->used)
+          break;
+        cell = &c->cells[j];
+        cell->atom[0] = nil;
+        cell->atom[1] = nil;
+        if (last)
+          last->atom[1] = atom_pointer(ATOM_PAIR, cell);
+        else
+          free_cells = cell;
+        last = cell;
+        free_count++;
+        bits &= bits - 1;
+      }
+    }
+  }
+  if (!last)
+    free_cells = NULL;
+  chunk_count = kept;
+
+  return freed * sizeof(struct Pair);
+}
+
+#else
+
+struct Pair *gc_alloc_pair(void)
+{
+  return gc_alloc(GC_PAIR, sizeof(struct Pair));
+}
+
+struct Pair *gc_alloc_pairs(size_t n, size_t *got)
+{
+  (void)n;
+  *got = 1;
+  return gc_alloc_pair();
+}
+
+static int mark_pair(struct Pair *p)
+{
+  struct Allocation *a = HEADER(p);
+
+  if (a->mark)
+    return 1;
+  a->mark = 1;
+  return 0;
+}
+
+#endif
+
+static void mark_scope(struct Scope *scope)
+{
+  HEADER(scope)->mark = 1;
+  if (scope->code)
+    gc_mark_code(scope->code);
+}
+
+void gc_mark_code(struct Code *code)
+{
+  size_t i;
+
+  if (HEADER(code)->mark)
+    return;
+  HEADER(code)->mark = 1;
+  for (i = 0; i < code->nconstants; i++)
+    gc_mark(code->constants[i]);
+  for (i = 0; i < code->nsites; i++) {
+    if (code->sites[i])
+      gc_mark_code(code->sites[i]);
+  }
+  if (code->spare)
+    gc_mark(atom_pointer(ATOM_FRAME, code->spare));
+}
+
+void gc_mark(Atom root)
+{
+  for (;;) {
+    switch (atom_type(root)) {
+      case ATOM_PAIR:
+      case ATOM_CLOSURE:
+      case ATOM_MACRO:
+      case ATOM_LOCAL:
+      case ATOM_EXPANSION:
+        if (mark_pair(atom_pair(root)))
+          return;
+        gc_mark(car(root));
+        root = cdr(root);
+        break;
+      case ATOM_STRING: {
+        struct String *s = atom_string(root);
+
+        if (HEADER(s)->mark)
+          return;
+        HEADER(s)->mark = 1;
+        if (nilp(s->left)) {
+          root = s->base;
+          break;
+        }
+        /* Recurse into the shorter half of a rope, as string.c does */
+        if (atom_string(s->left)->length <= atom_string(s->right)->length) {
+          gc_mark(s->left);
+          root = s->right;
+        } else {
+          gc_mark(s->right);
+          root = s->left;
+        }
+        break;
+      }
+      case ATOM_ARRAY:
+        HEADER(atom_array(root))->mark = 1;
+        return;
+      case ATOM_SCOPE:
+        mark_scope(atom_scope(root));
+        return;
+      case ATOM_FRAME: {
+        struct Frame *frame = atom_frame(root);
+        size_t i;
+
+        if (HEADER(frame)->mark)
+          return;
+        HEADER(frame)->mark = 1;
+        mark_scope(frame->scope);
+        gc_mark(frame->extra);
+        for (i = 0; i < frame->scope->count; i++)
+          gc_mark(frame->slots[i]);
+        root = frame->parent;
+        break;
+      }
+      case ATOM_HASHTABLE: {
+        struct HashTable *table = atom_hashtable(root);
+        size_t i;
+
+        /* The bucket arrays may already be marked from the stack, so
+         * only the table's own bit says whether this was done */
+        if (HEADER(table)->mark)
+          return;
+        HEADER(table)->mark = 1;
+        if (table->buckets) {
+          HEADER(table->buckets)->mark = 1;
+          for (i = 0; i < table->capacity; i++)
+            gc_mark(table->buckets[i]);
+        }
+        if (table->old) {
+          HEADER(table->old)->mark = 1;
+          for (i = 0; i < table->old_capacity; i++)
+            gc_mark(table->old[i]);
+        }
+        return;
+      }
+      case ATOM_VECTOR: {
+        struct Vector *vector = atom_vector(root);
+        size_t i;
+
+        if (HEADER(vector)->mark)
+          return;
+        HEADER(vector)->mark = 1;
+        if (vector->length == 0)
+          return;
+        for (i = 0; i + 1 < vector->length; i++)
+          gc_mark(vector->items[i]);
+        root = vector->items[i];
+        break;
+      }
+      default:
+        return;
+    }
+  }
+}
+
+static void gc_mark_allocation(struct Allocation *a)
+{
+  if (a->mark)
+    return;
+
+  switch (a->kind) {
+    case GC_PAIR:
+      gc_mark(atom_pointer(ATOM_PAIR, PAYLOAD(a)));
+      break;
+    case GC_FRAME:
+      gc_mark(atom_pointer(ATOM_FRAME, PAYLOAD(a)));
+      break;
+    case GC_SCOPE:
+      mark_scope(PAYLOAD(a));
+      break;
+    case GC_CODE:
+      gc_mark_code(PAYLOAD(a));
+      break;
+    case GC_STRING:
+      gc_mark(atom_pointer(ATOM_STRING, PAYLOAD(a)));
+      break;
+    case GC_VECTOR:
+      gc_mark(atom_pointer(ATOM_VECTOR, PAYLOAD(a)));
+      break;
+    case GC_HASHTABLE:
+      gc_mark(atom_pointer(ATOM_HASHTABLE, PAYLOAD(a)));
+      break;
+    default:
+      a->mark = 1;
+      break;
+  }
+}
+
+static void *find_stack_bottom(void)
+{
+  void *addr = NULL;
+#if defined(__APPLE__)
+  addr = pthread_get_stackaddr_np(pthread_self());
+#else
+  pthread_attr_t attr;
+  size_t size;
+
+  if (pthread_getattr_np(pthread_self(), &attr) == 0) {
+    if (pthread_attr_getstack(&attr, &addr, &size) == 0)
+      addr = (char *)addr + size;
+    pthread_attr_destroy(&attr);
+  }
+#endif
+  return addr;
+}
+
+static int compare_words(const void *a, const void *b)
+{
+  uintptr_t x = *(const uintptr_t *)a;
+  uintptr_t y = *(const uintptr_t *)b;
+  return (x > y) - (x < y);
+}
+
+/* Returns non-zero if any of the sorted candidate words falls inside
+ * [start, start + size). */
+static int range_referenced(
+    const uintptr_t *words, size_t n, uintptr_t start, size_t size)
+{
+  size_t lo = 0, hi = n;
+
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (words[mid] < start)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo < n && words[lo] < start + size;
+}
+
+static void gc_scan_range(void *from, void *to)
+{
+  struct Allocation *a;
+  uintptr_t *words, *p;
+  size_t n = 0;
+
+  p = (uintptr_t *)((uintptr_t)from & ~(uintptr_t)(sizeof(uintptr_t) - 1));
+  words = malloc(((uintptr_t *)to - p + 1) * sizeof(*words));
+  if (!words)
+    return;
+
+  /* Only words that could point into the heap are worth looking at;
+   * sorting them is much cheaper than sorting the heap itself. */
+  for (; (void *)p < to; p++) {
+    uintptr_t word = *p;
+#ifdef CUTIE_NAN_BOXING
+    /* Atoms on the stack hold their pointers in a NaN's payload */
+    if ((word & NANBOX_QNAN) == NANBOX_QNAN)
+      word &= NANBOX_PAYLOAD;
+#endif
+    if (word >= heap_lo && word < heap_hi)
+      words[n++] = word;
+  }
+  qsort(words, n, sizeof(*words), compare_words);
+
+#if CUTIE_PAIR_POOL
+  for (size_t i = 0; i < n; i++)
+    pool_mark_word(words[i]);
+#endif
+
+  for (a = heap; a && n > 0; a = a->next) {
+    if (!a->mark && range_referenced(words, n, (uintptr_t)PAYLOAD(a), a->size))
+      gc_mark_allocation(a);
+  }
+
+  free(words);
+}
+
+static void __attribute__((noinline)) gc_mark_stack(void)
+{
+  jmp_buf regs;
+
+  /* Spill callee-saved registers so that Atoms living only in
+   * registers are visible to the scan below. */
+#if defined(__GNUC__)
+  __builtin_unwind_init();
+#endif
+  setjmp(regs);
+
+  if (!stack_bottom)
+    stack_bottom = find_stack_bottom();
+  if (stack_bottom)
+    gc_scan_range(&regs, stack_bottom);
+}
+
+static size_t gc_sweep(void)
+{
+  struct Allocation **p = &heap;
+  size_t freed = 0;
+
+  while (*p) {
+    struct Allocation *a = *p;
+    if (a->mark) {
+      a->mark = 0;
+      p = &a->next;
+    } else {
+      *p = a->next;
+      freed += a->size;
+      cutie_free(a);
+    }
+  }
+  return freed;
+}
+
+static void gc_mark_globals(void)
+{
+  size_t i = 0;
+  Atom sym;
+
+  while (symbol_next(&i, &sym)) {
+    if (atom_symbol(sym)->bound)
+      gc_mark(atom_symbol(sym)->value);
+  }
+}
+
+size_t cutie_gc(void)
+{
+  size_t freed;
+
+  gc_mark_globals();
+  gc_mark(gc_roots);
+  vm_mark();
+  gc_mark_stack();
+
+  freed = gc_sweep();
+#if CUTIE_PAIR_POOL
+  freed += pool_sweep();
+#endif
+
+  heap_live -= freed;
+  heap_reclaimed += freed;
+  heap_since_gc = 0;
+  gc_runs++;
+
+  /* Let the heap grow in proportion to what survived, so a large live
+   * set is not re-marked after every few megabytes of garbage */
+  gc_trigger = heap_live > gc_threshold ? heap_live : gc_threshold;
+  return freed;
+}
+
+void cutie_gc_protect(Atom root)
+{
+  gc_roots = cons(root, gc_roots);
+}
+
+size_t cutie_gc_threshold(size_t bytes)
+{
+  if (bytes > 0)
+    gc_threshold = gc_trigger = bytes;
+  return gc_threshold;
+}
+
 void cutie_mem() {
   printf("(allocations %li)\n", allocations);
-  
+  printf("(live-bytes %zu)\n", heap_live);
+  printf("(reclaimed-bytes %zu)\n", heap_reclaimed);
+  printf("(gc-threshold %zu)\n", gc_threshold);
+  printf("(gc-runs %li)\n", gc_runs);
+#if CUTIE_PAIR_POOL
+  printf("(pair-chunks %zu)\n", chunk_count);
+#endif
 }
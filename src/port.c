@@ -0,0 +1,424 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cutie.h"
+
+/* READER PORTS
+ *
+ * A port reads source from a file descriptor a chunk at a time and hands
+ * back one expression per port_read(). Bytes are scanned as they arrive
+ * to find where the next top-level expression ends, following the same
+ * rules and character classes as lex(): parentheses, string literals,
+ * comments and atoms. Once an expression is complete its text is passed
+ * to read_expr() and dropped from the buffer. A token or string cut in
+ * two by a chunk boundary is just scanned further when the next chunk
+ * comes in.
+ *
+ * The buffer only has to hold the expression being read, so memory use
+ * does not depend on the size of the input, and the scanner keeps its
+ * state between chunks, so each byte is looked at once.
+ *
+ * A regular file is mapped instead, when it can be, and parsed in place
+ * with no copy at all. Mappings are kept and shared: loading the same
+ * unchanged file again reuses its mapping, and the pages themselves are
+ * the page cache's, shared with every other process reading the file.
+ *
+ * A mapped file that is truncated while it is being read, say by an
+ * editor saving over it, leaves pages past its new end raising SIGBUS
+ * when they are touched. Mapped text is only read with map_guarded set,
+ * and a fault inside that mapping jumps back to port_read(), which gives
+ * up the rest of the file with an I/O error. */
+
+#define PORT_CHUNK 65536
+
+/* A read-only mapping of a whole source file, known by its inode and
+ * kept for as long as the file is unchanged */
+struct Mapping {
+  dev_t dev;
+  ino_t ino;
+  off_t size;
+  struct timespec mtime;
+  char *addr;
+  int refs;
+  struct Mapping *next;
+};
+
+static struct Mapping *mappings = NULL;
+
+static const struct Mapping *map_guarded = NULL;
+static sigjmp_buf map_fault;
+static struct sigaction old_sigbus;
+static int sigbus_handled = 0;
+
+static void on_sigbus(int sig, siginfo_t *info, void *context)
+{
+  const struct Mapping *m = map_guarded;
+  const char *addr = info->si_addr;
+
+  (void)sig;
+  (void)context;
+
+  /* The reader may look at the NUL just past the text, too */
+  if (m && addr >= m->addr && addr <= m->addr + m->size)
+    siglongjmp(map_fault, 1);
+
+  /* Not a read from a mapping: put the old handler back and let the
+   * access fault again */
+  sigaction(SIGBUS, &old_sigbus, NULL);
+  sigbus_handled = 0;
+}
+
+/* Returns 0 if faults in mappings can not be caught, and so files must
+ * not be mapped. SA_NODEFER leaves SIGBUS unblocked after the jump out
+ * of the handler, so sigsetjmp() need not save the signal mask. */
+static int handle_sigbus(void)
+{
+  struct sigaction sa;
+
+  if (sigbus_handled)
+    return 1;
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_sigaction = on_sigbus;
+  sa.sa_flags = SA_SIGINFO | SA_NODEFER;
+  sigemptyset(&sa.sa_mask);
+  if (sigaction(SIGBUS, &sa, &old_sigbus) < 0)
+    return 0;
+  sigbus_handled = 1;
+  return 1;
+}
+
+struct Port {
+  struct Mapping *map;  /* the file parsed in place, or NULL to stream */
+  int fd;
+  int owns_fd;
+  int eof;
+  char *buf;
+  size_t size;      /* bytes allocated, less the one kept for a NUL */
+  size_t start;     /* where the expression being scanned begins */
+  size_t scan;      /* how far it has been scanned */
+  size_t end;       /* how much of buf holds input */
+
+  /* Scanner state for the expression from start to scan */
+  int depth;
+  int started;
+  int in_atom;
+  int in_string;
+  int in_comment;
+  size_t atom_start;
+};
+
+static struct Port *port_new(int fd, int owns_fd)
+{
+  struct Port *port = calloc(1, sizeof(struct Port));
+
+  if (!port)
+    return NULL;
+  port->buf = malloc(PORT_CHUNK + 1);
+  if (!port->buf) {
+    free(port);
+    return NULL;
+  }
+  port->fd = fd;
+  port->owns_fd = owns_fd;
+  port->size = PORT_CHUNK;
+  return port;
+}
+
+/* A port reading from fd, which is left open when the port is closed */
+struct Port *port_open_fd(int fd)
+{
+  return port_new(fd, 0);
+}
+
+static int same_file(const struct Mapping *m, const struct stat *st)
+{
+  return m->dev == st->st_dev && m->ino == st->st_ino;
+}
+
+static int unchanged(const struct Mapping *m, const struct stat *st)
+{
+  return m->size == st->st_size
+    && m->mtime.tv_sec == st->st_mtim.tv_sec
+    && m->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+/* The mapping of the regular file open on fd, or NULL if it is not one
+ * that can be parsed in place. The reader needs the text to end with a
+ * NUL: the kernel zero-fills the rest of the last page, so that comes
+ * free unless the file fills its last page exactly. */
+static struct Mapping *map_file(int fd)
+{
+  struct Mapping *m, **link;
+  struct stat st;
+  void *addr;
+
+  if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size == 0
+      || st.st_size % sysconf(_SC_PAGESIZE) == 0 || !handle_sigbus())
+    return NULL;
+
+  for (link = &mappings; (m = *link) != NULL; ) {
+    if (same_file(m, &st) && unchanged(m, &st)) {
+      m->refs++;
+      return m;
+    }
+    /* The file has been rewritten; drop its old text once unused */
+    if (same_file(m, &st) && m->refs == 0) {
+      *link = m->next;
+      munmap(m->addr, m->size);
+      free(m);
+      continue;
+    }
+    link = &m->next;
+  }
+
+  addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (addr == MAP_FAILED)
+    return NULL;
+  m = malloc(sizeof(struct Mapping));
+  if (!m) {
+    munmap(addr, st.st_size);
+    return NULL;
+  }
+  m->dev = st.st_dev;
+  m->ino = st.st_ino;
+  m->size = st.st_size;
+  m->mtime = st.st_mtim;
+  m->addr = addr;
+  m->refs = 1;
+  m->next = mappings;
+  mappings = m;
+  return m;
+}
+
+/* Parse the file in place if it can be mapped, else stream it */
+struct Port *port_open_file(const char *path)
+{
+  struct Port *port;
+  struct Mapping *map;
+  int fd = open(path, O_RDONLY);
+
+  if (fd < 0)
+    return NULL;
+
+  map = map_file(fd);
+  if (map) {
+    close(fd);
+    port = calloc(1, sizeof(struct Port));
+    if (!port) {
+      map->refs--;
+      return NULL;
+    }
+    port->map = map;
+    port->fd = -1;
+    port->eof = 1;
+    port->buf = map->addr;
+    port->end = map->size;
+    return port;
+  }
+
+  port = port_new(fd, 1);
+  if (!port)
+    close(fd);
+  return port;
+}
+
+void port_close(struct Port *port)
+{
+  if (port->map) {
+    port->map->refs--;
+    free(port);
+    return;
+  }
+  if (port->owns_fd)
+    close(port->fd);
+  free(port->buf);
+  free(port);
+}
+
+/* Read the next chunk, first moving the expression being scanned to the
+ * front of the buffer or, if it fills the buffer, making room for it.
+ * Returns 0 at the end of the input. */
+static int port_fill(struct Port *port)
+{
+  ssize_t n;
+
+  if (port->start > 0) {
+    memmove(port->buf, port->buf + port->start, port->end - port->start);
+    port->scan -= port->start;
+    port->atom_start -= port->start;
+    port->end -= port->start;
+    port->start = 0;
+  }
+
+  if (port->end == port->size) {
+    char *buf = realloc(port->buf, port->size * 2 + 1);
+    if (!buf)
+      return 0;
+    port->buf = buf;
+    port->size *= 2;
+  }
+
+  do
+    n = read(port->fd, port->buf + port->end, port->size - port->end);
+  while (n < 0 && errno == EINTR);
+
+  if (n <= 0) {
+    port->eof = 1;
+    return 0;
+  }
+  port->end += n;
+  return 1;
+}
+
+/* Scan on from port->scan. Returns 1 with port->scan just past the end
+ * of the expression once it is complete, 0 if it needs more input. */
+static int port_scan(struct Port *port)
+{
+  for (; port->scan < port->end; port->scan++) {
+    const char *p;
+    char c;
+
+    /* Comments and strings run on to a single byte, left to memchr */
+    if (port->in_comment) {
+      p = memchr(port->buf + port->scan, '\n', port->end - port->scan);
+      if (!p) {
+        port->scan = port->end;
+        return 0;
+      }
+      port->scan = p - port->buf;
+      port->in_comment = 0;
+      if (!port->started)
+        port->start = port->scan + 1;
+      continue;
+    }
+
+    if (port->in_string) {
+      p = memchr(port->buf + port->scan, '"', port->end - port->scan);
+      if (!p) {
+        port->scan = port->end;
+        return 0;
+      }
+      port->scan = p - port->buf;
+      if (p[-1] != '\\') {
+        port->in_string = 0;
+        if (port->depth == 0) {
+          port->scan++;
+          return 1;
+        }
+      }
+      continue;
+    }
+
+    c = port->buf[port->scan];
+    if (port->in_atom) {
+      if (c == '(' && port->depth == 0 && port->scan - port->atom_start == 1
+          && port->buf[port->atom_start] == '#') {
+        /* #( opens a vector */
+        port->in_atom = 0;
+        port->depth++;
+        continue;
+      }
+      if (!(char_class[(unsigned char)c] & CHAR_DELIM))
+        continue;
+      port->in_atom = 0;
+      if (port->depth == 0)
+        return 1;
+    }
+
+    switch (c) {
+      case ' ':
+      case '\t':
+      case '\n':
+        /* Drop what comes before an expression as it is passed */
+        if (!port->started)
+          port->start = port->scan + 1;
+        break;
+      case ';':
+        port->in_comment = 1;
+        break;
+      case '(':
+        port->started = 1;
+        port->depth++;
+        break;
+      case ')':
+        port->started = 1;
+        if (port->depth == 0 || --port->depth == 0) {
+          port->scan++;
+          return 1;
+        }
+        break;
+      case '"':
+        port->started = 1;
+        port->in_string = 1;
+        break;
+      case '\'':
+      case '`':
+      case ',':
+        /* Prefixes belong to the expression that follows */
+        port->started = 1;
+        break;
+      default:
+        port->started = 1;
+        port->in_atom = 1;
+        port->atom_start = port->scan;
+        break;
+    }
+  }
+  return 0;
+}
+
+/* Read the next expression from port. Raises "End-of-input reached." as
+ * lex() does once nothing but white space and comments is left. */
+Error port_read(struct Port *port, Atom *result)
+{
+  const char *p;
+  char saved;
+  Error err;
+
+  if (port->map) {
+    /* The mapping ends in a NUL, so the reader can run over it as it is.
+     * After an error there is no telling where the next expression
+     * starts, so the rest of the file is given up. */
+    if (sigsetjmp(map_fault, 0)) {
+      map_guarded = NULL;
+      port->start = port->end;
+      return ERROR(Error_IO, "Source file truncated while being read.");
+    }
+    map_guarded = port->map;
+    err = read_expr(port->buf + port->start, &p, result);
+    map_guarded = NULL;
+    port->start = ERROR_RAISED(err) ? port->end : (size_t)(p - port->buf);
+    return err;
+  }
+
+  while (!port_scan(port)) {
+    if (!port->eof && port_fill(port))
+      continue;
+    /* At the end, hand whatever is left to the reader: a trailing atom
+     * is complete and anything else is an error it will report. */
+    if (port->start == port->end)
+      return ERROR(Error_Syntax, "End-of-input reached.");
+    break;
+  }
+
+  saved = port->buf[port->scan];
+  port->buf[port->scan] = '\0';
+  err = read_expr(port->buf + port->start, &p, result);
+  port->buf[port->scan] = saved;
+
+  port->start = port->scan;
+  port->depth = 0;
+  port->started = 0;
+  port->in_atom = 0;
+  port->in_string = 0;
+  port->in_comment = 0;
+  return err;
+}
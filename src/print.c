@@ -2,22 +2,22 @@
 #include "cutie.h"
 
 void print_expr(Atom atom) {
-  switch (atom.type) {
+  switch (atom_type(atom)) {
     case ATOM_NIL:
       printf("NIL");
       break;
     case ATOM_INTEGER:
-      printf("%ld", atom.value.integer);
+      printf("%ld", atom_integer(atom));
       break;
     case ATOM_REAL:
-      printf("%lf", atom.value.real);
+      printf("%lf", atom_real(atom));
       break;
     case ATOM_PAIR:
       putchar('(');
       print_expr(car(atom));
       atom = cdr(atom);
       while (!nilp(atom)) {
-        if (atom.type == ATOM_PAIR) {
+        if (atom_type(atom) == ATOM_PAIR) {
           putchar(' ');
           print_expr(car(atom));
           atom = cdr(atom);
@@ -29,11 +29,40 @@ void print_expr(Atom atom) {
       }
       putchar(')');
       break;
+    case ATOM_VECTOR: {
+      size_t i;
+
+      printf("#(");
+      for (i = 0; i < atom_vector(atom)->length; i++) {
+        if (i > 0)
+          putchar(' ');
+        print_expr(atom_vector(atom)->items[i]);
+      }
+      putchar(')');
+      break;
+    }
+    case ATOM_ARRAY: {
+      struct Array *a = atom_array(atom);
+      size_t i;
+
+      printf(a->kind == ARRAY_F64 ? "#<F64" : "#<I64");
+      for (i = 0; i < a->length; i++) {
+        if (a->kind == ARRAY_F64)
+          printf(" %lf", a->data.f64[i]);
+        else
+          printf(" %ld", a->data.i64[i]);
+      }
+      putchar('>');
+      break;
+    }
+    case ATOM_HASHTABLE:
+      printf("#<HASH-TABLE:%zu>", atom_hashtable(atom)->count);
+      break;
     case ATOM_BUILTIN:
-      printf("#<BUILTIN:%p>", atom.value.builtin);
+      printf("#<BUILTIN:%p>", atom_builtin(atom));
       break;
     case ATOM_STRING:
-      printf("%s", atom.value.string);
+      fwrite(string_bytes(atom), 1, atom_string(atom)->length, stdout);
       break;
     case ATOM_CLOSURE:
       printf("#<CLOSURE>");
@@ -43,7 +72,22 @@ void print_expr(Atom atom) {
       break;
     case ATOM_ERROR:
     case ATOM_SYMBOL:
-      printf("%s", atom.value.symbol);
+      printf("%s", atom_symbol(atom)->name);
+      break;
+    case ATOM_LOCAL:
+      printf("%s", atom_symbol(car(atom))->name);
+      break;
+    case ATOM_EXPANSION:
+      print_expr(car(atom));
+      break;
+    case ATOM_SCOPE:
+      printf("#<SCOPE>");
+      break;
+    case ATOM_FRAME:
+      printf("#<FRAME>");
+      break;
+    case ATOM_UNBOUND:
+      printf("#<UNBOUND>");
       break;
   }
 }
@@ -76,6 +120,9 @@ void print_error(Error err)
     case Error_OutOfBounds:
       puts("Index out of bounds.");
       break;
+    case Error_IO:
+      puts("Input/output error.");
+      break;
   }
   printf("Error: '%s' in function %s %s:%d\n",
       err.message, err.function_name, err.file_name, err.line_number);
@@ -1,18 +1,71 @@
+#include <limits.h>
 #include <string.h>
-#include <ctype.h>
 #include <stdlib.h>
 
 #include "cutie.h"
 
-Error lex(const char *str, const char **start, const char **end)
+/* LEXER
+ *
+ * Every byte is classified through char_class[], so telling white space,
+ * delimiters and digits apart is one load and a mask rather than a scan
+ * of a small set of characters. Runs of white space and atom characters
+ * are tested four bytes to a step; the tests are made in order and stop
+ * at the terminating NUL, which is a delimiter, so nothing past the end
+ * of the input is read. Strings and comments are left to strchr, which
+ * the C library scans a word or more at a time.
+ *
+ * Comments are skipped along with white space, so the reader never sees
+ * them as tokens. */
+
+#define S (CHAR_SPACE | CHAR_DELIM)
+#define P (CHAR_PREFIX | CHAR_DELIM)
+#define D CHAR_DIGIT
+
+const unsigned char char_class[256] = {
+  ['\0'] = CHAR_DELIM,
+  [' '] = S, ['\t'] = S, ['\n'] = S,
+  ['('] = P, [')'] = P, ['\''] = CHAR_PREFIX, ['`'] = CHAR_PREFIX,
+  ['0'] = D, ['1'] = D, ['2'] = D, ['3'] = D, ['4'] = D,
+  ['5'] = D, ['6'] = D, ['7'] = D, ['8'] = D, ['9'] = D,
+};
+
+#undef S
+#undef P
+#undef D
+
+#define is_space(c) (char_class[(unsigned char)(c)] & CHAR_SPACE)
+#define is_delim(c) (char_class[(unsigned char)(c)] & CHAR_DELIM)
+#define is_digit(c) (char_class[(unsigned char)(c)] & CHAR_DIGIT)
+
+static const char *skip_space(const char *p)
+{
+  for (;;) {
+    while (is_space(p[0]) && is_space(p[1]) && is_space(p[2])
+        && is_space(p[3]))
+      p += 4;
+    while (is_space(*p))
+      p++;
+    if (*p != ';')
+      return p;
+    p = strchr(p, '\n');
+    if (!p)
+      return "";
+  }
+}
+
+static const char *skip_atom(const char *p)
 {
-  const char *ws = " \t\n";
-  const char *delim = "() \t\n";
-  const char *prefix = "()\'`";
-  const char *eol = "\n";
-  const char *eos = "\"";
+  while (!is_delim(p[0]) && !is_delim(p[1]) && !is_delim(p[2])
+      && !is_delim(p[3]))
+    p += 4;
+  while (!is_delim(*p))
+    p++;
+  return p;
+}
 
-  str += strspn(str, ws);
+Error lex(const char *str, const char **start, const char **end)
+{
+  str = skip_space(str);
 
   if (str[0] == '\0') {
     *start = *end = NULL;
@@ -21,85 +74,137 @@ Error lex(const char *str, const char **start, const char **end)
 
   *start = str;
 
-  if (strchr(prefix, str[0]) != NULL)
+  if (char_class[(unsigned char)str[0]] & CHAR_PREFIX)
     *end = str + 1;
+  else if (str[0] == '#' && str[1] == '(')
+    *end = str + 2;
   else if (str[0] == ',')
     *end = str + (str[1] == '@' ? 2 : 1);
-  else if (str[0] == ';')
-    *end = str + strcspn(str, eol);
   else if (str[0] == '"') {
-    *end = str;
+    const char *p = str;
     do {
-      (*end)++;
-      *end = *end + strcspn(*end, eos);
-    } while (*(*end-1) == '\\');
-    *end = *end + 1;
+      p = strchr(p + 1, '"');
+      if (!p) {
+        *end = str + strlen(str);
+        return ERROR(Error_Syntax, "Unterminated string.");
+      }
+    } while (p[-1] == '\\');
+    *end = p + 1;
   } else
-    *end = str + strcspn(str, delim);
+    *end = skip_atom(str);
 
   return ERROR_OK();
 }
 
-Error parse_simple(const char *start, const char *end, Atom *result)
+/* Parse start to end as an integer or a real in one pass, accumulating
+ * the digits of an integer as they are checked. A real is handed to
+ * strtod only once it is known to be one, so it is rounded correctly.
+ * Returns 0 if the token is not a number. */
+static int parse_number(const char *start, const char *end, Atom *result)
 {
-  char *buf, *p;
+  const char *p = start;
+  unsigned long n = 0, limit = LONG_MAX;
+  int negative = 0, digits = 0, overflow = 0, real = 0;
 
-  /* Is it an integer? */
-  long ival = strtol(start, &p, 10);
-  if (p == end) {
-    result->type = ATOM_INTEGER;
-    result->value.integer = ival;
-    return ERROR_OK();
+  if (*p == '-' || *p == '+') {
+    negative = *p++ == '-';
+    limit += negative;
   }
 
-  /* Is it a real number? */
-  double dval = strtod(start, &p);
-  if (p == end) {
-    result->type = ATOM_REAL;
-    result->value.real = dval;
-    return ERROR_OK();
+  for (; p < end && is_digit(*p); p++, digits++) {
+    unsigned d = *p - '0';
+    if (n > (limit - d) / 10)
+      overflow = 1;
+    else
+      n = n * 10 + d;
   }
 
-  /* It is  a string */
-  if (*start == '"') {
-    start++;
-    end--;
-    buf = malloc(end - start);
-    p = buf;
-    while (start < end)
-      *p++ = *start, ++start;
-    *p = '\0';
+  if (p < end && *p == '.') {
+    real = 1;
+    for (p++; p < end && is_digit(*p); p++)
+      digits++;
+  }
 
-    *result = make_string(buf);
+  if (digits == 0)
+    return 0;
+
+  if (p < end && (*p == 'e' || *p == 'E')) {
+    real = 1;
+    p++;
+    if (p < end && (*p == '-' || *p == '+'))
+      p++;
+    if (p == end || !is_digit(*p))
+      return 0;
+    while (p < end && is_digit(*p))
+      p++;
+  }
 
-    free(buf);
+  if (p != end)
+    return 0;
+
+  if (real || overflow)
+    *result = make_real(strtod(start, NULL));
+  else
+    *result = make_integer(negative ? (long)(0 - n) : (long)n);
+  return 1;
+}
+
+Error parse_simple(const char *start, const char *end, Atom *result)
+{
+  size_t len = end - start;
+
+  if ((is_digit(*start) || *start == '-' || *start == '+' || *start == '.')
+      && parse_number(start, end, result))
+    return ERROR_OK();
+
+  /* It is  a string */
+  if (*start == '"') {
+    *result = make_string_n(start + 1, len - 2);
     return ERROR_OK();
   }
 
   /* NIL or symbol */
-  buf = malloc(end - start + 1);
-  p = buf;
-  while (start != end)
-    *p++ = toupper(*start), ++start;
-  *p = '\0';
-
-  if (strcmp(buf, "NIL") == 0)
+  if (len == 3 && (start[0] | 0x20) == 'n' && (start[1] | 0x20) == 'i'
+      && (start[2] | 0x20) == 'l')
     *result = nil;
-  else {
-    *result = make_symbol(buf);
-  }
-
-  free(buf);
+  else
+    *result = make_symbol_upcase(start, len);
 
   return ERROR_OK();
 }
 
+static Error read_token(const char *token, const char **end, Atom *result);
+
+/* Items are gathered on the C stack, where the collector's stack scan
+ * finds them, and move to a vector once a list outgrows that. The spine
+ * is laid out in one run when the closing ')' gives its length, so the
+ * reader allocates each pair once. */
+#define READ_LIST_ITEMS 16
+
+static Atom list_of_items(const Atom *items, size_t n, Atom tail)
+{
+  Atom list, p;
+  size_t i;
+
+  if (n == 0)
+    return tail;
+
+  list = p = make_list(n);
+  for (i = 0; i + 1 < n; i++, p = cdr(p))
+    car(p) = items[i];
+  car(p) = items[i];
+  cdr(p) = tail;
+  return list;
+}
+
 Error read_list(const char *start, const char **end, Atom *result)
 {
-  Atom p;
+  Atom stack_items[READ_LIST_ITEMS];
+  Atom *items = stack_items;
+  size_t n = 0, capacity = READ_LIST_ITEMS;
 
   *end = start;
-  p = *result = nil;
+  *result = nil;
 
   for (;;) {
     const char *token;
@@ -110,55 +215,66 @@ Error read_list(const char *start, const char **end, Atom *result)
     if (ERROR_RAISED(err))
       return err;
 
-    if (token[0] == ')')
+    if (token[0] == ')') {
+      *result = list_of_items(items, n, nil);
       return ERROR_OK();
+    }
 
     if (token[0] == '.' && *end - token == 1) {
       /* Improper list */
-      if (nilp(p))
+      if (n == 0)
         return ERROR(Error_Syntax, "Improper list error");
 
       err = read_expr(*end, end, &item);
       if (ERROR_RAISED(err))
         return err;
 
-      cdr(p) = item;
-
       /* Read the closing ')' */
       err = lex(*end, &token, end);
       if (!ERROR_RAISED(err) && token[0] != ')')
         err = ERROR(Error_Syntax, "Error syntax!");
+      if (ERROR_RAISED(err))
+        return err;
 
-      return err;
+      *result = list_of_items(items, n, item);
+      return ERROR_OK();
     }
 
-    err = read_expr(token, end, &item);
+    err = read_token(token, end, &item);
     if (ERROR_RAISED(err))
       return err;
 
-    if (nilp(p)) {
-      /* First item */
-      *result = cons(item, nil);
-      p = *result;
-    } else {
-      cdr(p) = cons(item, nil);
-      p = cdr(p);
+    if (n == capacity) {
+      /* The vector is kept alive by items pointing into it */
+      Atom grown = make_vector(capacity * 2, nil);
+
+      memcpy(atom_vector(grown)->items, items, n * sizeof(Atom));
+      items = atom_vector(grown)->items;
+      capacity *= 2;
     }
+    items[n++] = item;
   }
 }
 
-Error read_expr(const char *input, const char **end, Atom *result)
+/* Read the expression starting with token, which lex() has just returned
+ * with *end just past it */
+static Error read_token(const char *token, const char **end, Atom *result)
 {
-  const char *token;
   Error err;
 
-  err = lex(input, &token, end);
-  if (ERROR_RAISED(err))
-    return err;
-
   if (token[0] == '(') {
     return read_list(*end, end, result);
   }
+  else if (token[0] == '#' && *end - token == 2 && token[1] == '(') {
+    /* Vector literal; its items are not evaluated */
+    err = read_list(*end, end, result);
+    if (ERROR_RAISED(err))
+      return err;
+    if (!listp(*result))
+      return ERROR(Error_Syntax, "Improper vector literal.");
+    *result = list_to_vector(*result);
+    return ERROR_OK();
+  }
   else if (token[0] == ')') {
     return ERROR(Error_Syntax, "')' reached unexpectedly.");
   }
@@ -175,15 +291,23 @@ Error read_expr(const char *input, const char **end, Atom *result)
       token[1] == '@' ? "UNQUOTE-SPLICING" : "UNQUOTE"),
       cons(nil, nil));
     return read_expr(*end, end, &car(cdr(*result)));
-  } else if (token[0] == ';') {
-    // Found a comment. Skip until newline and continue reading.
-    return read_expr(*end, end, result);
   }
   else {
     return parse_simple(token, *end, result);
   }
 }
 
+Error read_expr(const char *input, const char **end, Atom *result)
+{
+  const char *token;
+  Error err;
+
+  err = lex(input, &token, end);
+  if (ERROR_RAISED(err))
+    return err;
+  return read_token(token, end, result);
+}
+
 Error cutie_parse(const char *input, Atom *result)
 {
   return read_expr(input, &input, result);
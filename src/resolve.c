@@ -0,0 +1,398 @@
+#include <stdlib.h>
+
+#include "cutie.h"
+
+/* LEXICAL ADDRESSING
+ *
+ * When a closure is made its body is resolved once. Every reference to a
+ * parameter or internal DEFINE of this closure or of an enclosing one is
+ * replaced, in place, by an ATOM_LOCAL holding the frame depth and slot
+ * index of the variable. An ATOM_SCOPE marker with the frame layout is
+ * then spliced in front of the body, so closures made later from the
+ * same source skip the pass. Globals stay symbols and are found through
+ * their value cells.
+ *
+ * Arguments of macro calls are left alone since the macro sees them as
+ * data, but the expansions kept in calls expanded ahead of time are
+ * resolved. Nested LAMBDAs are resolved when they are themselves made,
+ * and the bodies of LETs, which get a frame of their own, when they are
+ * first evaluated. */
+
+struct Names {
+  struct Symbol **names;
+  size_t count;
+  size_t capacity;
+};
+
+static void add_name(struct Names *names, struct Symbol *symbol)
+{
+  if (names->count == names->capacity) {
+    names->capacity = names->capacity ? names->capacity * 2 : 8;
+    names->names = realloc(names->names,
+        names->capacity * sizeof(*names->names));
+  }
+  names->names[names->count++] = symbol;
+}
+
+static int has_name(struct Names *names, struct Symbol *symbol)
+{
+  size_t i;
+
+  for (i = 0; i < names->count; i++) {
+    if (names->names[i] == symbol)
+      return 1;
+  }
+  return 0;
+}
+
+static int alist_has(Atom bs, Atom symbol)
+{
+  while (!nilp(bs)) {
+    if (atom_symbol(car(car(bs))) == atom_symbol(symbol))
+      return 1;
+    bs = cdr(bs);
+  }
+  return 0;
+}
+
+/* Find where symbol would be bound when the body runs: in the closure's
+ * own frame (depth 0), in an enclosing frame, dynamically (an alist
+ * binding, which may change), or not locally at all. With no scope the
+ * code runs directly in env, which is then depth 0. */
+int lookup_local(Atom symbol, struct Scope *scope, Atom env,
+    long *depth, long *index)
+{
+  int crossed_alist = 0;
+  long d = 0, i = -1;
+
+  if (scope)
+    i = scope_index(scope, atom_symbol(symbol));
+  else
+    d = -1;
+
+  for (;;) {
+    if (i >= 0) {
+      if (crossed_alist || d > 0xffff || i > 0xffff)
+        return LOCAL_DYNAMIC;
+      *depth = d;
+      *index = i;
+      return LOCAL_SLOT;
+    }
+
+    if (atom_type(env) == ATOM_FRAME) {
+      if (alist_has(atom_frame(env)->extra, symbol))
+        return LOCAL_DYNAMIC;
+      i = scope_index(atom_frame(env)->scope, atom_symbol(symbol));
+      env = atom_frame(env)->parent;
+    } else if (atom_type(env) == ATOM_PAIR && !nilp(car(env))) {
+      if (alist_has(cdr(env), symbol))
+        return LOCAL_DYNAMIC;
+      crossed_alist = 1;
+      env = car(env);
+    } else {
+      return LOCAL_NONE;
+    }
+    d++;
+  }
+}
+
+Atom make_local(Atom symbol, long depth, long index)
+{
+  return atom_retype(cons(symbol, make_integer(depth << 16 | index)),
+      ATOM_LOCAL);
+}
+
+static int macro_operator(Atom op, struct Scope *scope, Atom env)
+{
+  long depth, index;
+
+  if (atom_type(op) != ATOM_SYMBOL)
+    return 0;
+  if (lookup_local(op, scope, env, &depth, &index) != LOCAL_NONE)
+    return 0;
+  return atom_symbol(op)->bound
+    && atom_type(atom_symbol(op)->value) == ATOM_MACRO;
+}
+
+static void collect_defines(Atom expr, struct Names *names, Atom env);
+
+static void collect_list(Atom list, struct Names *names, Atom env)
+{
+  for (; atom_type(list) == ATOM_PAIR; list = cdr(list))
+    collect_defines(car(list), names, env);
+}
+
+/* The initial values of LET bindings are evaluated outside the LET */
+static void collect_bindings(Atom bindings, struct Names *names, Atom env)
+{
+  for (; atom_type(bindings) == ATOM_PAIR; bindings = cdr(bindings)) {
+    if (atom_type(car(bindings)) == ATOM_PAIR)
+      collect_list(cdr(car(bindings)), names, env);
+  }
+}
+
+static void collect_defines(Atom expr, struct Names *names, Atom env)
+{
+  struct Scope scope;
+  Atom op, args, target;
+
+  if (atom_type(expr) != ATOM_PAIR || !listp(expr))
+    return;
+
+  op = car(expr);
+  args = cdr(expr);
+
+  if (atom_type(op) == ATOM_SYMBOL) {
+    switch (atom_symbol(op)->special) {
+    case SPECIAL_QUOTE:
+    case SPECIAL_LAMBDA:
+    case SPECIAL_DEFMACRO:
+      return;
+
+    case SPECIAL_LET:
+      /* DEFINEs in the body go in the LET's frame */
+      if (!nilp(args))
+        collect_bindings(car(args), names, env);
+      return;
+
+    case SPECIAL_COND:
+      for (; !nilp(args); args = cdr(args))
+        collect_list(car(args), names, env);
+      return;
+
+    case SPECIAL_DEFINE:
+      if (nilp(args))
+        return;
+      target = car(args);
+      if (atom_type(target) == ATOM_PAIR)
+        target = car(target);
+      if (atom_type(target) == ATOM_LOCAL)
+        target = car(target);
+      if (atom_type(target) == ATOM_SYMBOL && !has_name(names, atom_symbol(target)))
+        add_name(names, atom_symbol(target));
+      if (atom_type(car(args)) == ATOM_PAIR)
+        return;
+      args = cdr(args);
+      break;
+
+    case SPECIAL_NONE:
+      scope.count = names->count;
+      scope.params = 0;
+      scope.rest = 0;
+      scope.names = names->names;
+      if (macro_operator(op, &scope, env))
+        return;
+      break;
+
+    default:
+      break;
+    }
+  } else if (atom_type(op) == ATOM_EXPANSION) {
+    collect_defines(cdr(cdr(op)), names, env);
+    return;
+  }
+
+  while (!nilp(args)) {
+    collect_defines(car(args), names, env);
+    args = cdr(args);
+  }
+}
+
+static void resolve_expr(Atom *expr, struct Scope *scope, Atom env);
+
+static void resolve_list(Atom list, struct Scope *scope, Atom env)
+{
+  while (!nilp(list)) {
+    resolve_expr(&car(list), scope, env);
+    list = cdr(list);
+  }
+}
+
+static void resolve_expr(Atom *expr, struct Scope *scope, Atom env)
+{
+  Atom op, args;
+  long depth, index;
+
+  if (atom_type(*expr) == ATOM_SYMBOL) {
+    if (atom_symbol(*expr)->name[0] != ':'
+        && lookup_local(*expr, scope, env, &depth, &index) == LOCAL_SLOT)
+      *expr = make_local(*expr, depth, index);
+    return;
+  }
+
+  if (atom_type(*expr) != ATOM_PAIR || !listp(*expr))
+    return;
+
+  op = car(*expr);
+  args = cdr(*expr);
+
+  if (atom_type(op) == ATOM_SYMBOL) {
+    switch (atom_symbol(op)->special) {
+    case SPECIAL_QUOTE:
+    case SPECIAL_LAMBDA:
+    case SPECIAL_DEFMACRO:
+      return;
+
+    case SPECIAL_DEFINE:
+    case SPECIAL_SET:
+      /* (DEFINE (f ...) ...) makes a closure and is resolved then */
+      if (nilp(args) || atom_type(car(args)) != ATOM_SYMBOL)
+        return;
+      if (lookup_local(car(args), scope, env, &depth, &index) == LOCAL_SLOT
+          && (depth == 0 || atom_symbol(op)->special == SPECIAL_SET))
+        car(args) = make_local(car(args), depth, index);
+      resolve_list(cdr(args), scope, env);
+      return;
+
+    case SPECIAL_LET:
+      if (nilp(args))
+        return;
+      for (args = car(args); atom_type(args) == ATOM_PAIR; args = cdr(args)) {
+        if (atom_type(car(args)) == ATOM_PAIR && listp(cdr(car(args))))
+          resolve_list(cdr(car(args)), scope, env);
+      }
+      return;
+
+    case SPECIAL_COND:
+      for (; !nilp(args); args = cdr(args)) {
+        if (atom_type(car(args)) == ATOM_PAIR && listp(car(args)))
+          resolve_list(car(args), scope, env);
+      }
+      return;
+
+    case SPECIAL_NONE:
+      if (macro_operator(op, scope, env))
+        return;
+      break;
+
+    default:
+      resolve_list(args, scope, env);
+      return;
+    }
+  } else if (atom_type(op) == ATOM_EXPANSION) {
+    /* the expansion of a call runs in this scope, its arguments may not */
+    resolve_expr(&cdr(cdr(op)), scope, env);
+    return;
+  }
+
+  resolve_list(*expr, scope, env);
+}
+
+/* A body shared between closures with different parameter lists, which
+ * only a macro can arrange, must not reuse the other closure's layout. */
+static int scope_matches(struct Scope *scope, Atom args)
+{
+  size_t i = 0;
+
+  while (atom_type(args) == ATOM_PAIR) {
+    if (i >= scope->params || scope->names[i] != atom_symbol(car(args)))
+      return 0;
+    args = cdr(args);
+    i++;
+  }
+  if (i != scope->params)
+    return 0;
+  if (atom_type(args) == ATOM_SYMBOL)
+    return scope->rest && scope->names[i] == atom_symbol(args);
+  return !scope->rest;
+}
+
+Atom resolve_body(Atom env, Atom args, Atom body)
+{
+  struct Names names = {NULL, 0, 0};
+  struct Scope *scope;
+  Atom p, marker;
+  size_t i;
+
+  if (!nilp(body) && atom_type(car(body)) == ATOM_SCOPE) {
+    if (scope_matches(atom_scope(car(body)), args))
+      return body;
+    body = copy_list(cdr(body));
+  }
+
+  for (p = args; atom_type(p) == ATOM_PAIR; p = cdr(p))
+    add_name(&names, atom_symbol(car(p)));
+  i = names.count;
+  if (atom_type(p) == ATOM_SYMBOL)
+    add_name(&names, atom_symbol(p));
+
+  for (p = body; !nilp(p); p = cdr(p))
+    collect_defines(car(p), &names, env);
+
+  scope = gc_alloc(GC_SCOPE,
+      sizeof(struct Scope) + names.count * sizeof(struct Symbol*));
+  scope->count = names.count;
+  scope->params = i;
+  scope->rest = !listp(args);
+  scope->names = (struct Symbol**)(scope + 1);
+  scope->code = NULL;
+  for (i = 0; i < names.count; i++)
+    scope->names[i] = names.names[i];
+  free(names.names);
+
+  resolve_list(body, scope, env);
+
+  marker = atom_pointer(ATOM_SCOPE, scope);
+
+  if (nilp(body))
+    return cons(marker, nil);
+
+  cdr(body) = cons(car(body), cdr(body));
+  car(body) = marker;
+  return body;
+}
+
+/* A LET's bindings must each be (name value) or (name) */
+static int valid_binding(Atom binding)
+{
+  return atom_type(binding) == ATOM_PAIR
+    && atom_type(car(binding)) == ATOM_SYMBOL
+    && (nilp(cdr(binding))
+      || (atom_type(cdr(binding)) == ATOM_PAIR && nilp(cdr(cdr(binding)))));
+}
+
+/* Does scope lay out the frame for exactly these bindings? */
+static int let_scope_matches(struct Scope *scope, Atom bindings)
+{
+  size_t i = 0;
+
+  for (; atom_type(bindings) == ATOM_PAIR; bindings = cdr(bindings), i++) {
+    if (!valid_binding(car(bindings)) || i >= scope->params
+        || scope->names[i] != atom_symbol(car(car(bindings))))
+      return 0;
+  }
+  return nilp(bindings) && i == scope->params;
+}
+
+/* The frame layout for the body of (LET . args) run in env. The body is
+ * resolved the first time, as a closure's body is, with the bound names
+ * as its parameters. */
+Error resolve_let(Atom env, Atom args, struct Scope **scope)
+{
+  Atom bindings = car(args), body = cdr(args), names = nil, tail = nil;
+
+  if (!nilp(body) && atom_type(car(body)) == ATOM_SCOPE
+      && let_scope_matches(atom_scope(car(body)), bindings)) {
+    *scope = atom_scope(car(body));
+    return ERROR_OK();
+  }
+
+  for (; atom_type(bindings) == ATOM_PAIR; bindings = cdr(bindings)) {
+    Atom cell;
+
+    if (!valid_binding(car(bindings)))
+      return ERROR(Error_Syntax, "LET binding must be (name value).");
+    cell = cons(car(car(bindings)), nil);
+    if (nilp(names))
+      names = cell;
+    else
+      cdr(tail) = cell;
+    tail = cell;
+  }
+  if (!nilp(bindings))
+    return ERROR(Error_Syntax, "LET bindings must be a list.");
+
+  cdr(args) = resolve_body(env, names, body);
+  *scope = atom_scope(car(cdr(args)));
+  return ERROR_OK();
+}
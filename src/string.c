@@ -0,0 +1,228 @@
+#include <string.h>
+
+#include "cutie.h"
+
+/* STRINGS
+ *
+ * A string records its length and reaches its text one of three ways:
+ *
+ *   flat   its chars follow the header in the same allocation
+ *   slice  its chars point into the buffer of base, another flat string
+ *   rope   chars is NULL and the text is left followed by right
+ *
+ * Concatenation makes a rope and substrings make slices, so neither
+ * copies. The text is put together only when C code asks for it with
+ * string_chars(), and the flat copy is kept in base for next time.
+ *
+ * A rope never has an empty half, so the shorter half of any rope is at
+ * most half as long; recursing into the shorter half and looping on the
+ * longer keeps the C stack to log2(length) frames however lopsided the
+ * rope is. */
+
+/* Concatenations shorter than this are copied rather than made ropes */
+#define ROPE_MIN 32
+
+static struct String *new_string(size_t extra)
+{
+  struct String *s = gc_alloc(GC_STRING, sizeof(struct String) + extra);
+
+  s->length = 0;
+  s->chars = NULL;
+  s->base = nil;
+  s->left = nil;
+  s->right = nil;
+  return s;
+}
+
+/* A flat string of len characters, left for the caller to fill in */
+static Atom make_flat(size_t len)
+{
+  struct String *s = new_string(len + 1);
+
+  s->length = len;
+  s->chars = (char *)(s + 1);
+  s->chars[len] = '\0';
+  return atom_pointer(ATOM_STRING, s);
+}
+
+Atom make_string_n(const char *text, size_t len)
+{
+  Atom a = make_flat(len);
+  memcpy(atom_string(a)->chars, text, len);
+  return a;
+}
+
+Atom make_string(const char *text)
+{
+  return make_string_n(text, strlen(text));
+}
+
+/* Copy the text of s to out */
+static void string_copy(Atom s, char *out)
+{
+  for (;;) {
+    struct String *str = atom_string(s);
+
+    if (str->chars) {
+      memcpy(out, str->chars, str->length);
+      return;
+    }
+
+    if (atom_string(str->left)->length <= atom_string(str->right)->length) {
+      string_copy(str->left, out);
+      out += atom_string(str->left)->length;
+      s = str->right;
+    } else {
+      string_copy(str->right, out + atom_string(str->left)->length);
+      s = str->left;
+    }
+  }
+}
+
+/* The text of s as a NUL-terminated C string */
+const char *string_chars(Atom s)
+{
+  struct String *str = atom_string(s);
+  Atom flat;
+
+  /* A suffix slice ends where its base does */
+  if (str->chars && str->chars[str->length] == '\0')
+    return str->chars;
+
+  flat = make_flat(str->length);
+  string_copy(s, atom_string(flat)->chars);
+
+  str->chars = atom_string(flat)->chars;
+  str->base = flat;
+  str->left = nil;
+  str->right = nil;
+  return str->chars;
+}
+
+Atom string_concat(Atom a, Atom b)
+{
+  size_t la = atom_string(a)->length, lb = atom_string(b)->length;
+  struct String *s;
+  Atom r;
+
+  if (la == 0)
+    return b;
+  if (lb == 0)
+    return a;
+
+  if (la + lb < ROPE_MIN) {
+    r = make_flat(la + lb);
+    string_copy(a, atom_string(r)->chars);
+    string_copy(b, atom_string(r)->chars + la);
+    return r;
+  }
+
+  s = new_string(0);
+  s->length = la + lb;
+  s->left = a;
+  s->right = b;
+  return atom_pointer(ATOM_STRING, s);
+}
+
+/* The len characters of s from start, which the caller has checked lie
+ * within it */
+Atom string_slice(Atom s, size_t start, size_t len)
+{
+  struct String *str, *slice;
+
+  if (start == 0 && len == atom_string(s)->length)
+    return s;
+
+  str = atom_string(s);
+  if (!str->chars)
+    string_chars(s);
+  slice = new_string(0);
+  slice->length = len;
+  slice->chars = str->chars + start;
+  slice->base = nilp(str->base) ? s : str->base;
+  return atom_pointer(ATOM_STRING, slice);
+}
+
+/* The text of s, which unlike string_chars() may run on past its length
+ * in a slice; only ropes need to be flattened for it */
+const char *string_bytes(Atom s)
+{
+  if (atom_string(s)->chars)
+    return atom_string(s)->chars;
+  return string_chars(s);
+}
+
+/* Ordered as strcmp orders them */
+int string_compare(Atom a, Atom b)
+{
+  size_t la = atom_string(a)->length, lb = atom_string(b)->length;
+  const char *ta, *tb;
+  int c;
+
+  if (atom_string(a) == atom_string(b))
+    return 0;
+  ta = string_bytes(a);
+  tb = string_bytes(b);
+  c = memcmp(ta, tb, la < lb ? la : lb);
+  if (c != 0)
+    return c;
+  return (la > lb) - (la < lb);
+}
+
+/* SEARCHING
+ *
+ * Scans are left to memchr, which the C library vectorizes: a search
+ * looks for the first byte of the pattern and only compares the rest
+ * where it turns up. */
+
+/* The offset of the first pattern in s at or after from, or -1 */
+long string_search(Atom s, Atom pattern, size_t from)
+{
+  size_t n = atom_string(s)->length, m = atom_string(pattern)->length;
+  const char *text, *pat, *p, *end;
+
+  if (from > n || m > n - from)
+    return -1;
+  if (m == 0)
+    return from;
+
+  pat = string_bytes(pattern);
+  text = string_bytes(s);
+  end = text + n - m + 1;
+  for (p = text + from; p < end; p++) {
+    p = memchr(p, pat[0], end - p);
+    if (!p)
+      return -1;
+    if (memcmp(p + 1, pat + 1, m - 1) == 0)
+      return p - text;
+  }
+  return -1;
+}
+
+/* The offset of the first byte of s at or after from that is any of the
+ * bytes of set, or -1 */
+long string_index(Atom s, Atom set, size_t from)
+{
+  size_t n = atom_string(s)->length, m = atom_string(set)->length;
+  const char *text, *chars, *p;
+  unsigned char member[256] = {0};
+  size_t i;
+
+  if (from >= n || m == 0)
+    return -1;
+
+  chars = string_bytes(set);
+  text = string_bytes(s);
+  if (m == 1) {
+    p = memchr(text + from, chars[0], n - from);
+    return p ? p - text : -1;
+  }
+
+  for (i = 0; i < m; i++)
+    member[(unsigned char)chars[i]] = 1;
+  for (i = from; i < n; i++) {
+    if (member[(unsigned char)text[i]])
+      return i;
+  }
+  return -1;
+}
@@ -0,0 +1,669 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "cutie.h"
+
+/* BYTECODE VM
+ *
+ * Runs the code made by compile.c. Arguments and temporaries live on a
+ * value stack, and each closure call pushes an activation rather than
+ * recursing in C, so only builtins that call back into Lisp (APPLY, macro
+ * expansion, LOAD) nest vm_run. Closure frames are the same ATOM_FRAMEs
+ * the tree walker uses, so closures can be called from either engine.
+ *
+ * The stacks are outside the C stack and are marked by vm_mark. */
+
+struct Activation {
+  struct Code *code;
+  const int *pc;
+  Atom env;
+  size_t base;
+};
+
+static Atom *stack = NULL;
+static size_t sp = 0;
+static size_t stack_size = 0;
+
+static struct Activation *frames = NULL;
+static size_t fp = 0;
+static size_t frames_size = 0;
+
+static Atom sym_t = NIL_INITIALIZER;
+
+/* Room for n more values on the stack, or an error, with the stack as
+ * it was, if it can not grow */
+static Error reserve(size_t n)
+{
+  size_t size = stack_size;
+  Atom *grown;
+
+  if (sp + n <= stack_size)
+    return ERROR_OK();
+  while (sp + n > size)
+    size = size ? size * 2 : 1024;
+  grown = realloc(stack, size * sizeof(Atom));
+  if (!grown)
+    return ERROR(Error_IO, "Out of memory for the VM stack.");
+  stack = grown;
+  stack_size = size;
+  return ERROR_OK();
+}
+
+static Error push_activation(struct Code *code, Atom env)
+{
+  if (fp == frames_size) {
+    size_t size = frames_size ? frames_size * 2 : 256;
+    struct Activation *grown = realloc(frames, size * sizeof(*frames));
+
+    if (!grown)
+      return ERROR(Error_IO, "Out of memory for the VM call stack.");
+    frames = grown;
+    frames_size = size;
+  }
+  frames[fp].code = code;
+  frames[fp].pc = code->ops;
+  frames[fp].env = env;
+  frames[fp].base = sp;
+  fp++;
+  return reserve(code->max_stack);
+}
+
+/* The slot an OP_LOCAL refers to, checked as local_slot in env.c does */
+static Atom *local_ref(Atom env, Atom ref)
+{
+  long depth = LOCAL_DEPTH(ref);
+  long index = LOCAL_INDEX(ref);
+  struct Frame *frame;
+
+  while (depth-- > 0 && atom_type(env) == ATOM_FRAME)
+    env = atom_frame(env)->parent;
+  if (atom_type(env) != ATOM_FRAME)
+    return NULL;
+
+  frame = atom_frame(env);
+  if ((size_t)index >= frame->scope->count
+      || frame->scope->names[index] != atom_symbol(car(ref))
+      || atom_type(frame->slots[index]) == ATOM_UNBOUND)
+    return NULL;
+  return &frame->slots[index];
+}
+
+/* A global can only be shadowed by a binding DEFINEd at runtime in one
+ * of the frames on the way to the root */
+static int global_visible(Atom env)
+{
+  while (atom_type(env) == ATOM_FRAME) {
+    if (!nilp(atom_frame(env)->extra))
+      return 0;
+    env = atom_frame(env)->parent;
+  }
+  return 1;
+}
+
+/* Make the frame for a call of closure fn with the n arguments on top of
+ * the stack, and pop them and fn. */
+static Error bind_stack(Atom fn, size_t n, Atom *env, struct Code **code)
+{
+  struct Scope *scope = atom_scope(car(cdr(cdr(fn))));
+  Atom *slots;
+  size_t i;
+  Error err;
+
+  if (scope->code) {
+    *code = scope->code;
+  } else {
+    err = compile_closure(fn, code);
+    if (ERROR_RAISED(err))
+      return err;
+  }
+
+  if (n < scope->params || (n > scope->params && !scope->rest))
+    return ERROR(Error_Args, "Argument required.");
+
+  if ((*code)->spare) {
+    *env = atom_pointer(ATOM_FRAME, (*code)->spare);
+    atom_frame(*env)->parent = car(fn);
+    atom_frame(*env)->extra = nil;
+    (*code)->spare = NULL;
+    for (i = scope->params; i < scope->count; i++)
+      atom_frame(*env)->slots[i] = atom_pointer(ATOM_UNBOUND, NULL);
+  } else {
+    *env = make_frame(car(fn), scope);
+  }
+
+  slots = atom_frame(*env)->slots;
+  for (i = 0; i < scope->params; i++)
+    slots[i] = stack[sp - n + i];
+
+  if (scope->rest) {
+    Atom list = nil;
+    size_t j;
+
+    for (j = n; j-- > scope->params;)
+      list = cons(stack[sp - n + j], list);
+    slots[i] = list;
+  }
+
+  sp -= n + 1;
+  return ERROR_OK();
+}
+
+/* Once a call returns nothing can refer to its frame unless the body
+ * made a closure or similar, so the frame can be used again. */
+static void release_frame(struct Code *code, Atom env)
+{
+  if (!code->captures && atom_type(env) == ATOM_FRAME
+      && atom_frame(env)->scope->code == code)
+    code->spare = atom_frame(env);
+}
+
+/* The builtins that inner loops lean on are done in place when their
+ * arguments are plain, saving the consed argument list. Anything else,
+ * including every error case, goes through the builtin itself. */
+static int call_inline(Builtin fn, size_t n, const Atom *args, Atom *result)
+{
+  if (n == 2 && atom_type(args[0]) == ATOM_INTEGER
+      && atom_type(args[1]) == ATOM_INTEGER) {
+    long a = atom_integer(args[0]), b = atom_integer(args[1]);
+
+    if (fn == builtin_add)
+      *result = integer_arithmetic('+', a, b);
+    else if (fn == builtin_subtract)
+      *result = integer_arithmetic('-', a, b);
+    else if (fn == builtin_multiply)
+      *result = integer_arithmetic('*', a, b);
+    else if (fn == builtin_less)
+      *result = a < b ? sym_t : nil;
+    else if (fn == builtin_greater)
+      *result = a > b ? sym_t : nil;
+    else if (fn == builtin_less_equal)
+      *result = a <= b ? sym_t : nil;
+    else if (fn == builtin_greater_equal)
+      *result = a >= b ? sym_t : nil;
+    else if (fn == builtin_numeq)
+      *result = a == b ? sym_t : nil;
+    else
+      return 0;
+    return 1;
+  }
+
+  if (n == 1 && atom_type(args[0]) == ATOM_PAIR) {
+    if (fn == builtin_car)
+      *result = car(args[0]);
+    else if (fn == builtin_cdr)
+      *result = cdr(args[0]);
+    else
+      return 0;
+    return 1;
+  }
+
+  if (n == 2 && fn == builtin_vector_ref
+      && atom_type(args[0]) == ATOM_VECTOR
+      && atom_type(args[1]) == ATOM_INTEGER
+      && atom_integer(args[1]) >= 0
+      && (size_t)atom_integer(args[1]) < atom_vector(args[0])->length) {
+    *result = atom_vector(args[0])->items[atom_integer(args[1])];
+    return 1;
+  }
+
+  if (n == 2 && fn == builtin_cons) {
+    *result = cons(args[0], args[1]);
+    return 1;
+  }
+
+  return 0;
+}
+
+/* The compiled expansion for the macro call site described by operands
+ * (see compile_site), expanding it again if the macro has changed. */
+static Error expand_site(struct Code *code, const int *operands,
+    Atom macro, Atom env, struct Code **thunk)
+{
+  Atom form = code->constants[operands[0]];
+  Atom *used = &code->constants[operands[0] + 1];
+  struct Code **site = &code->sites[operands[1]];
+  Atom expansion;
+  Error err;
+
+  if (*site && atom_pair(*used) == atom_pair(macro)) {
+    *thunk = *site;
+    return ERROR_OK();
+  }
+
+  err = expand_call(form, macro, &expansion);
+  if (ERROR_RAISED(err))
+    return err;
+
+  err = compile_thunk(expansion, env, thunk);
+  if (ERROR_RAISED(err))
+    return err;
+
+  *site = *thunk;
+  *used = macro;
+  return ERROR_OK();
+}
+
+static Error vm_run(struct Code *code, Atom env, Atom *result)
+{
+  size_t entry = fp, base = sp;
+  const int *pc;
+  Atom *constants;
+  Error err;
+
+  if (nilp(sym_t))
+    sym_t = make_symbol("T");
+
+  err = push_activation(code, env);
+  if (ERROR_RAISED(err))
+    goto fail;
+  pc = code->ops;
+  constants = code->constants;
+
+  for (;;) {
+    switch ((Opcode)*pc++) {
+    case OP_CONST:
+      stack[sp++] = constants[*pc++];
+      break;
+
+    case OP_NIL:
+      stack[sp++] = nil;
+      break;
+
+    case OP_LOCAL: {
+      Atom ref = constants[*pc++];
+      Atom *slot = local_ref(env, ref);
+
+      if (slot) {
+        stack[sp++] = *slot;
+      } else {
+        err = env_get(env, car(ref), &stack[sp]);
+        if (ERROR_RAISED(err))
+          goto fail;
+        sp++;
+      }
+      break;
+    }
+
+    case OP_GLOBAL: {
+      Atom symbol = constants[*pc++];
+
+      if (global_visible(env) && atom_symbol(symbol)->bound) {
+        stack[sp++] = atom_symbol(symbol)->value;
+      } else {
+        err = env_get(env, symbol, &stack[sp]);
+        if (ERROR_RAISED(err))
+          goto fail;
+        sp++;
+      }
+      break;
+    }
+
+    case OP_NAME:
+      err = env_get(env, constants[*pc++], &stack[sp]);
+      if (ERROR_RAISED(err))
+        goto fail;
+      sp++;
+      break;
+
+    case OP_SET_LOCAL: {
+      Atom ref = constants[*pc++];
+      err = local_set(env, ref, stack[sp - 1]);
+      if (ERROR_RAISED(err))
+        goto fail;
+      stack[sp - 1] = car(ref);
+      break;
+    }
+
+    case OP_SET_NAME: {
+      Atom symbol = constants[*pc++];
+      err = env_set_existing(env, symbol, stack[sp - 1]);
+      if (ERROR_RAISED(err))
+        goto fail;
+      stack[sp - 1] = symbol;
+      break;
+    }
+
+    case OP_DEFINE_LOCAL: {
+      Atom ref = constants[*pc++];
+      err = local_define(env, ref, stack[sp - 1]);
+      if (ERROR_RAISED(err))
+        goto fail;
+      stack[sp - 1] = car(ref);
+      break;
+    }
+
+    case OP_DEFINE_NAME: {
+      Atom symbol = constants[*pc++];
+      err = env_set(env, symbol, stack[sp - 1]);
+      if (ERROR_RAISED(err))
+        goto fail;
+      stack[sp - 1] = symbol;
+      break;
+    }
+
+    case OP_POP:
+      sp--;
+      break;
+
+    case OP_JUMP:
+      pc = code->ops + *pc;
+      break;
+
+    case OP_JUMP_IF_NIL:
+      if (nilp(stack[--sp]))
+        pc = code->ops + *pc;
+      else
+        pc++;
+      break;
+
+    case OP_JUMP_IF_TRUE_OR_POP:
+      if (!nilp(stack[sp - 1])) {
+        pc = code->ops + *pc;
+      } else {
+        sp--;
+        pc++;
+      }
+      break;
+
+    case OP_CLOSURE: {
+      Atom lambda = constants[*pc++], fn;
+      err = make_closure(env, car(lambda), cdr(lambda), &fn);
+      if (ERROR_RAISED(err))
+        goto fail;
+      stack[sp++] = fn;
+      break;
+    }
+
+    case OP_MACRO: {
+      Atom args = constants[*pc++], name, macro;
+
+      if (nilp(args) || nilp(cdr(args))) {
+        err = ERROR(Error_Args, "DEFMACRO requires two arguments.");
+        goto fail;
+      }
+      if (atom_type(car(args)) != ATOM_PAIR) {
+        err = ERROR(Error_Syntax, "DEFMACRO syntax error.");
+        goto fail;
+      }
+      name = car(car(args));
+      if (atom_type(name) != ATOM_SYMBOL) {
+        err = ERROR(Error_Type, "DEFMACRO type error.");
+        goto fail;
+      }
+
+      err = make_closure(env, cdr(car(args)), cdr(args), &macro);
+      if (ERROR_RAISED(err))
+        goto fail;
+      macro = atom_retype(macro, ATOM_MACRO);
+      err = env_set(env, name, macro);
+      if (ERROR_RAISED(err))
+        goto fail;
+      stack[sp++] = name;
+      break;
+    }
+
+    case OP_LOAD: {
+      Atom path = stack[sp - 1];
+
+      if (atom_type(path) != ATOM_STRING) {
+        err = ERROR(Error_Type, "LOAD argument must be a string.");
+        goto fail;
+      }
+      err = load_path(env, string_chars(path));
+      if (ERROR_RAISED(err))
+        goto fail;
+      stack[sp - 1] = make_symbol("T");
+      break;
+    }
+
+    case OP_REQUIRE: {
+      Atom loaded;
+
+      err = require_module(env, stack[sp - 2], stack[sp - 1], &loaded);
+      if (ERROR_RAISED(err))
+        goto fail;
+      stack[--sp - 1] = loaded;
+      break;
+    }
+
+    case OP_PROVIDE: {
+      Atom feature;
+
+      err = provide_feature(env, stack[sp - 1], &feature);
+      if (ERROR_RAISED(err))
+        goto fail;
+      stack[sp - 1] = feature;
+      break;
+    }
+
+    case OP_EXPAND:
+    case OP_TAIL_EXPAND: {
+      Atom form = constants[pc[0]], op = car(form), macro;
+      struct Code *thunk;
+
+      if (atom_type(op) == ATOM_EXPANSION)
+        op = car(op);
+      macro = atom_symbol(op)->value;
+
+      if (atom_type(macro) == ATOM_MACRO)
+        err = expand_site(code, pc, macro, env, &thunk);
+      else
+        err = compile_thunk(form, env, &thunk);
+      if (ERROR_RAISED(err))
+        goto fail;
+
+      if (pc[-1] == OP_TAIL_EXPAND) {
+        sp = frames[fp - 1].base;
+        frames[fp - 1].code = thunk;
+        err = reserve(thunk->max_stack);
+      } else {
+        frames[fp - 1].pc = pc + 2;
+        err = push_activation(thunk, env);
+      }
+      if (ERROR_RAISED(err))
+        goto fail;
+      code = thunk;
+      pc = code->ops;
+      constants = code->constants;
+      break;
+    }
+
+    case OP_MACRO_GUARD: {
+      struct Code *thunk;
+
+      if (atom_type(stack[sp - 1]) != ATOM_MACRO) {
+        pc += 3;
+        break;
+      }
+
+      err = expand_site(code, pc, stack[sp - 1], env, &thunk);
+      if (ERROR_RAISED(err))
+        goto fail;
+      sp--;
+
+      frames[fp - 1].pc = code->ops + pc[2];
+      err = push_activation(thunk, env);
+      if (ERROR_RAISED(err))
+        goto fail;
+      code = thunk;
+      pc = code->ops;
+      constants = code->constants;
+      break;
+    }
+
+    case OP_LET: {
+      struct Scope *scope = atom_scope(constants[*pc++]);
+      Atom frame = make_frame(env, scope);
+      size_t i, n = scope->params;
+
+      for (i = 0; i < n; i++)
+        atom_frame(frame)->slots[i] = stack[sp - n + i];
+      sp -= n;
+      env = frames[fp - 1].env = frame;
+      break;
+    }
+
+    case OP_UNLET:
+      env = frames[fp - 1].env = atom_frame(env)->parent;
+      break;
+
+    case OP_CALL:
+    case OP_TAIL_CALL: {
+      int tail = pc[-1] == OP_TAIL_CALL;
+      size_t n = *pc++;
+      Atom fn;
+
+    call:
+      fn = stack[sp - n - 1];
+
+      if (atom_type(fn) == ATOM_CLOSURE) {
+        struct Code *callee;
+        Atom frame;
+
+        err = bind_stack(fn, n, &frame, &callee);
+        if (ERROR_RAISED(err))
+          goto fail;
+
+        if (tail) {
+          release_frame(frames[fp - 1].code, frames[fp - 1].env);
+          sp = frames[fp - 1].base;
+          frames[fp - 1].code = callee;
+          frames[fp - 1].env = frame;
+          err = reserve(callee->max_stack);
+        } else {
+          frames[fp - 1].pc = pc;
+          err = push_activation(callee, frame);
+        }
+        if (ERROR_RAISED(err))
+          goto fail;
+        code = callee;
+        pc = code->ops;
+        constants = code->constants;
+        env = frame;
+        break;
+      }
+
+      /* (APPLY f args) spreads args on the stack and calls f */
+      if (atom_type(fn) == ATOM_BUILTIN && atom_builtin(fn) == builtin_apply
+          && n == 2 && listp(stack[sp - 1])) {
+        Atom list = stack[sp - 1];
+
+        stack[sp - 3] = stack[sp - 2];
+        sp -= 2;
+        for (n = 0; !nilp(list); list = cdr(list), n++) {
+          err = reserve(1);
+          if (ERROR_RAISED(err))
+            goto fail;
+          stack[sp++] = car(list);
+        }
+        goto call;
+      }
+
+      if (atom_type(fn) == ATOM_BUILTIN) {
+        Atom args = nil, value;
+        size_t i;
+
+        if (!call_inline(atom_builtin(fn), n, &stack[sp - n], &value)) {
+          for (i = 0; i < n; i++)
+            args = cons(stack[sp - 1 - i], args);
+          err = (*atom_builtin(fn))(args, &value);
+          if (ERROR_RAISED(err))
+            goto fail;
+        }
+        sp -= n + 1;
+        stack[sp++] = value;
+      } else {
+        print_expr(fn);
+        err = ERROR(Error_Type, "Type must be closure.");
+        goto fail;
+      }
+
+      if (!tail)
+        break;
+    }
+      /* fall through */
+
+    case OP_RETURN: {
+      Atom value = stack[sp - 1];
+
+      fp--;
+      release_frame(frames[fp].code, frames[fp].env);
+      sp = frames[fp].base;
+      if (fp == entry) {
+        *result = value;
+        return ERROR_OK();
+      }
+
+      stack[sp++] = value;
+      code = frames[fp - 1].code;
+      pc = frames[fp - 1].pc;
+      env = frames[fp - 1].env;
+      constants = code->constants;
+      break;
+    }
+
+    case OP_FAIL:
+      err = make_error(pc[0], string_chars(constants[pc[1]]),
+          __FILE__, __FUNCTION__, __LINE__);
+      goto fail;
+    }
+  }
+
+fail:
+  sp = base;
+  fp = entry;
+  return err;
+}
+
+Error vm_eval(Atom expr, Atom env, Atom *result)
+{
+  struct Code *code;
+  Error err;
+
+  err = compile_thunk(expr, env, &code);
+  if (ERROR_RAISED(err))
+    return err;
+
+  return vm_run(code, env, result);
+}
+
+Error vm_apply(Atom fn, Atom args, Atom *result)
+{
+  size_t base = sp, n = 0;
+  struct Code *code;
+  Atom frame;
+  Error err;
+
+  err = reserve(1);
+  if (ERROR_RAISED(err))
+    return err;
+  stack[sp++] = fn;
+  for (; !nilp(args); args = cdr(args), n++) {
+    err = reserve(1);
+    if (ERROR_RAISED(err)) {
+      sp = base;
+      return err;
+    }
+    stack[sp++] = car(args);
+  }
+
+  err = bind_stack(fn, n, &frame, &code);
+  if (ERROR_RAISED(err)) {
+    sp = base;
+    return err;
+  }
+
+  return vm_run(code, frame, result);
+}
+
+void vm_mark(void)
+{
+  size_t i;
+
+  for (i = 0; i < sp; i++)
+    gc_mark(stack[i]);
+  for (i = 0; i < fp; i++) {
+    gc_mark(frames[i].env);
+    gc_mark_code(frames[i].code);
+  }
+}
@@ -5,26 +5,23 @@
 #include "readline.h"
 #include "cutie.h"
 
-/* static to enable readline completion */
-static Atom env;
-
 char* env_generator(const char* text, int state)
 {
     static int len;
-    static Atom bs;
- 
+    static size_t index;
+    Atom sym;
+
     if (!state) {
       len = strlen(text);
-      bs = cdr(env);
+      index = 0;
     }
 
-    while (!nilp(bs)) {
-      Atom b = car(bs);
-      if (strncasecmp(car(b).value.symbol, text, len) == 0) {
-        bs = cdr(bs);
-        return strdup(car(b).value.symbol);
+    /* Globals live in the symbols' value cells */
+    while (symbol_next(&index, &sym)) {
+      if (atom_symbol(sym)->bound &&
+          strncasecmp(atom_symbol(sym)->name, text, len) == 0) {
+        return strdup(atom_symbol(sym)->name);
       }
-      bs = cdr(bs);
     }
 
     return ((char *)NULL);
@@ -39,25 +36,67 @@ static char** env_completion(const char * text, int start, int end)
 }
 
 
+static int report(Error err)
+{
+  if (!ERROR_RAISED(err))
+    return 0;
+  print_error(err);
+  putchar('\n');
+  return 1;
+}
+
 int main(int argc, char **argv)
 {
-  env = setup_env();
+  Atom env = setup_env();
+  const char *image = NULL, *save_image = NULL;
+  int arg = 1;
+
+  for (; argc > arg; arg++) {
+    // Run on the bytecode VM instead of the tree walker
+    if (strcmp(argv[arg], "--vm") == 0)
+      cutie_engine(ENGINE_VM);
+    // Start from a saved heap image instead of library.lsp
+    else if (strcmp(argv[arg], "--image") == 0 && argc > arg + 1)
+      image = argv[++arg];
+    // Save the environment to an image once the script has run
+    else if (strcmp(argv[arg], "--save-image") == 0 && argc > arg + 1)
+      save_image = argv[++arg];
+    else
+      break;
+  }
 
-  // Execute file mode
-  if (argc > 1) {
-    const char *scriptname = argv[1];
-    int result = load_file(env, scriptname);
+  if (image && report(image_load(env, image)))
+    return 1;
+
+  // Execute file mode; "-" reads the script from standard input
+  if (argc > arg) {
+    const char *scriptname = argv[arg];
+    int result;
+
+    if (strcmp(scriptname, "-") == 0) {
+      struct Port *port = port_open_fd(0);
+      result = load_port(env, port);
+      port_close(port);
+    } else
+      result = load_file(env, scriptname);
+    if (save_image && result == 0)
+      result = report(image_save(env, save_image));
     return result;
   }
 
+  if (!image)
+    load_file(env, "library.lsp");
+
+  // With no script, save the library's environment
+  if (save_image)
+    return report(image_save(env, save_image));
+
   rl_attempted_completion_function = env_completion;
 
   // Interactive mode
   puts("CutieLisp Version 0.0.1");
   puts("Press Ctrl+c to Exit\n");
 
-  load_file(env, "library.lsp");
-
   char *input = 0;
   while (1) {
     if (input) { free(input); }
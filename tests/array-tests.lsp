@@ -0,0 +1,47 @@
+(load "library.lsp")
+(load "tests/test-lib.lsp")
+
+(define xs (list->array 'f64 '(1 2.5 -3 4)))
+(define ns (list->array 'i64 '(3 1 4 1 5)))
+(test-true (array? xs))
+(test-false (array? '(1 2)))
+(test-true (= (array-length xs) 4))
+(test-true (= (array-ref xs 1) 2.5))
+(test-true (= (array-ref ns 2) 4))
+(test-equal (array->list ns) '(3 1 4 1 5))
+
+(test-true (= (array-set! ns 0 9) 9))
+(test-true (= (array-ref ns 0) 9))
+(test-true (= (array-set! ns 1 2.7) 2))
+(test-true (= (array-ref (make-array 'f64 3 1.5) 2) 1.5))
+(test-true (= (array-ref (make-array 'i64 3) 0) 0))
+
+;; Reductions
+(test-true (= (array-sum xs) 4.5))
+(test-true (= (array-sum ns) 21))
+(test-true (= (array-min xs) -3))
+(test-true (= (array-max ns) 9))
+(test-false (array-min (make-array 'i64 0)))
+(test-true (= (array-dot xs xs) 32.25))
+(test-true (= (array-dot ns ns) 127))
+
+;; Elementwise operations make new arrays
+(test-equal (array->list (array-map+ ns ns)) '(18 4 8 2 10))
+(test-equal (array->list (array-scale ns 2)) '(18 4 8 2 10))
+(test-equal (array->list (array-scale ns 0.5)) '(4.5 1 2 0.5 2.5))
+(test-equal (array->list (array-scale xs 2)) '(2 5 -6 8))
+(define ys (list->array 'f64 '(1 3 -3 0)))
+(test-equal (array->list (array< xs ys)) '(0 1 0 0))
+(test-equal (array->list (array> xs ys)) '(0 0 0 1))
+(test-equal (array->list (array= xs ys)) '(1 0 1 0))
+
+(test-true (equal? (array-scale ns 1) ns))
+(test-false (eq? (array-scale ns 1) ns))
+
+;; Large arrays, across a collection
+(define big (make-array 'f64 100001 0.5))
+(define counts (make-array 'i64 100001 2))
+(gc)
+(test-true (= (array-sum big) 50000.5))
+(test-true (= (array-dot counts counts) 400004))
+(test-true (= (array-sum (array-map+ counts counts)) 400004))
@@ -1,3 +1,7 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+
 #include "contest.h"
 
 extern "C"
@@ -45,10 +49,10 @@ Error builtin_square(Atom args, Atom *result)
     return ERROR(Error::Error_Args, "Requires one arguments.");
 
   Atom a = car(args);
-  if (a.type != AtomType::ATOM_INTEGER)
+  if (atom_type(a) != AtomType::ATOM_INTEGER)
     return ERROR(Error::Error_Args, "Argument must be integer");
 
-  *result = make_integer(a.value.integer * a.value.integer);
+  *result = make_integer(atom_integer(a) * atom_integer(a));
   return ERROR_OK();
 }
 }
@@ -66,7 +70,322 @@ CONTEST_CASE(make_new_builtin)
 
   err = eval_expr(sexpr, env, &result);
   CONTEST_TRUE(!ERROR_RAISED(err));
-  CONTEST_EQUAL(result.value.integer, (long)144);
+  CONTEST_EQUAL(atom_integer(result), (long)144);
+}
+
+CONTEST_CASE(test_gc_reclaims_garbage)
+{
+  Atom kept = nil;
+  for (long i = 0; i < 1000; i++)
+    kept = cons(make_integer(i), kept);
+
+  for (long i = 0; i < 100000; i++)
+    cons(make_string("garbage"), nil);
+
+  CONTEST_TRUE(cutie_gc() > 0);
+
+  long sum = 0;
+  for (Atom p = kept; !nilp(p); p = cdr(p))
+    sum += atom_integer(car(p));
+  CONTEST_EQUAL(sum, (long)499500);
+}
+
+CONTEST_CASE(test_symbol_interning)
+{
+  Atom a = make_symbol("INTERNED");
+  for (int i = 0; i < 50000; i++)
+    make_symbol(("SYM-" + std::to_string(i)).c_str());
+
+  Atom b = make_symbol("INTERNED");
+  CONTEST_TRUE(atom_symbol(a) == atom_symbol(b));
+  CONTEST_TRUE(atom_symbol(make_symbol("SYM-1"))
+      != atom_symbol(make_symbol("SYM-10")));
+  CONTEST_EQUAL(atom_symbol(make_symbol("SYM-49999"))->length, (size_t)9);
+}
+
+CONTEST_CASE(test_vm_engine)
+{
+  Atom env = setup_env();
+  Atom sexpr, result;
+  Error err;
+
+  cutie_engine(ENGINE_VM);
+
+  const char *p = "(define (fact n) (if (= n 0) 1 (* n (fact (- n 1)))))";
+  err = read_expr(p, &p, &sexpr);
+  CONTEST_TRUE(!ERROR_RAISED(err));
+  err = eval_expr(sexpr, env, &result);
+  CONTEST_TRUE(!ERROR_RAISED(err));
+
+  p = "(fact 10)";
+  err = read_expr(p, &p, &sexpr);
+  CONTEST_TRUE(!ERROR_RAISED(err));
+  err = eval_expr(sexpr, env, &result);
+
+  cutie_engine(ENGINE_TREE);
+
+  CONTEST_TRUE(!ERROR_RAISED(err));
+  CONTEST_EQUAL(atom_integer(result), (long)3628800);
+}
+
+CONTEST_CASE(test_atom_accessors)
+{
+  Atom i = make_integer(-42);
+  Atom r = make_real(2.5);
+  Atom s = make_symbol("ACCESSORS");
+  Atom p = cons(i, r);
+
+  CONTEST_TRUE(atom_type(i) == ATOM_INTEGER);
+  CONTEST_EQUAL(atom_integer(i), (long)-42);
+  CONTEST_TRUE(atom_type(r) == ATOM_REAL);
+  CONTEST_TRUE(atom_real(r) == 2.5);
+  CONTEST_TRUE(atom_type(s) == ATOM_SYMBOL);
+  CONTEST_TRUE(atom_type(p) == ATOM_PAIR);
+  CONTEST_EQUAL(atom_integer(car(p)), (long)-42);
+  CONTEST_TRUE(atom_type(atom_retype(p, ATOM_CLOSURE)) == ATOM_CLOSURE);
+  CONTEST_TRUE(atom_pair(atom_retype(p, ATOM_CLOSURE)) == atom_pair(p));
+  CONTEST_TRUE(atom_type(make_real(0.0 / 0.0)) == ATOM_REAL);
+  CONTEST_TRUE(nilp(nil));
+#ifdef CUTIE_NAN_BOXING
+  CONTEST_EQUAL(sizeof(Atom), (size_t)8);
+  CONTEST_EQUAL(sizeof(struct Pair), (size_t)16);
+  CONTEST_TRUE(atom_type(make_integer(1L << 50)) == ATOM_REAL);
+#endif
+}
+
+CONTEST_CASE(test_make_list)
+{
+  Atom list = make_list(300);
+  long n = 0, adjacent = 0;
+
+  for (Atom p = list; !nilp(p); p = cdr(p)) {
+    CONTEST_TRUE(nilp(car(p)));
+    if (!nilp(cdr(p)) && atom_pair(cdr(p)) == atom_pair(p) + 1)
+      adjacent++;
+    n++;
+  }
+  CONTEST_EQUAL(n, (long)300);
+  CONTEST_TRUE(nilp(make_list(0)));
+#if !defined(CUTIE_PAIR_POOL) || CUTIE_PAIR_POOL
+  CONTEST_EQUAL(adjacent, (long)299);
+#endif
+
+  Atom copy = copy_list(list);
+  car(copy) = make_integer(1);
+  CONTEST_TRUE(nilp(car(list)));
+}
+
+CONTEST_CASE(test_vector_reader)
+{
+  Atom v;
+  const char *p = "#(1 \"two\" (3))";
+  Error err = read_expr(p, &p, &v);
+  CONTEST_TRUE(!ERROR_RAISED(err));
+  CONTEST_TRUE(atom_type(v) == ATOM_VECTOR);
+  CONTEST_EQUAL(atom_vector(v)->length, (size_t)3);
+
+  cutie_gc();
+  CONTEST_EQUAL(atom_integer(atom_vector(v)->items[0]), (long)1);
+  CONTEST_TRUE(atom_type(atom_vector(v)->items[1]) == ATOM_STRING);
+  CONTEST_TRUE(atom_type(atom_vector(v)->items[2]) == ATOM_PAIR);
+
+  p = "#(1 . 2)";
+  CONTEST_TRUE(ERROR_RAISED(read_expr(p, &p, &v)));
+}
+
+CONTEST_CASE(test_reader_atoms)
+{
+  Atom a;
+  const char *p = "(-42 +7 2.5 1e3 9223372036854775808 1e Foo nil ; note\n)";
+  Error err = read_expr(p, &p, &a);
+  CONTEST_TRUE(!ERROR_RAISED(err));
+
+  CONTEST_EQUAL(atom_integer(car(a)), (long)-42);
+  a = cdr(a);
+  CONTEST_EQUAL(atom_integer(car(a)), (long)7);
+  a = cdr(a);
+  CONTEST_TRUE(atom_real(car(a)) == 2.5);
+  a = cdr(a);
+  CONTEST_TRUE(atom_real(car(a)) == 1000.0);
+  a = cdr(a);
+  CONTEST_TRUE(atom_type(car(a)) == ATOM_REAL);
+  a = cdr(a);
+  CONTEST_TRUE(atom_symbol(car(a)) == atom_symbol(make_symbol("1E")));
+  a = cdr(a);
+  CONTEST_TRUE(atom_symbol(car(a)) == atom_symbol(make_symbol("FOO")));
+  a = cdr(a);
+  CONTEST_TRUE(nilp(car(a)));
+  CONTEST_TRUE(nilp(cdr(a)));
+
+  p = "\"open";
+  CONTEST_TRUE(ERROR_RAISED(read_expr(p, &p, &a)));
+}
+
+CONTEST_CASE(test_port_reader)
+{
+  char path[] = "/tmp/cutie-port-XXXXXX";
+  int fd = mkstemp(path);
+  CONTEST_TRUE(fd >= 0);
+
+  // Enough expressions, of every kind, that some straddle chunks
+  std::string text = "; leading comment\n";
+  for (int i = 0; i < 20000; i++)
+    text += "(add " + std::to_string(i) + " \"s t\\\"r\") 'q #(1 2) sym\n";
+  text += "\"" + std::string(200000, 'x') + "\"\n; trailing comment";
+  CONTEST_TRUE(write(fd, text.data(), text.size()) == (ssize_t)text.size());
+  close(fd);
+
+  // Parsed in place from a mapping, then streamed through a descriptor
+  for (int mapped = 1; mapped >= 0; mapped--) {
+    int rfd = mapped ? -1 : open(path, O_RDONLY);
+    struct Port *port = mapped ? port_open_file(path) : port_open_fd(rfd);
+    CONTEST_TRUE(port != NULL);
+
+    Atom expr;
+    long lists = 0, quotes = 0, vectors = 0, symbols = 0, sum = 0;
+    size_t last_string = 0;
+    while (!ERROR_RAISED(port_read(port, &expr))) {
+      if (atom_type(expr) == ATOM_PAIR && atom_type(car(expr)) == ATOM_SYMBOL
+          && strcmp(atom_symbol(car(expr))->name, "QUOTE") == 0)
+        quotes++;
+      else if (atom_type(expr) == ATOM_PAIR) {
+        lists++;
+        sum += atom_integer(car(cdr(expr)));
+        CONTEST_EQUAL(atom_string(car(cdr(cdr(expr))))->length, (size_t)6);
+      } else if (atom_type(expr) == ATOM_VECTOR)
+        vectors++;
+      else if (atom_type(expr) == ATOM_SYMBOL)
+        symbols++;
+      else if (atom_type(expr) == ATOM_STRING)
+        last_string = atom_string(expr)->length;
+    }
+    port_close(port);
+    if (rfd >= 0)
+      close(rfd);
+
+    CONTEST_EQUAL(lists, 20000L);
+    CONTEST_EQUAL(quotes, 20000L);
+    CONTEST_EQUAL(vectors, 20000L);
+    CONTEST_EQUAL(symbols, 20000L);
+    CONTEST_EQUAL(sum, 199990000L);
+    CONTEST_EQUAL(last_string, (size_t)200000);
+  }
+  unlink(path);
+}
+
+static long read_first_integer(const char *path)
+{
+  struct Port *port = port_open_file(path);
+  Atom expr = nil;
+  if (!port)
+    return -1;
+  Error err = port_read(port, &expr);
+  port_close(port);
+  return ERROR_RAISED(err) ? -1 : atom_integer(expr);
+}
+
+CONTEST_CASE(test_mapped_reload)
+{
+  char path[] = "/tmp/cutie-map-XXXXXX";
+  int fd = mkstemp(path);
+  CONTEST_TRUE(fd >= 0);
+  CONTEST_TRUE(write(fd, "1 2", 3) == 3);
+  close(fd);
+
+  // The second load shares the first one's mapping
+  CONTEST_EQUAL(read_first_integer(path), 1L);
+  CONTEST_EQUAL(read_first_integer(path), 1L);
+
+  // A rewritten file is mapped afresh
+  FILE *f = fopen(path, "w");
+  fputs("22 3", f);
+  fclose(f);
+  CONTEST_EQUAL(read_first_integer(path), 22L);
+
+  // One that fills its last page has no NUL after it and is streamed
+  std::string text = "333" + std::string(sysconf(_SC_PAGESIZE) - 3, ' ');
+  f = fopen(path, "w");
+  fwrite(text.data(), 1, text.size(), f);
+  fclose(f);
+  CONTEST_EQUAL(read_first_integer(path), 333L);
+  unlink(path);
+}
+
+CONTEST_CASE(test_mapped_truncated)
+{
+  char path[] = "/tmp/cutie-trunc-XXXXXX";
+  int fd = mkstemp(path);
+  CONTEST_TRUE(fd >= 0);
+
+  // Several pages of source, so the text past the first read is mapped
+  std::string text = "1";
+  while (text.size() < 4 * (size_t)sysconf(_SC_PAGESIZE))
+    text += " (list 2 \"three\" four)";
+  CONTEST_TRUE(write(fd, text.data(), text.size()) == (ssize_t)text.size());
+  close(fd);
+
+  struct Port *port = port_open_file(path);
+  CONTEST_TRUE(port != NULL);
+  Atom expr = nil;
+  CONTEST_TRUE(!ERROR_RAISED(port_read(port, &expr)));
+  CONTEST_EQUAL(atom_integer(expr), 1L);
+
+  // Cutting the file short under the port is an I/O error, not a SIGBUS
+  CONTEST_TRUE(truncate(path, 0) == 0);
+  Error err = port_read(port, &expr);
+  CONTEST_TRUE(err.type == Error::Error_IO);
+  CONTEST_TRUE(ERROR_RAISED(port_read(port, &expr)));
+  port_close(port);
+
+  // The file is mapped afresh once it has been written again
+  FILE *f = fopen(path, "w");
+  fputs("44", f);
+  fclose(f);
+  CONTEST_EQUAL(read_first_integer(path), 44L);
+  unlink(path);
+}
+
+static Atom eval_string(Atom env, const char *p)
+{
+  Atom sexpr, result = nil;
+  if (!ERROR_RAISED(read_expr(p, &p, &sexpr)))
+    eval_expr(sexpr, env, &result);
+  return result;
+}
+
+CONTEST_CASE(test_heap_image)
+{
+  char path[] = "/tmp/cutie-image-XXXXXX";
+  int fd = mkstemp(path);
+  CONTEST_TRUE(fd >= 0);
+  close(fd);
+
+  Atom env = setup_env();
+  eval_string(env, "(define img-add (let ((k 5)) (lambda (x) (+ x k))))");
+  eval_string(env, "(define img-vec (vector 1 \"two\" '(3)))");
+  eval_string(env, "(define img-table (make-hash-table))");
+  eval_string(env, "(hash-set! img-table '(a b) \"ab\")");
+  eval_string(env, "(define img-rope (string-concat (string-substr "
+      "\"a string long enough for a rope\" 2) \" and some more of it\"))");
+  CONTEST_TRUE(!ERROR_RAISED(image_save(env, path)));
+
+  // Forget the bindings, then take them back from the image
+  eval_string(env, "(set! img-add nil)");
+  eval_string(env, "(set! img-vec nil)");
+  eval_string(env, "(set! img-table nil)");
+  eval_string(env, "(set! img-rope nil)");
+  CONTEST_TRUE(!ERROR_RAISED(image_load(env, path)));
+  cutie_gc();
+  unlink(path);
+
+  CONTEST_EQUAL(atom_integer(eval_string(env, "(img-add 10)")), 15L);
+  CONTEST_EQUAL(atom_integer(eval_string(env, "(vector-length img-vec)")), 3L);
+  CONTEST_EQUAL(atom_integer(eval_string(env,
+      "(string-length (hash-ref img-table '(a b)))")), 2L);
+  CONTEST_EQUAL(atom_integer(eval_string(env, "(string-length img-rope)")),
+      49L);
+
+  CONTEST_TRUE(ERROR_RAISED(image_load(env, "/nonexistent/cutie.img")));
 }
 
 CONTEST_SUITE_END
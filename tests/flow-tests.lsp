@@ -20,3 +20,45 @@
 
 
 (test-false (when T nil))
+(test-true (when T nil T))
+(test-false (unless T T))
+(test-true (unless nil nil T))
+(test-false (when nil (error "WHEN evaluated its body")))
+
+;; AND and OR give the value that decided them and stop there
+(test-true (= (and 1 2 3) 3))
+(test-true (= (or nil 2 3) 2))
+(test-false (and nil (error "AND did not stop")))
+(test-true (or T (error "OR did not stop")))
+
+;; COND
+(test-true (= (cond (nil 1) (2)) 2))
+(test-true (= (cond ((= 1 2) 1) ((= 1 1) 2 3)) 3))
+
+;; LET binds in a frame of its own
+(define x 1)
+(test-true (= (let ((x 2) (y x)) (+ x y)) 3))
+(test-true (= x 1))
+(test-false (let ((z)) z))
+(test-true (= (let ((a 1)) (let ((b (+ a 1))) (+ a b))) 3))
+(test-true (= (let ((a 1)) (define b 2) (+ a b)) 3))
+
+(define (scaled n)
+  (let ((factor 10))
+    (* n factor)))
+(test-true (= (scaled 4) 40))
+
+;; each LET makes new bindings for the closures made inside it
+(define (collect n acc)
+  (if (= n 0)
+    acc
+    (let ((k n))
+      (collect (- n 1) (cons (lambda () k) acc)))))
+(test-true (= (foldl + 0 (map (lambda (f) (f)) (collect 3 nil))) 6))
+
+;; LET, COND, AND, OR, WHEN and UNLESS keep tail calls
+(define (spin n)
+  (let ((m (- n 1)))
+    (cond ((= m 0) 'done)
+          (T (and T (or nil (when T (unless nil (spin m)))))))))
+(test-true (eq? (spin 100000) 'done))
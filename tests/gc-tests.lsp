@@ -0,0 +1,18 @@
+(load "library.lsp")
+(load "tests/test-lib.lsp")
+
+(define (make-garbage n)
+  (while (> n 0)
+    (progn
+      (list n n n n)
+      (set! n (- n 1)))))
+
+(define kept (list 1 2 3 4 5))
+(make-garbage 20000)
+(test-true (> (gc) 0))
+(test-true (= (length kept) 5))
+
+(gc-threshold 4096)
+(make-garbage 2000)
+(test-true (= (nth 4 kept) 5))
+(test-true (= (gc-threshold) 4096))
@@ -0,0 +1,70 @@
+(load "library.lsp")
+(load "tests/test-lib.lsp")
+
+;; EQUAL? compares structure
+(test-true (equal? '(1 (2 "three") 4.5) (list 1 (list 2 "three") 4.5)))
+(test-false (equal? '(1 2) '(1 2 3)))
+(test-true (equal? "abc" (string-concat "ab" "c")))
+(test-true (equal? #(1 (2)) (vector 1 '(2))))
+(test-false (equal? 1 1.0))
+(test-true (equal? 'a 'a))
+
+(define h (make-hash-table))
+(test-true (hash-table? h))
+(test-false (hash-table? '((a . 1))))
+(test-true (= (hash-count h) 0))
+(test-false (hash-ref h 'missing))
+(test-true (= (hash-ref h 'missing 7) 7))
+
+;; Symbols, strings, numbers and lists as keys
+(hash-set! h 'sym 1)
+(hash-set! h "str" 2)
+(hash-set! h 42 3)
+(hash-set! h '(a (b)) 4)
+(test-true (= (hash-ref h 'sym) 1))
+(test-true (= (hash-ref h (string-concat "s" "tr")) 2))
+(test-true (= (hash-ref h 42) 3))
+(test-true (= (hash-ref h (list 'a (list 'b))) 4))
+(test-true (= (hash-count h) 4))
+
+;; Setting an existing key replaces its value
+(test-true (= (hash-set! h 'sym 10) 10))
+(test-true (= (hash-ref h 'sym) 10))
+(test-true (= (hash-count h) 4))
+
+(test-true (hash-remove! h 42))
+(test-false (hash-remove! h 42))
+(test-false (hash-ref h 42))
+(test-true (= (hash-count h) 3))
+(test-true (= (length (hash-keys h)) 3))
+(test-true (= (length (hash->list h)) 3))
+
+;; Iteration sees every entry
+(define total 0)
+(hash-for-each h (lambda (k v) (set! total (+ total v))))
+(test-true (= total 16))
+
+;; Many entries, looked up and removed while the table grows
+(define big (make-hash-table))
+(define (fill i n)
+  (when (< i n)
+    (hash-set! big i (* i 2))
+    (fill (+ i 1) n)))
+(fill 0 50000)
+(test-true (= (hash-count big) 50000))
+(test-true (= (hash-ref big 31337) 62674))
+(define (check i n)
+  (cond ((= i n) t)
+        ((= (hash-ref big i) (* i 2)) (check (+ i 1) n))
+        (t nil)))
+(test-true (check 0 50000))
+(define (drop i n)
+  (when (< i n)
+    (hash-remove! big i)
+    (drop (+ i 2) n)))
+(drop 0 50000)
+(gc)
+(test-true (= (hash-count big) 25000))
+(test-false (hash-ref big 100))
+(test-true (= (hash-ref big 101) 202))
+(test-true (= (length (hash-keys big)) 25000))
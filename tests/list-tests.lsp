@@ -1,8 +1,76 @@
 (load "library.lsp")
 (load "tests/test-lib.lsp")
 
-(test-equal (length (list 1 2)) 2)
-(test-equal (length (list 1 2 3 4 5)) 5)
+(test-true (= (length (list 1 2)) 2))
+(test-true (= (length (list 1 2 3 4 5)) 5))
+(test-true (= (length nil) 0))
 
 (define (ss x) (* x x))
-(test-equal (map ss (list 1 2)) (2 4))
+(test-equal (map ss (list 1 2)) '(1 4))
+(test-equal (map + '(1 2 3) '(10 20 30)) '(11 22 33))
+(test-false (map ss nil))
+
+(test-equal (reverse '(1 2 3)) '(3 2 1))
+(test-equal (append '(1 2) '(3 4)) '(1 2 3 4))
+(test-equal (append '(1) '(2) '(3 4)) '(1 2 3 4))
+(test-false (append))
+(define tail '(3 4))
+(test-true (eq? (cdr (cdr (append '(1 2) tail))) tail))
+
+(test-true (= (nth 0 '(5 6 7)) 5))
+(test-true (= (nth 2 '(5 6 7)) 7))
+(test-false (nth 3 '(5 6 7)))
+(test-true (= (last '(5 6 7)) 7))
+(test-false (last nil))
+
+(test-true (= (foldl - 0 '(1 2 3)) -6))
+(test-true (= (foldr - 0 '(1 2 3)) 2))
+(test-equal (foldr cons nil '(1 2 3)) '(1 2 3))
+
+;; APPLY on LIST must not share the argument list
+(define items '(1 2 3))
+(test-false (eq? (apply list items) items))
+
+;; Long lists do not use stack in proportion to their length
+(define (iota n)
+  (define (loop n acc) (if (= n 0) acc (loop (- n 1) (cons n acc))))
+  (loop n nil))
+(define big (iota 200000))
+(test-true (= (length big) 200000))
+(test-true (= (foldr + 0 big) 20000100000))
+(test-true (= (length (map ss big)) 200000))
+(test-true (= (car (reverse big)) 200000))
+
+;; Lists laid out in one run still behave like consed ones
+(define built (append '(1 2 3) '(4)))
+(test-equal built '(1 2 3 4))
+(test-equal (cons 0 (cdr built)) '(0 2 3 4))
+(test-equal (map + '(1 2 3) '(10 20 30)) '(11 22 33))
+(test-equal (map car '((1) (2))) '(1 2))
+(test-false (map car nil))
+(test-equal (append big '(0)) (append (iota 200000) '(0)))
+(test-true (= (cdr (cdr '(1 2 . 3))) 3))
+
+;; The reader lays out lists longer than its on-stack buffer
+(define read-long '(1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20
+                    21 22 23 24 25 26 27 28 29 30 31 32 33 34))
+(test-true (= (length read-long) 34))
+(test-true (= (nth 33 read-long) 34))
+(test-equal read-long (iota 34))
+
+;; A tail in the middle of a read run is shared like any other
+(define (drop n xs) (if (= n 0) xs (drop (- n 1) (cdr xs))))
+(define read-tail (drop 20 read-long))
+(test-true (eq? (cdr (cons 0 read-tail)) read-tail))
+(test-true (eq? (cdr (append '(0) read-tail)) read-tail))
+(test-true (= (length (append '(0) read-tail)) 15))
+
+;; Nested lists each get their own run, however long the outer one is
+(define read-nested '((1 2) (3 (4 5 6 7 8 9 10 11 12 13 14 15 16 17 18)) 19))
+(test-true (= (length read-nested) 3))
+(test-true (= (length (car (cdr (nth 1 read-nested)))) 15))
+(test-true (= (nth 2 read-nested) 19))
+
+(define read-dotted '(1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 . 18))
+(test-true (= (nth 16 read-dotted) 17))
+(test-true (= (drop 17 read-dotted) 18))
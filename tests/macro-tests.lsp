@@ -0,0 +1,52 @@
+(load "library.lsp")
+(load "tests/test-lib.lsp")
+
+; each call site is expanded once
+(define expansions 0)
+(defmacro (counted x)
+  (set! expansions (+ expansions 1))
+  x)
+(define (use-counted n) (counted n))
+(use-counted 1)
+(use-counted 2)
+(use-counted 3)
+(test-true (= expansions 1))
+
+(define i 0)
+(while (< i 10)
+  (set! i (counted (+ i 1))))
+(test-true (= expansions 2))
+
+; redefining the macro expands the call sites again
+(defmacro (counted x)
+  (set! expansions (+ expansions 1))
+  (list '+ x 100))
+(test-true (= (use-counted 1) 101))
+(test-true (= expansions 3))
+
+; a macro name rebound to a function is called as one
+(defmacro (shape x) ''macro)
+(define (use-shape) (shape 1))
+(test-true (eq? (use-shape) 'macro))
+(define (shape x) 'function)
+(test-true (eq? (use-shape) 'function))
+
+; macro calls in a body are expanded when the closure is made
+(define made 0)
+(defmacro (noted x)
+  (set! made (+ made 1))
+  x)
+(define (use-noted n) (noted n))
+(test-true (= made 1))
+(use-noted 1)
+(test-true (= made 1))
+
+; macroexpand-all leaves only special forms and calls
+(defmacro (my-when c . body) `(if ,c (progn ,@body) nil))
+(test-true (eq? (car (macroexpand-all '(my-when a b))) 'if))
+(test-true (eq? (car (cadr (macroexpand-all '(progn (my-when a b))))) 'if))
+(test-true (eq? (car (macroexpand-all '(when a b))) 'when))
+(test-true (eq? (car (car (cddr (macroexpand-all '(lambda (my-when) (my-when 1 2))))))
+                'my-when))
+(test-true (eq? (car (car (cddr (macroexpand-all '(let ((my-when 1)) (my-when 1 2))))))
+                'my-when))
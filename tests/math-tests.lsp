@@ -0,0 +1,63 @@
+(load "library.lsp")
+(load "tests/test-lib.lsp")
+
+;; Variadic arithmetic
+(test-true (= (+) 0))
+(test-true (= (*) 1))
+(test-true (= (+ 1 2 3 4) 10))
+(test-true (= (* 1 2 3 4) 24))
+(test-true (= (- 10 1 2 3) 4))
+(test-true (= (- 5) -5))
+(test-true (= (/ 100 5 2) 10))
+(test-true (= (/ 2) 0))
+(test-true (= (/ 2.0) 0.5))
+
+;; Mixed integers and reals
+(test-true (= (+ 1 2.5) 3.5))
+(test-true (= (* 2 0.5 4) 4.0))
+(test-true (= (/ 7 2) 3))
+(test-true (= (/ 7 2.0) 3.5))
+(test-true (= 1 1.0))
+
+;; Chained comparisons
+(test-true (< 1 2 3))
+(test-false (< 1 3 2))
+(test-true (< 1 1.5 2))
+(test-true (> 3 2 1))
+(test-false (> 1 1))
+(test-true (<= 1 1 2))
+(test-false (<= 2 1))
+(test-true (>= 2 2 1.5))
+(test-false (>= 1 2))
+(test-true (= 2 2 2))
+(test-false (= 2 2 3))
+
+;; Builtins taken as values
+(test-true (= (foldl + 0 (list 1 2 3)) 6))
+(test-true (= (apply * (list 2 3 4)) 24))
+
+;; EQ? on numbers compares values of the same type
+(test-true (eq? 1 1))
+(test-false (eq? 1 2))
+(test-false (eq? -1 1))
+(test-true (eq? 1.5 1.5))
+(test-false (eq? 1.5 2.5))
+
+;; Integer results too wide for a fixnum become reals instead of wrapping
+(define most -9223372036854775807)
+(define least (- most 1))
+(test-true (= (/ least -1) 9223372036854775808.0))
+(test-true (= (- least) 9223372036854775808.0))
+(test-true (= (+ (- most) 1) 9223372036854775808.0))
+(test-true (= (- least 1) -9223372036854775809.0))
+(test-true (= (* least 2) -18446744073709551616.0))
+(test-true (= (* 4294967296 4294967296) 18446744073709551616.0))
+(test-true (= (+ least 1) most))
+(test-true (= (/ least 1) least))
+(define (add2 a b) (+ a b))
+(define (sub2 a b) (- a b))
+(define (mul2 a b) (* a b))
+(test-true (= (add2 most (- most)) 0))
+(test-true (= (add2 (- most) 1) 9223372036854775808.0))
+(test-true (= (sub2 least 1) -9223372036854775809.0))
+(test-true (= (mul2 4294967296 4294967296) 18446744073709551616.0))
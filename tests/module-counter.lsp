@@ -0,0 +1,3 @@
+;; Loaded by module-tests.lsp, which counts how often
+(set! module-loads (+ module-loads 1))
+(provide 'module-counter)
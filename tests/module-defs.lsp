@@ -0,0 +1,2 @@
+;; Required from inside a function by module-tests.lsp
+(define (module-double x) (* 2 x))
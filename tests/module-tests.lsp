@@ -0,0 +1,38 @@
+(load "library.lsp")
+(load "tests/test-lib.lsp")
+
+(define module-loads 0)
+
+;; REQUIRE evaluates a file once, however its path is spelled
+(test-true (require "tests/module-counter.lsp"))
+(test-true (= module-loads 1))
+(test-false (require "tests/module-counter.lsp"))
+(test-false (require "./tests/../tests/module-counter.lsp"))
+(test-true (= module-loads 1))
+
+;; The file provided its feature
+(test-false (require 'module-counter))
+(test-false (require 'module-counter "tests/no-such-file.lsp"))
+(test-true (= module-loads 1))
+
+;; PROVIDE names a feature without loading anything
+(test-true (eq? (provide 'in-line-feature) 'in-line-feature))
+(test-false (require 'in-line-feature))
+
+;; LOAD still evaluates the file every time...
+(load "tests/module-counter.lsp")
+(test-true (= module-loads 2))
+
+;; ...unless *LOAD-ONCE* is set, when an unchanged file is skipped
+(set! *load-once* t)
+(load "tests/module-counter.lsp")
+(test-true (= module-loads 2))
+(set! *load-once* nil)
+(load "tests/module-counter.lsp")
+(test-true (= module-loads 3))
+
+;; A module required from inside a function is defined at top level
+(define (setup-modules) (require "tests/module-defs.lsp"))
+(test-true (setup-modules))
+(test-false (require "tests/module-defs.lsp"))
+(test-true (= (module-double 21) 42))
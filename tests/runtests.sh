@@ -32,4 +32,20 @@ do
         fi
     fi
 done
+
+echo "LISP TESTS (VM)" >> tests/tests.log
+
+for i in tests/*-tests.lsp
+do
+    if test -f $i
+    then
+        echo "$i --vm" >> tests/tests.log
+        if ./bin/cutie --vm ./$i 2>&1 | tee -a tests/tests.log | grep "test failed!"
+        then
+            echo $i --vm FAILED
+        else
+            echo $i --vm PASS
+        fi
+    fi
+done
 echo ""
@@ -0,0 +1,45 @@
+(load "library.lsp")
+(load "tests/test-lib.lsp")
+
+(define (make-counter)
+  (define count 0)
+  (lambda ()
+    (set! count (+ count 1))
+    count))
+
+(define c1 (make-counter))
+(define c2 (make-counter))
+(c1)
+(c1)
+(test-true (= (c1) 3))
+(test-true (= (c2) 1))
+
+(define x 10)
+(define (shadow x) (+ x 1))
+(test-true (= (shadow 1) 2))
+(test-true (= x 10))
+
+(define (adder n) (lambda (m) (+ n m)))
+(test-true (= ((adder 3) 4) 7))
+
+(define (rest-args a . more) (cons a more))
+(test-true (= (length (rest-args 1 2 3)) 3))
+(test-true (null? (cdr (rest-args 1))))
+
+(define (with-let a)
+  (let ((b (* a 2)))
+    (let ((c (+ a b)))
+      (+ a b c))))
+(test-true (= (with-let 1) 6))
+
+(define (late-define)
+  (define y 5)
+  (set! y (+ y 1))
+  y)
+(test-true (= (late-define) 6))
+(test-true (= (late-define) 6))
+
+(define (outer-set!)
+  (set! x 42))
+(outer-set!)
+(test-true (= x 42))
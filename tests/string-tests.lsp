@@ -0,0 +1,70 @@
+(load "library.lsp")
+(load "tests/test-lib.lsp")
+
+(test-true (= (string-length "") 0))
+(test-true (= (string-length "hello") 5))
+(test-true (string-equal (string-concat) ""))
+(test-true (string-equal (string-concat "ab") "ab"))
+(test-true (string-equal (string-concat "ab" "" "cd" "e") "abcde"))
+
+;; Substrings
+(test-true (string-equal (string-substr "hello world" 6 5) "world"))
+(test-true (string-equal (string-substr "hello world" 6) "world"))
+(test-true (string-equal (string-substr "hello world" 0 5) "hello"))
+(test-true (string-equal (string-substr (string-substr "hello world" 3 6) 1 3) "o w"))
+(test-true (= (string-length (string-substr "hello" 2 0)) 0))
+(test-false (string-lessp "abc" "abc"))
+(test-true (= (string-lessp (string-substr "xabd" 1 3) "abz") 2))
+
+;; Long strings built up a piece at a time
+(define (repeat s n)
+  (define (loop acc n) (if (= n 0) acc (loop (string-concat acc s) (- n 1))))
+  (loop "" n))
+(define long (repeat "0123456789" 20000))
+(test-true (= (string-length long) 200000))
+(test-true (string-equal (string-substr long 199990 10) "0123456789"))
+(test-true (string-equal (string-substr long 12345 3) "567"))
+(define (repeat-right s n)
+  (define (loop acc n) (if (= n 0) acc (loop (string-concat s acc) (- n 1))))
+  (loop "" n))
+(define long2 (repeat-right "0123456789" 20000))
+(gc)
+(test-true (string-equal long long2))
+(test-true (equal? long long2))
+
+;; Slices and concatenations are strings like any other
+(define h (make-hash-table))
+(hash-set! h (string-concat "ke" "y") 1)
+(test-true (= (hash-ref h (string-substr "a key" 2 3)) 1))
+(test-true (eq? (string-substr "abcdef" 1 2) "bc"))
+
+;; Searching
+(define line "2024-01-05 ERROR disk full; retry=3; host=db1")
+(test-true (= (string-search line "ERROR") 11))
+(test-false (string-search line "WARN"))
+(test-true (= (string-search line "=" 40) 41))
+(test-true (= (string-search line "") 0))
+(test-false (string-search "ab" "abc"))
+(test-true (= (string-index line ";") 26))
+(test-true (= (string-index line "=;" 27) 33))
+(test-false (string-index line "!"))
+(test-true (= (string-search (string-concat (repeat "ab" 20) "abc") "abc") 40))
+
+;; Splitting
+(define fields (string-split line "; "))
+(test-true (= (length fields) 3))
+(test-true (string-equal (car fields) "2024-01-05 ERROR disk full"))
+(test-true (string-equal (nth 2 fields) "host=db1"))
+(test-true (= (length (string-split "a,,b," ",")) 4))
+(test-true (string-equal (nth 1 (string-split "a,,b," ",")) ""))
+(test-true (= (length (string-split "" ",")) 1))
+
+;; Counting and replacing
+(test-true (= (string-count line "=") 2))
+(test-true (= (string-count "aaaa" "aa") 2))
+(test-true (= (string-count "abc" "x") 0))
+(test-true (string-equal (string-replace "a-b-c" "-" "+") "a+b+c"))
+(test-true (string-equal (string-replace "abcabc" "bc" "") "aa"))
+(test-true (string-equal (string-replace "abc" "x" "y") "abc"))
+(test-true (string-equal (string-replace "xx" "x" "yy") "yyyy"))
+(test-true (= (string-count (string-replace long "0" "00") "0") 40000))
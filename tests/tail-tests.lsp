@@ -0,0 +1,32 @@
+(load "library.lsp")
+(load "tests/test-lib.lsp")
+
+(define (count-down n)
+  (if (= n 0)
+    'done
+    (count-down (- n 1))))
+(test-true (eq? (count-down 100000) 'done))
+
+(define (even? n) (if (= n 0) T (odd? (- n 1))))
+(define (odd? n) (if (= n 0) nil (even? (- n 1))))
+(test-true (even? 100000))
+
+(define (range n acc)
+  (if (= n 0)
+    acc
+    (range (- n 1) (cons n acc))))
+(define big (range 100000 nil))
+
+(test-true (= (last big) 100000))
+(test-true (= (nth 99999 big) 100000))
+(test-true (= (foldl (lambda (a x) (+ a 1)) 0 big) 100000))
+
+(define (progn-loop n)
+  (progn
+    nil
+    (if (= n 0) T (progn-loop (- n 1)))))
+(test-true (progn-loop 100000))
+
+(define (apply-loop n)
+  (if (= n 0) T (apply apply-loop (list (- n 1)))))
+(test-true (apply-loop 100000))
@@ -0,0 +1,42 @@
+(load "library.lsp")
+(load "tests/test-lib.lsp")
+
+(define v (make-vector 3 0))
+(test-true (vector? v))
+(test-false (vector? '(1 2)))
+(test-true (= (vector-length v) 3))
+(test-true (= (vector-ref v 2) 0))
+(test-true (= (vector-set! v 1 42) 42))
+(test-true (= (vector-ref v 1) 42))
+(test-false (vector-ref (make-vector 2) 0))
+(test-true (= (vector-length (make-vector 0)) 0))
+
+;; Conversions
+(test-equal (vector->list (vector 1 2 3)) '(1 2 3))
+(test-equal (vector->list (list->vector '(4 5))) '(4 5))
+(test-false (vector->list (vector)))
+
+;; Literals read as vectors and evaluate to themselves
+(define lit #(1 (2 3) 4))
+(test-true (vector? lit))
+(test-true (= (vector-length lit) 3))
+(test-equal (vector-ref lit 1) '(2 3))
+(test-true (vector? (car '(#()))))
+
+;; Vectors are compared by identity
+(test-true (eq? v v))
+(test-false (eq? (vector 1) (vector 1)))
+
+;; Indexing is constant time, so filling a large table is linear
+(define (fill-squares n)
+  (define table (make-vector n 0))
+  (define i 0)
+  (while (< i n)
+    (progn
+      (vector-set! table i (* i i))
+      (set! i (+ i 1))))
+  table)
+(define squares (fill-squares 100000))
+(test-true (= (vector-ref squares 99999) 9999800001))
+(gc)
+(test-true (= (vector-ref squares 300) 90000))
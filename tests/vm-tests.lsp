@@ -0,0 +1,39 @@
+(load "library.lsp")
+(load "tests/test-lib.lsp")
+
+; redefining a macro expands its call sites again
+(defmacro (twice x) `(+ ,x ,x))
+(define (use-twice n) (twice n))
+(test-true (= (use-twice 3) 6))
+(defmacro (twice x) `(* ,x ,x))
+(test-true (= (use-twice 3) 9))
+
+; an operator that only becomes a macro after its caller is defined
+(define (use-later n) (later n))
+(defmacro (later x) `(- ,x 1))
+(test-true (= (use-later 5) 4))
+
+; macros whose expansion depends on runtime data
+(test-true (and T T T))
+(test-false (and T nil T))
+(test-true (or nil nil T))
+
+; deep recursion that is not in tail position
+(define (count-up n)
+  (if (= n 0)
+    0
+    (+ 1 (count-up (- n 1)))))
+(test-true (= (count-up 10000) 10000))
+
+; rest arguments and apply
+(define (count-args . args) (length args))
+(test-true (= (count-args 1 2 3) 3))
+(test-true (= (apply count-args '(1 2 3 4)) 4))
+
+; closures keep their frame alive after the call returns
+(define (make-counter)
+  (define n 0)
+  (lambda () (set! n (+ n 1)) n))
+(define counter (make-counter))
+(counter)
+(test-true (= (counter) 2))